@@ -0,0 +1,42 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../ffvship_utility/CLI_Parser.hpp"
+
+//What vshipbench and vshipkernelbench share: their command line handling and the JSON of their reports.
+
+namespace bench{
+
+//unlike FFVship every option has a default, no arguments runs the benchmark instead of printing the help.
+//-1 when the benchmark should run, otherwise the exit code of the program (0 after the help)
+inline int parseArgs(helper::ArgParser& parser, int argc, char** argv){
+    std::vector<std::string> args(argv, argv + argc);
+    const int parsed = argc > 1 ? parser.parse_cli_args(args) : 0;
+    if (parsed == 2) return 0;
+    if (parsed != 0) return 1;
+    return -1;
+}
+
+//comma separated list, empty entries are skipped
+inline std::vector<std::string> splitList(const std::string& list){
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) if (!item.empty()) items.push_back(item);
+    return items;
+}
+
+inline std::string jsonString(const std::string& text){
+    std::string out = "\"";
+    for (const char c : text){
+        if (c == '"' || c == '\\') out.push_back('\\');
+        if ((unsigned char)c < 0x20) continue;
+        out.push_back(c);
+    }
+    return out + "\"";
+}
+
+}
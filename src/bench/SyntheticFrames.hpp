@@ -0,0 +1,189 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../util/preprocessor.hpp"
+
+//Deterministic reference/distorted frame pairs for the benchmarks. The random parts come from a fixed
+//seed, so two runs (or two releases) on the same platform score exactly the same pixels.
+
+namespace bench{
+
+enum class Pattern {Noise, Gradient, Blocky};
+
+inline const char* patternName(Pattern pattern){
+    switch (pattern){
+        case Pattern::Noise: return "noise";
+        case Pattern::Gradient: return "gradient";
+        case Pattern::Blocky: return "blocky";
+    }
+    return "";
+}
+
+inline const char* inputTypeName(InputMemType type){
+    switch (type){
+        case UINT16: return "uint16";
+        case HALF: return "half";
+        case FLOAT: return "float";
+    }
+    return "";
+}
+
+inline int64_t inputTypeSize(InputMemType type){
+    return type == FLOAT ? 4 : 2;
+}
+
+struct Resolution{
+    const char* name;
+    int64_t width;
+    int64_t height;
+};
+
+inline const std::vector<Resolution>& standardResolutions(){
+    static const std::vector<Resolution> resolutions = {
+        {"480p", 854, 480}, {"1080p", 1920, 1080}, {"4k", 3840, 2160}, {"8k", 7680, 4320}};
+    return resolutions;
+}
+
+//splitmix64, cheap and the same on every platform
+class Random{
+    uint64_t state;
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+    uint64_t next(){
+        uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+    //in [0, 1)
+    float uniform(){
+        return (next() >> 40) * (1.0f / (1 << 24));
+    }
+    //sum of uniforms, about normal with mean 0 and variance 1
+    float normal(){
+        return uniform() + uniform() + uniform() + uniform() - 2.0f;
+    }
+};
+
+//planar RGB in [0, 1]
+struct FramePair{
+    int64_t width = 0;
+    int64_t height = 0;
+    std::vector<float> reference[3];
+    std::vector<float> distorted[3];
+};
+
+inline FramePair makeFramePair(Pattern pattern, int64_t width, int64_t height, uint64_t seed = 0x5eed){
+    FramePair pair;
+    pair.width = width;
+    pair.height = height;
+    const int64_t size = width*height;
+    for (int c = 0; c < 3; c++){
+        pair.reference[c].resize(size);
+        pair.distorted[c].resize(size);
+    }
+    Random rng(seed);
+    auto clamp01 = [](float v){ return std::min(1.0f, std::max(0.0f, v)); };
+
+    switch (pattern){
+        //grain on a textured image, the distortion is more grain
+        case Pattern::Noise:
+            for (int64_t i = 0; i < size; i++){
+                const float luma = 0.2f + 0.6f*rng.uniform();
+                for (int c = 0; c < 3; c++){
+                    const float value = clamp01(luma + 0.1f*(rng.uniform() - 0.5f));
+                    pair.reference[c][i] = value;
+                    pair.distorted[c][i] = clamp01(value + 0.03f*rng.normal());
+                }
+            }
+            break;
+        //smooth ramps, the distortion is banding
+        case Pattern::Gradient:
+            for (int64_t y = 0; y < height; y++){
+                for (int64_t x = 0; x < width; x++){
+                    const int64_t i = y*width + x;
+                    const float ramps[3] = {(float)x/width, (float)y/height, (float)(x + y)/(width + height)};
+                    for (int c = 0; c < 3; c++){
+                        pair.reference[c][i] = ramps[c];
+                        pair.distorted[c][i] = std::floor(ramps[c]*32.0f)/32.0f;
+                    }
+                }
+            }
+            break;
+        //detailed content, the distortion is 8x8 blocks losing part of their detail like a coarse quantizer
+        case Pattern::Blocky: {
+            for (int64_t y = 0; y < height; y++){
+                for (int64_t x = 0; x < width; x++){
+                    const int64_t i = y*width + x;
+                    const float base = 0.5f + 0.2f*std::sin(x*0.05f)*std::cos(y*0.03f) + 0.1f*std::sin((x + 2*y)*0.21f);
+                    for (int c = 0; c < 3; c++){
+                        pair.reference[c][i] = clamp01(base + 0.05f*c + 0.04f*(rng.uniform() - 0.5f));
+                    }
+                }
+            }
+            for (int c = 0; c < 3; c++){
+                for (int64_t by = 0; by < height; by += 8){
+                    for (int64_t bx = 0; bx < width; bx += 8){
+                        const int64_t ey = std::min(by + 8, height), ex = std::min(bx + 8, width);
+                        float sum = 0;
+                        for (int64_t y = by; y < ey; y++) for (int64_t x = bx; x < ex; x++) sum += pair.reference[c][y*width + x];
+                        const float mean = sum/((ey - by)*(ex - bx));
+                        for (int64_t y = by; y < ey; y++){
+                            for (int64_t x = bx; x < ex; x++){
+                                const int64_t i = y*width + x;
+                                pair.distorted[c][i] = 0.4f*mean + 0.6f*pair.reference[c][i];
+                            }
+                        }
+                    }
+                }
+            }
+            break;
+        }
+    }
+    return pair;
+}
+
+//round to nearest even, the values used here are never NaN
+inline uint16_t floatToHalf(float value){
+    uint32_t bits;
+    std::memcpy(&bits, &value, 4);
+    const uint16_t sign = (bits >> 16) & 0x8000;
+    const int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+    if (exponent <= 0){ //subnormal half
+        if (exponent < -10) return sign;
+        mantissa |= 0x800000;
+        const int shift = 14 - exponent;
+        uint16_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1))) half++;
+        return sign | half;
+    }
+    if (exponent >= 31) return sign | 0x7c00;
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) half++; //a carry correctly moves to the exponent
+    return half;
+}
+
+//one plane in the memory layout of an input type, full range for UINT16
+inline void convertPlane(const std::vector<float>& src, InputMemType type, uint8_t* dst){
+    const size_t size = src.size();
+    if (type == FLOAT){
+        std::memcpy(dst, src.data(), size*sizeof(float));
+        return;
+    }
+    uint16_t* out = (uint16_t*)dst;
+    for (size_t i = 0; i < size; i++){
+        out[i] = type == UINT16 ? (uint16_t)std::lround(src[i]*65535.0f) : floatToHalf(src[i]);
+    }
+}
+
+}
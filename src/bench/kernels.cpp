@@ -0,0 +1,338 @@
+//vshipkernelbench: every building block of the SYCL ssimulacra2 implementation launched alone on fixed
+//size device buffers. Achieved GB/s and GFLOP/s are compared with a roofline of the device measured by two
+//built-in probes (a streaming copy and an FMA loop), which tells how far each kernel is from the peak and
+//catches the regression of one kernel that the end to end fps of vshipbench hides.
+//Bytes are the compulsory traffic (every input read once, every output written once) and flops are counted
+//from the source with pow and cbrt as one, so both are lower bounds of the work really done.
+
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "../util/VshipExceptions.hpp"
+#include "../util/gpuhelper.hpp"
+#include "../ssimu2/main.hpp"
+#include "BenchCommon.hpp"
+
+namespace bench{
+
+struct Roofline{
+    double bandwidth = 0; //bytes per second
+    double flops = 0; //per second
+};
+
+struct KernelResult{
+    std::string name;
+    double seconds = 0; //per launch
+    double bytes = 0;
+    double flops = 0;
+
+    //time the kernel would take at the roofline over the time it took
+    double efficiency(const Roofline& roofline) const {
+        return std::max(bytes/roofline.bandwidth, flops/roofline.flops)/seconds;
+    }
+    const char* bound(const Roofline& roofline) const {
+        return bytes/roofline.bandwidth >= flops/roofline.flops ? "memory" : "compute";
+    }
+};
+
+//seconds per launch: launch is enqueued repeat times back to back and waited for once, best of 3 rounds.
+//prepare runs before every round, untimed (kernels working in place need their input restored)
+template <typename Prepare, typename Launch>
+double timeKernel(sycl::queue& q, Prepare prepare, Launch launch, int repeat){
+    prepare();
+    launch(); //first launch builds or loads the device image
+    q.wait();
+    double best = std::numeric_limits<double>::max();
+    for (int round = 0; round < 3; round++){
+        prepare();
+        q.wait();
+        const auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < repeat; i++) launch();
+        q.wait();
+        best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count()/repeat);
+    }
+    return best;
+}
+
+//streaming copy of 2 x 256MB (less if the device cannot allocate it) for the bandwidth, and independent
+//FMA chains on registers for the arithmetic peak
+Roofline probeRoofline(sycl::queue& q, int repeat){
+    Roofline roofline;
+    const sycl::device dev = q.get_device();
+    const int64_t count = std::min<int64_t>(16 << 20, dev.get_info<sycl::info::device::max_mem_alloc_size>()/sizeof(sycl::float4)/4);
+    sycl::float4* src = sycl::malloc_device<sycl::float4>(count, q);
+    sycl::float4* dst = sycl::malloc_device<sycl::float4>(count, q);
+    if (src == nullptr || dst == nullptr){
+        if (src) sycl::free(src, q);
+        if (dst) sycl::free(dst, q);
+        VSHIP_THROW(OutOfVRAM);
+    }
+    q.fill(src, sycl::float4(0.5f), count).wait();
+
+    const double copy = timeKernel(q, [](){}, [&](){
+        q.parallel_for(sycl::range<1>(count), [=](sycl::id<1> i){ dst[i] = src[i]; });
+    }, repeat);
+    roofline.bandwidth = 2.0*count*sizeof(sycl::float4)/copy;
+
+    constexpr int iterations = 256;
+    const int64_t items = std::min<int64_t>(count, 1 << 20);
+    const double fma = timeKernel(q, [](){}, [&](){
+        q.parallel_for(sycl::range<1>(items), [=](sycl::id<1> i){
+            sycl::float4 acc[8];
+            for (int k = 0; k < 8; k++) acc[k] = src[i] + (float)k;
+            const sycl::float4 mul = src[i]*0.999f;
+            for (int it = 0; it < iterations; it++){
+                for (int k = 0; k < 8; k++) acc[k] = sycl::fma(acc[k], mul, sycl::float4(0.001f));
+            }
+            sycl::float4 sum = acc[0];
+            for (int k = 1; k < 8; k++) sum += acc[k];
+            dst[i] = sum;
+        });
+    }, repeat);
+    roofline.flops = 2.0*4*8*iterations*items/fma;
+
+    sycl::free(src, q);
+    sycl::free(dst, q);
+    return roofline;
+}
+
+//every kernel entry point of ssimu2 at width x height (the full resolution scale)
+std::vector<KernelResult> benchKernels(sycl::queue& q, int64_t width, int64_t height, int repeat){
+    using namespace ssimu2;
+    const sycl::device dev = q.get_device();
+    const int64_t maxshared = dev.get_info<sycl::info::device::local_mem_size>();
+    KernelConfig config;
+    loadKernelConfig(dev, width, height, config);
+
+    const int64_t size = width*height;
+    const int64_t neww = (width-1)/2+1, newh = (height-1)/2+1;
+    const int64_t bl_x = (width-1)/16+1, bl_y = (height-1)/16+1;
+    const int64_t blocks = bl_x*bl_y;
+
+    GaussianHandle gaussianhandle;
+    gaussianhandle.init(q);
+    sycl::float3* src1 = sycl::malloc_device<sycl::float3>(size, q);
+    sycl::float3* src2 = sycl::malloc_device<sycl::float3>(size, q);
+    sycl::float3* half_size = sycl::malloc_device<sycl::float3>(neww*newh, q);
+    sycl::float3* sums = sycl::malloc_device<sycl::float3>(3*6*blocks, q); //same layout as the temp of allscore_map
+    uint8_t* planes = sycl::malloc_device<uint8_t>(3*size*sizeof(float), q);
+    if (!src1 || !src2 || !half_size || !sums || !planes){
+        for (void* ptr : {(void*)src1, (void*)src2, (void*)half_size, (void*)sums, (void*)planes}) if (ptr) sycl::free(ptr, q);
+        gaussianhandle.destroy(q);
+        VSHIP_THROW(OutOfVRAM);
+    }
+    q.fill(src1, sycl::float3(0.3f, 0.4f, 0.5f), size);
+    q.fill(src2, sycl::float3(0.35f, 0.4f, 0.45f), size);
+    q.memset(planes, 0, 3*size*sizeof(float));
+    q.fill(sums, sycl::float3(0.001f), 3*6*blocks).wait();
+    auto nothing = [](){};
+    auto restore = [&](){ q.fill(src1, sycl::float3(0.3f, 0.4f, 0.5f), size); };
+
+    std::vector<KernelResult> results;
+    auto organizer = [&](auto type, const char* name, int64_t input_size){
+        constexpr InputMemType T = decltype(type)::value;
+        const int64_t stride = width*input_size;
+        const double t = timeKernel(q, nothing, [&](){
+            memoryorganizer<T>(src1, planes, planes + stride*height, planes + 2*stride*height, stride, width, height, q, config.organizer_threads);
+        }, repeat);
+        results.push_back({name, t, (double)size*(3*input_size + sizeof(sycl::float3)), T == UINT16 ? 3.0*size : 0.0});
+    };
+    organizer(std::integral_constant<InputMemType, UINT16>{}, "memoryorganizer<UINT16>", 2);
+    organizer(std::integral_constant<InputMemType, HALF>{}, "memoryorganizer<HALF>", 2);
+    organizer(std::integral_constant<InputMemType, FLOAT>{}, "memoryorganizer<FLOAT>", 4);
+
+    //in place: the input is restored before every round so that repeated launches stay on normal floats
+    results.push_back({"rgb_to_linear", timeKernel(q, restore, [&](){
+        rgb_to_linear(src1, size, q, config.pointwise_threads);
+    }, repeat), 2.0*size*sizeof(sycl::float3), 9.0*size}); //add, mul, pow per channel
+
+    results.push_back({"rgb_to_positive_xyb", timeKernel(q, restore, [&](){
+        rgb_to_positive_xyb(src1, size, q, config.pointwise_threads);
+    }, repeat), 2.0*size*sizeof(sycl::float3), 35.0*size}); //opsin matrix 18, cbrt and bias 9, mixing 3, positive 5
+    restore();
+
+    results.push_back({"downsample", timeKernel(q, nothing, [&](){
+        downsample(src1, half_size, width, height, q, config.downsample_x, config.downsample_y);
+    }, repeat), (double)(size + neww*newh)*sizeof(sycl::float3), 12.0*neww*newh});
+
+    //per pixel: 5 separable 17 tap blurs (the horizontal pass covers 2 tile rows per thread) of 315 flops,
+    //36 for the products loaded by 3 of them, 78 for the score maps, 18 for the 4th powers and 18 for the block sums
+    const double blur = 2*17*2*3 + 2*3 + 17*2*3 + 3;
+    results.push_back({"allscore_map_Kernel", timeKernel(q, nothing, [&](){
+        allscore_map_Kernel(q, sums + 6*blocks, src1, src2, width, height, gaussianhandle.gaussiankernel_d,
+                            gaussianhandle.gaussiankernel_integral_d, bl_x, bl_y, 16, 16);
+    }, repeat), 2.0*size*sizeof(sycl::float3) + 6.0*blocks*sizeof(sycl::float3), (5*blur + 36 + 78 + 18 + 18)*size});
+
+    //the stages allscore_map runs on the block sums of the full resolution scale
+    const int64_t th_x = reduceThreads(maxshared, blocks, config.reduce_threads);
+    double reduce_bytes = 0, reduce_flops = 0;
+    for (int64_t count = blocks; count >= 256; count = (count-1)/th_x+1){
+        const int64_t out = (count-1)/th_x+1;
+        reduce_bytes += 6.0*(count + out)*sizeof(sycl::float3);
+        reduce_flops += 18.0*count;
+    }
+    results.push_back({"sumreduce (all stages)", timeKernel(q, nothing, [&](){
+        int oscillate = 0;
+        for (int64_t count = blocks; count >= 256; count = (count-1)/th_x+1){
+            const int64_t out = (count-1)/th_x+1;
+            sycl::float3* dst = sums + ((out >= 256) ? ((oscillate ^ 1) + 1)*6*blocks : 0);
+            sumreduce_Kernel(q, dst, sums + (oscillate + 1)*6*blocks, count, th_x);
+            oscillate ^= 1;
+        }
+    }, repeat), reduce_bytes, reduce_flops});
+
+    for (void* ptr : {(void*)src1, (void*)src2, (void*)half_size, (void*)sums, (void*)planes}) sycl::free(ptr, q);
+    gaussianhandle.destroy(q);
+    return results;
+}
+
+//final_score runs on the host once per frame: 108 FMA and the polynomial
+KernelResult benchFinalScore(){
+    std::vector<float> scores(108);
+    for (int i = 0; i < 108; i++) scores[i] = 0.001f*(i % 7);
+    constexpr int calls = 200000;
+    double sink = 0;
+    const auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; i++){
+        scores[i % 108] += 1e-9f; //keeps the calls from being hoisted
+        sink += ssimu2::final_score(scores);
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count()/calls;
+    if (sink == 0.12345) std::cout << std::endl;
+    return {"final_score (host)", seconds, 2.0*108*sizeof(float), 2.0*108 + 12};
+}
+
+struct DeviceReport{
+    int index;
+    std::string name;
+    Roofline roofline;
+    std::vector<KernelResult> kernels;
+    std::string error;
+};
+
+void printKernel(const KernelResult& kernel, const Roofline* roofline){
+    std::cout << "  " << std::left << std::setw(26) << kernel.name << std::right << std::fixed
+              << std::setprecision(4) << std::setw(10) << kernel.seconds*1e3 << " ms"
+              << std::setprecision(1) << std::setw(9) << kernel.bytes/kernel.seconds/1e9 << " GB/s"
+              << std::setw(9) << kernel.flops/kernel.seconds/1e9 << " GFLOP/s";
+    if (roofline) std::cout << std::setw(7) << 100*kernel.efficiency(*roofline) << "% of roofline (" << kernel.bound(*roofline) << " bound)";
+    std::cout << std::endl;
+}
+
+void writeKernel(std::ofstream& out, const KernelResult& kernel, const Roofline* roofline){
+    out << "{\"name\": " << jsonString(kernel.name) << std::fixed << std::setprecision(6)
+        << ", \"ms\": " << kernel.seconds*1e3 << std::setprecision(3)
+        << ", \"bytes\": " << kernel.bytes << ", \"flops\": " << kernel.flops
+        << ", \"gb_per_second\": " << kernel.bytes/kernel.seconds/1e9
+        << ", \"gflops\": " << kernel.flops/kernel.seconds/1e9;
+    if (roofline) out << ", \"roofline_percent\": " << 100*kernel.efficiency(*roofline) << ", \"bound\": \"" << kernel.bound(*roofline) << "\"";
+    out << "}";
+}
+
+bool writeJson(const std::string& path, int64_t width, int64_t height, const std::vector<DeviceReport>& devices, const KernelResult& host){
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out << "{\n  \"benchmark\": \"vshipkernelbench\",\n  \"format\": 1,\n  \"width\": " << width << ",\n  \"height\": " << height
+        << ",\n  \"host\": [";
+    writeKernel(out, host, nullptr);
+    out << "],\n  \"devices\": [";
+    for (size_t d = 0; d < devices.size(); d++){
+        const DeviceReport& device = devices[d];
+        out << (d ? ",\n" : "\n") << "    {\"device\": " << jsonString(device.name) << ", \"device_index\": " << device.index;
+        if (!device.error.empty()){
+            out << ", \"error\": " << jsonString(device.error) << "}";
+            continue;
+        }
+        out << std::fixed << std::setprecision(3) << ", \"bandwidth_gb_per_second\": " << device.roofline.bandwidth/1e9
+            << ", \"peak_gflops\": " << device.roofline.flops/1e9 << ", \"kernels\": [";
+        for (size_t k = 0; k < device.kernels.size(); k++){
+            out << (k ? ",\n      " : "\n      ");
+            writeKernel(out, device.kernels[k], &device.roofline);
+        }
+        out << "\n    ]}";
+    }
+    out << "\n  ]\n}\n";
+    return (bool)out;
+}
+
+}
+
+int main(int argc, char** argv){
+    using namespace bench;
+    helper::enablePersistentKernelCache();
+
+    std::string output = "kernelbench.json";
+    std::string device_list = "all";
+    int width = 1920;
+    int height = 1080;
+    int repeat = 20;
+
+    helper::ArgParser parser;
+    parser.add_flag({"--output", "-o"}, &output, "JSON file receiving the results, default kernelbench.json");
+    parser.add_flag({"--devices"}, &device_list, "all, or comma separated device indices of FFVship --list-gpu");
+    parser.add_flag({"--width"}, &width, "Width of the buffers, default 1920");
+    parser.add_flag({"--height"}, &height, "Height of the buffers, default 1080");
+    parser.add_flag({"--repeat"}, &repeat, "Launches per timed round, default 20");
+
+    const int parsed = parseArgs(parser, argc, argv);
+    if (parsed >= 0) return parsed;
+    if (width < 16 || height < 16 || repeat < 1){
+        std::cerr << "--width and --height must be at least 16 and --repeat at least 1" << std::endl;
+        return 1;
+    }
+
+    const std::vector<sycl::device> sycl_devices = helper::getDevices();
+    std::vector<int> indices;
+    if (device_list == "all"){
+        for (size_t i = 0; i < sycl_devices.size(); i++) indices.push_back(i);
+    } else {
+        for (const std::string& item : splitList(device_list)){
+            int index = -1;
+            try { index = std::stoi(item); } catch (...) {}
+            if (index < 0 || index >= (int)sycl_devices.size()){
+                std::cerr << "Unknown device " << item << std::endl;
+                return 1;
+            }
+            indices.push_back(index);
+        }
+    }
+
+    const KernelResult host = benchFinalScore();
+    std::cout << "host" << std::endl;
+    printKernel(host, nullptr);
+
+    std::vector<DeviceReport> reports;
+    for (const int index : indices){
+        DeviceReport report;
+        report.index = index;
+        report.name = sycl_devices[index].get_info<sycl::info::device::name>();
+        std::cout << report.name << " (" << width << "x" << height << ")" << std::endl;
+        try {
+            sycl::queue q(sycl_devices[index], helper::queueProperties());
+            report.roofline = probeRoofline(q, repeat);
+            std::cout << "  roofline: " << std::fixed << std::setprecision(1) << report.roofline.bandwidth/1e9 << " GB/s, "
+                      << report.roofline.flops/1e9 << " GFLOP/s" << std::endl;
+            report.kernels = benchKernels(q, width, height, repeat);
+            for (const KernelResult& kernel : report.kernels) printKernel(kernel, &report.roofline);
+        } catch (const VshipError& e){
+            report.error = e.getErrorMessage();
+        } catch (const std::exception& e){
+            report.error = e.what();
+        }
+        if (!report.error.empty()) std::cout << "  error: " << report.error << std::endl;
+        reports.push_back(std::move(report));
+    }
+    helper::KernelTrace::get().close();
+
+    if (!writeJson(output, width, height, reports, host)){
+        std::cerr << "Failed to write " << output << std::endl;
+        return 1;
+    }
+    std::cout << "Results written to " << output << std::endl;
+    return 0;
+}
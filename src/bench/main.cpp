@@ -0,0 +1,328 @@
+//vshipbench: end to end throughput of the ssimulacra2 engine on deterministic synthetic frame pairs.
+//Every pattern and resolution is scored with every input type on every device (the SYCL devices of
+//helper::getDevices(), CPU ones included, and the native CPU implementation), and the results are
+//written as JSON so that releases can be compared.
+
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../util/VshipExceptions.hpp"
+#include "../util/gpuhelper.hpp"
+#ifndef VSHIP_NO_SYCL
+#include "../ssimu2/main.hpp"
+#endif
+#include "../ssimu2cpu/main.hpp"
+#include "BenchCommon.hpp"
+#include "SyntheticFrames.hpp"
+
+namespace bench{
+
+//a SYCL device of helper::getDevices() (index >= 0) or the native implementation (index -1)
+struct DeviceEntry{
+    int index;
+    std::string name;
+    std::string backend;
+};
+
+//one engine for one device and resolution, with the input buffers it reads fastest
+//(pinned host memory for SYCL devices, as FFVship uses)
+class BenchEngine{
+#ifndef VSHIP_NO_SYCL
+    std::optional<sycl::queue> queue;
+    std::optional<ssimu2::SSIMU2ComputingImplementation> sycl_engine;
+#endif
+    std::optional<ssimu2cpu::SSIMU2ComputingImplementation> native_engine;
+
+public:
+    BenchEngine([[maybe_unused]] const DeviceEntry& device, int64_t width, int64_t height){
+#ifndef VSHIP_NO_SYCL
+        if (device.index >= 0){
+            queue.emplace(helper::getDevices()[device.index], sycl::property::queue::in_order{});
+            sycl_engine.emplace(width, height, device.index);
+            return;
+        }
+#endif
+        native_engine.emplace(width, height);
+    }
+    ~BenchEngine(){
+#ifndef VSHIP_NO_SYCL
+        if (sycl_engine) sycl_engine->destroy();
+#endif
+        if (native_engine) native_engine->destroy();
+    }
+    BenchEngine(const BenchEngine&) = delete;
+    BenchEngine& operator=(const BenchEngine&) = delete;
+
+    uint8_t* allocate(size_t bytes){
+#ifndef VSHIP_NO_SYCL
+        if (queue){
+            uint8_t* ptr = sycl::malloc_host<uint8_t>(bytes, *queue);
+            if (ptr == nullptr) VSHIP_THROW(OutOfRAM);
+            return ptr;
+        }
+#endif
+        uint8_t* ptr = (uint8_t*)std::malloc(bytes);
+        if (ptr == nullptr) VSHIP_THROW(OutOfRAM);
+        return ptr;
+    }
+
+    void deallocate(uint8_t* ptr){
+#ifndef VSHIP_NO_SYCL
+        if (queue){
+            sycl::free(ptr, *queue);
+            return;
+        }
+#endif
+        std::free(ptr);
+    }
+
+    template <InputMemType T>
+    double run(const uint8_t* srcp1[3], const uint8_t* srcp2[3], int64_t stride){
+#ifndef VSHIP_NO_SYCL
+        if (sycl_engine) return sycl_engine->run<T>(srcp1, srcp2, stride);
+#endif
+        return native_engine->run<T>(srcp1, srcp2, stride);
+    }
+
+    double run(InputMemType type, const uint8_t* srcp1[3], const uint8_t* srcp2[3], int64_t stride){
+        switch (type){
+            case UINT16: return run<UINT16>(srcp1, srcp2, stride);
+            case HALF: return run<HALF>(srcp1, srcp2, stride);
+            case FLOAT: return run<FLOAT>(srcp1, srcp2, stride);
+        }
+        return 0;
+    }
+};
+
+struct Result{
+    const DeviceEntry* device;
+    const Resolution* resolution;
+    Pattern pattern;
+    InputMemType type;
+    int64_t frames = 0;
+    double seconds = 0;
+    double score = 0;
+    std::string error; //empty on success
+
+    //frames read by the engine: both inputs, 3 planes each
+    int64_t bytesPerFrame() const {
+        return 6*resolution->width*resolution->height*inputTypeSize(type);
+    }
+};
+
+//the first run is not timed, then frames are scored until both minimums are reached
+inline void measure(BenchEngine& engine, const FramePair& pair, Result& result, double min_seconds, int min_frames){
+    const int64_t plane_bytes = pair.width*pair.height*inputTypeSize(result.type);
+    uint8_t* buffer = engine.allocate(6*plane_bytes);
+    const uint8_t* reference[3];
+    const uint8_t* distorted[3];
+    for (int c = 0; c < 3; c++){
+        convertPlane(pair.reference[c], result.type, buffer + c*plane_bytes);
+        convertPlane(pair.distorted[c], result.type, buffer + (3 + c)*plane_bytes);
+        reference[c] = buffer + c*plane_bytes;
+        distorted[c] = buffer + (3 + c)*plane_bytes;
+    }
+    const int64_t stride = pair.width*inputTypeSize(result.type);
+
+    try {
+        result.score = engine.run(result.type, reference, distorted, stride);
+        const auto start = std::chrono::steady_clock::now();
+        while (result.frames < min_frames || result.seconds < min_seconds){
+            engine.run(result.type, reference, distorted, stride);
+            result.frames++;
+            result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    } catch (...) {
+        engine.deallocate(buffer);
+        throw;
+    }
+    engine.deallocate(buffer);
+}
+
+inline bool writeJson(const std::string& path, const std::vector<Result>& results){
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    char date[32];
+    const std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+#ifdef VSHIP_NO_SYCL
+    const char* build = "native";
+#else
+    const char* build = "sycl";
+#endif
+    out << "{\n  \"benchmark\": \"vshipbench\",\n  \"format\": 1,\n  \"build\": \"" << build << "\",\n  \"date\": \"" << date << "\",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++){
+        const Result& r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"device\": " << jsonString(r.device->name) << ", \"backend\": \"" << r.device->backend
+            << "\", \"device_index\": " << r.device->index << ", \"resolution\": \"" << r.resolution->name
+            << "\", \"width\": " << r.resolution->width << ", \"height\": " << r.resolution->height
+            << ", \"pattern\": \"" << patternName(r.pattern) << "\", \"input_type\": \"" << inputTypeName(r.type) << "\"";
+        if (!r.error.empty()){
+            out << ", \"error\": " << jsonString(r.error) << "}";
+            continue;
+        }
+        out << std::fixed << std::setprecision(4)
+            << ", \"frames\": " << r.frames << ", \"ms_per_frame\": " << 1000*r.seconds/r.frames
+            << ", \"fps\": " << r.frames/r.seconds << ", \"bytes_per_frame\": " << r.bytesPerFrame()
+            << ", \"gb_per_second\": " << r.bytesPerFrame()*r.frames/r.seconds/1e9
+            << std::setprecision(6) << ", \"score\": " << r.score << "}";
+        out.unsetf(std::ios::floatfield);
+    }
+    out << "\n  ]\n}\n";
+    return (bool)out;
+}
+
+}
+
+int main(int argc, char** argv){
+    using namespace bench;
+    helper::enablePersistentKernelCache();
+
+    std::string output = "vshipbench.json";
+    std::string resolution_list = "480p,1080p,4k,8k";
+    std::string pattern_list = "noise,gradient,blocky";
+    std::string type_list = "uint16,half,float";
+    std::string device_list = "all";
+    float min_seconds = 1.0f;
+    int min_frames = 5;
+
+    helper::ArgParser parser;
+    parser.add_flag({"--output", "-o"}, &output, "JSON file receiving the results, default vshipbench.json");
+    parser.add_flag({"--resolutions"}, &resolution_list, "Comma separated among 480p, 1080p, 4k, 8k. Default all");
+    parser.add_flag({"--patterns"}, &pattern_list, "Comma separated among noise, gradient, blocky. Default all");
+    parser.add_flag({"--types"}, &type_list, "Input types, comma separated among uint16, half, float. Default all");
+    parser.add_flag({"--devices"}, &device_list, "all, or comma separated device indices of --list-gpu and native for the native CPU implementation");
+    parser.add_flag({"--min-time"}, &min_seconds, "Seconds each case is timed for at least, default 1");
+    parser.add_flag({"--min-frames"}, &min_frames, "Frames each case is timed for at least, default 5");
+
+    const int parsed = parseArgs(parser, argc, argv);
+    if (parsed >= 0) return parsed;
+
+    std::vector<const Resolution*> resolutions;
+    for (const std::string& name : splitList(resolution_list)){
+        const Resolution* found = nullptr;
+        for (const Resolution& resolution : standardResolutions()) if (name == resolution.name) found = &resolution;
+        if (found == nullptr){
+            std::cerr << "Unknown resolution " << name << std::endl;
+            return 1;
+        }
+        resolutions.push_back(found);
+    }
+    std::vector<Pattern> patterns;
+    for (const std::string& name : splitList(pattern_list)){
+        bool found = false;
+        for (const Pattern pattern : {Pattern::Noise, Pattern::Gradient, Pattern::Blocky}){
+            if (name == patternName(pattern)){
+                patterns.push_back(pattern);
+                found = true;
+            }
+        }
+        if (!found){
+            std::cerr << "Unknown pattern " << name << std::endl;
+            return 1;
+        }
+    }
+    std::vector<InputMemType> types;
+    for (const std::string& name : splitList(type_list)){
+        bool found = false;
+        for (const InputMemType type : {UINT16, HALF, FLOAT}){
+            if (name == inputTypeName(type)){
+                types.push_back(type);
+                found = true;
+            }
+        }
+        if (!found){
+            std::cerr << "Unknown input type " << name << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<DeviceEntry> available;
+#ifndef VSHIP_NO_SYCL
+    const auto sycl_devices = helper::getDevices();
+    for (size_t i = 0; i < sycl_devices.size(); i++){
+        available.push_back({(int)i, sycl_devices[i].get_info<sycl::info::device::name>(), sycl_devices[i].is_cpu() ? "sycl-cpu" : "sycl-gpu"});
+    }
+#endif
+    available.push_back({-1, "native (" + std::to_string(helper::ThreadPool::shared().size()) + " threads)", "native"});
+
+    std::vector<DeviceEntry> devices;
+    if (device_list == "all"){
+        devices = available;
+    } else {
+        for (const std::string& name : splitList(device_list)){
+            const DeviceEntry* found = nullptr;
+            for (const DeviceEntry& device : available){
+                if ((name == "native" && device.index == -1) || name == std::to_string(device.index)) found = &device;
+            }
+            if (found == nullptr){
+                std::cerr << "Unknown device " << name << std::endl;
+                return 1;
+            }
+            devices.push_back(*found);
+        }
+    }
+
+    std::vector<Result> results;
+    for (const Resolution* resolution : resolutions){
+        //engines live for the whole resolution, frames are generated once per pattern
+        std::vector<std::unique_ptr<BenchEngine>> engines;
+        std::vector<std::string> engine_errors;
+        for (const DeviceEntry& device : devices){
+            try {
+                engines.push_back(std::make_unique<BenchEngine>(device, resolution->width, resolution->height));
+                engine_errors.push_back("");
+            } catch (const VshipError& e){
+                engines.push_back(nullptr);
+                engine_errors.push_back(e.getErrorMessage());
+            } catch (const std::exception& e){
+                engines.push_back(nullptr);
+                engine_errors.push_back(e.what());
+            }
+        }
+
+        for (const Pattern pattern : patterns){
+            const FramePair pair = makeFramePair(pattern, resolution->width, resolution->height);
+            for (const InputMemType type : types){
+                for (size_t d = 0; d < devices.size(); d++){
+                    Result result{&devices[d], resolution, pattern, type, 0, 0, 0, ""};
+                    if (engines[d] == nullptr){
+                        result.error = engine_errors[d];
+                    } else {
+                        try {
+                            measure(*engines[d], pair, result, min_seconds, min_frames);
+                        } catch (const VshipError& e){
+                            result.error = e.getErrorMessage();
+                        } catch (const std::exception& e){
+                            result.error = e.what();
+                        }
+                    }
+
+                    std::cout << std::left << std::setw(40) << devices[d].name.substr(0, 39) << std::setw(7) << resolution->name
+                              << std::setw(10) << patternName(pattern) << std::setw(8) << inputTypeName(type) << std::right;
+                    if (result.error.empty()){
+                        std::cout << std::fixed << std::setprecision(2) << std::setw(10) << 1000*result.seconds/result.frames << " ms"
+                                  << std::setw(10) << result.frames/result.seconds << " fps"
+                                  << std::setprecision(4) << std::setw(12) << result.score << std::endl;
+                    } else {
+                        std::cout << "  error: " << result.error << std::endl;
+                    }
+                    results.push_back(std::move(result));
+                }
+            }
+        }
+    }
+
+    if (!writeJson(output, results)){
+        std::cerr << "Failed to write " << output << std::endl;
+        return 1;
+    }
+    std::cout << "Results written to " << output << std::endl;
+    return 0;
+}
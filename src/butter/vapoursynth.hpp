@@ -10,7 +10,7 @@ namespace butter{
         ButterComputingImplementation* butterStreams;
         int diffmap;
         int streamnum = 0;
-        threadSet<int>* streamSet;
+        BufferPool<int>* streamSet;
     } ButterData;
     
     static const VSFrame *VS_CC butterGetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
@@ -50,7 +50,7 @@ namespace butter{
             
             std::tuple<float, float, float> val;
             
-            const int stream = d->streamSet->pop();
+            const int stream = d->streamSet->acquire();
             ButterComputingImplementation& butterstream = d->butterStreams[stream];
             try{
                 if (d->diffmap){
@@ -60,12 +60,12 @@ namespace butter{
                 }
             } catch (const VshipError& e){
                 vsapi->setFilterError(e.getErrorMessage().c_str(), frameCtx);
-                d->streamSet->insert(stream);
+                d->streamSet->release(stream);
                 vsapi->freeFrame(src1);
                 vsapi->freeFrame(src2);
                 return NULL;
             }
-            d->streamSet->insert(stream);
+            d->streamSet->release(stream);
     
             vsapi->mapSetFloat(vsapi->getFramePropertiesRW(dst), "_BUTTERAUGLI_2Norm", std::get<0>(val), maReplace);
             vsapi->mapSetFloat(vsapi->getFramePropertiesRW(dst), "_BUTTERAUGLI_3Norm", std::get<1>(val), maReplace);
@@ -163,11 +163,11 @@ namespace butter{
         d.streamnum = std::min(d.streamnum, infos.numThreads);
         d.streamnum = std::max(d.streamnum, 1);
     
-        std::set<int> newstreamset;
+        std::vector<int> streams;
         for (int i = 0; i < d.streamnum; i++){
-            newstreamset.insert(i);
+            streams.push_back(i);
         }
-        d.streamSet = new threadSet(newstreamset);
+        d.streamSet = new BufferPool<int>(streams);
     
         data = (ButterData *)malloc(sizeof(d));
         *data = d;
@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <future>
 #include <iostream>
@@ -13,9 +14,24 @@
 #include "util/concurrency.hpp"
 
 //#include "butter/main.hpp"
+#ifndef VSHIP_NO_SYCL
 #include "ssimu2/main.hpp"
+#include "ssimu2/autotune.hpp"
+#endif
+#include "ssimu2cpu/main.hpp"
 
 #include "ffvship_utility/ProgressBar.hpp"
+#include "ffvship_utility/ScoreWriter.hpp"
+#include "ffvship_utility/Checkpoint.hpp"
+#include "ffvship_utility/ScoreCache.hpp"
+#include "ffvship_utility/FeatureStore.hpp"
+#include "ffvship_utility/SceneSampling.hpp"
+#include "ffvship_utility/StratifiedSampling.hpp"
+#include "ffvship_utility/Profiler.hpp"
+#include "ffvship_utility/LiveMetrics.hpp"
+#include "ffvship_utility/ThreadBudget.hpp"
+#include "ffvship_utility/Dedup.hpp"
+#include "ffvship_utility/Letterbox.hpp"
 #include "ffvship_utility/ffmpegmain.hpp"
 #include "util/concurrency.hpp"
 
@@ -25,115 +41,450 @@ extern "C" {
 #include <zimg.h>
 }
 
+#ifndef VSHIP_NO_SYCL
 #include "ffvship_utility/gpuColorToLinear/vshipColor.hpp"
+#endif
 
 using score_tuple_t = std::tuple<float, float, float>;
-using score_queue_t = ClosableThreadSet<std::tuple<int, score_tuple_t>>;
+using score_queue_t = ReorderBuffer<score_tuple_t>;
 using frame_tuple_t = std::tuple<int, uint8_t *, uint8_t *>;
-using frame_queue_t = ThreadSafeQueue<frame_tuple_t>;
-using frame_pool_t = threadSet<uint8_t *>;
+using frame_queue_t = MPMCQueue<frame_tuple_t>;
+using frame_pool_t = BufferPool<uint8_t *>;
 using ProgressBarT = ProgressBar<500>;
+using dedup_t = DuplicateFrames<score_tuple_t>;
 
-void frame_reader_thread(VideoManager &v1, VideoManager &v2, std::vector<int>* frames_source, std::vector<int>* frames_encoded, int threadid, int threadnum, frame_queue_t &queue,
-                         frame_pool_t &frame_buffer_pool) {
-    const int num_frames = frames_source->size();
-    for (int i = num_frames*threadid/threadnum; i < num_frames*(threadid+1)/threadnum; i++) {
-        const int source_frame = (*frames_source)[i];
-        const int encoded_frame = (*frames_encoded)[i];
-        uint8_t *src_buffer = frame_buffer_pool.pop();
-        uint8_t *enc_buffer = frame_buffer_pool.pop();
+//result of a frame, nullopt when it has none
+void settle_frame(score_queue_t &score_queue, int frame_index, const std::optional<score_tuple_t> &result) {
+    if (result) {
+        score_queue.push(frame_index, *result);
+    } else {
+        score_queue.mark_missing(frame_index);
+    }
+}
 
-        auto future_src =
-            std::async(std::launch::async, [&v1, source_frame, src_buffer]() {
-                v1.fetch_frame_into_buffer(source_frame, src_buffer);
-            });
+//--dedup: the pairs repeating frame_index get its result
+void settle_duplicates(dedup_t *dedup, score_queue_t &score_queue, int frame_index, const std::optional<score_tuple_t> &result) {
+    if (dedup == nullptr) return;
+    for (const int duplicate : dedup->settle(frame_index, result)) settle_frame(score_queue, duplicate, result);
+}
 
-        auto future_enc =
-            std::async(std::launch::async, [&v2, encoded_frame, enc_buffer]() {
-                v2.fetch_frame_into_buffer(encoded_frame, enc_buffer);
-            });
+//frames_todo holds the positions in frames_source/frames_encoded that still need a score
+//without decode_source the source buffer is nullptr, the worker uses the stored reference features
+//a frame that cannot be read (encoded stream that ended early) is sent without buffers
+//with interleave the threads take every threadnum-th frame instead of a contiguous chunk, so that frames_todo
+//is read close to its order, and they stop early once stop_reading is set
+//with dedup a pair equal to the previous pair read by the thread is neither converted nor queued, it is settled
+//with the result of the last pair that was queued
+void frame_reader_thread(VideoManager &v1, VideoManager &v2, std::vector<int>* frames_source, std::vector<int>* frames_encoded, std::vector<int>* frames_todo, int threadid, int threadnum, frame_queue_t &queue,
+                         frame_pool_t &frame_buffer_pool, bool decode_source, bool interleave, const std::atomic<bool>* stop_reading, Profiler* profiler,
+                         LiveMetrics* metrics, ThreadBudget* budget, dedup_t* dedup, score_queue_t* score_queue) {
+    v1.budget = v2.budget = budget;
+    int last_original = -1;
+    uint64_t last_source_fingerprint = 0, last_encoded_fingerprint = 0;
+    int wait_track = 0;
+    if (profiler) {
+        const std::string name = "reader " + std::to_string(threadid);
+        wait_track = profiler->track(name);
+        v1.profiler = v2.profiler = profiler;
+        v1.profile_track = profiler->track(name + " source");
+        v2.profile_track = profiler->track(name + " encoded");
+    }
+    const int num_frames = frames_todo->size();
+    const int first = interleave ? threadid : num_frames*threadid/threadnum;
+    const int last = interleave ? num_frames : num_frames*(threadid+1)/threadnum;
+    const int step = interleave ? threadnum : 1;
+    bool reported_end = false;
+    for (int j = first; j < last; j += step) {
+        if (stop_reading->load(std::memory_order_relaxed)) break;
+        const int i = (*frames_todo)[j];
+        const int source_frame = (*frames_source)[i];
+        const int encoded_frame = (*frames_encoded)[i];
+        const auto pool_wait = Profiler::clock::now();
+        uint8_t *src_buffer = decode_source ? frame_buffer_pool.acquire() : nullptr;
+        uint8_t *enc_buffer = frame_buffer_pool.acquire();
+        if (profiler) profiler->record(wait_track, Stage::PoolWait, i, pool_wait, Profiler::clock::now());
+
+        bool fetched = true;
+        if (decode_source && dedup) {
+            //converted only once known to differ from the previous pair
+            uint64_t source_fingerprint = 0;
+            auto future_src =
+                std::async(std::launch::async, [&v1, &source_fingerprint, source_frame]() {
+                    if (!v1.decode_frame(source_frame)) return false;
+                    source_fingerprint = v1.frame_fingerprint();
+                    return true;
+                });
+
+            fetched = v2.decode_frame(encoded_frame);
+            const uint64_t encoded_fingerprint = fetched ? v2.frame_fingerprint() : 0;
+            fetched = future_src.get() && fetched;
+
+            if (fetched && last_original >= 0 && source_fingerprint == last_source_fingerprint && encoded_fingerprint == last_encoded_fingerprint) {
+                frame_buffer_pool.release(src_buffer);
+                frame_buffer_pool.release(enc_buffer);
+                if (metrics) metrics->frame_decoded(threadid);
+                const auto known = dedup->add(last_original, i);
+                if (known) settle_frame(*score_queue, i, *known);
+                continue;
+            }
+            if (fetched) {
+                v1.convert_frame(source_frame, src_buffer);
+                v2.convert_frame(encoded_frame, enc_buffer);
+                if (last_original >= 0) dedup->retire(last_original);
+                last_original = i;
+                last_source_fingerprint = source_fingerprint;
+                last_encoded_fingerprint = encoded_fingerprint;
+            }
+        } else if (decode_source) {
+            //the encoded frame is read on this thread, one thread per frame is enough
+            auto future_src =
+                std::async(std::launch::async, [&v1, source_frame, src_buffer]() {
+                    return v1.fetch_frame_into_buffer(source_frame, src_buffer);
+                });
+
+            fetched = v2.fetch_frame_into_buffer(encoded_frame, enc_buffer);
+            fetched = future_src.get() && fetched;
+        } else {
+            fetched = v2.fetch_frame_into_buffer(encoded_frame, enc_buffer);
+        }
 
-        future_src.get();
-        future_enc.get();
+        if (!fetched) {
+            if (!reported_end) std::cerr << "\nFrame " << source_frame << "/" << encoded_frame << " (source/encoded) could not be read, the frames from there on have no score" << std::endl;
+            reported_end = true;
+            if (src_buffer != nullptr) frame_buffer_pool.release(src_buffer);
+            frame_buffer_pool.release(enc_buffer);
+            src_buffer = enc_buffer = nullptr;
+        }
 
         frame_tuple_t frame_tuple = std::make_tuple(i, src_buffer, enc_buffer);
+        const auto push_wait = Profiler::clock::now();
         queue.push(frame_tuple);
+        if (profiler) profiler->record(wait_track, Stage::QueuePush, i, push_wait, Profiler::clock::now());
+        if (metrics && fetched) metrics->frame_decoded(threadid);
     }
+    if (last_original >= 0) dedup->retire(last_original);
 }
 
 struct frame_reader_thread2_arguments{
-    std::string source_path; std::string encoded_path;
-    FFMS_Index* source_index; FFMS_Index* encoded_index;
-    int source_video_track_index; int encoded_video_track_index;
+    const VideoInput* source_input; const VideoInput* encoded_input;
     int threadid; int threadnum;
     std::vector<int>* frames_source;
     std::vector<int>* frames_encoded;
+    std::vector<int>* frames_todo;
+    bool decode_source = true;
+    bool interleave = false; const std::atomic<bool>* stop_reading;
+    Profiler* profiler = nullptr;
+    LiveMetrics* metrics = nullptr;
+    ThreadBudget* budget = nullptr;
+    dedup_t* dedup = nullptr; score_queue_t* score_queue = nullptr;
     int width = -1; int height = -1;
     frame_queue_t* frame_queue; frame_pool_t* frame_buffer_pool;
 };
 
 void frame_reader_thread2(frame_reader_thread2_arguments args){
-    VideoManager v1(args.source_path, args.source_index, args.source_video_track_index, args.width, args.height);
-    VideoManager v2(args.encoded_path, args.encoded_index, args.encoded_video_track_index, args.width, args.height);
-    frame_reader_thread(v1, v2, args.frames_source, args.frames_encoded, args.threadid, args.threadnum, *args.frame_queue, *args.frame_buffer_pool);
+    VideoManager v1(*args.source_input, args.width, args.height);
+    VideoManager v2(*args.encoded_input, args.width, args.height);
+    frame_reader_thread(v1, v2, args.frames_source, args.frames_encoded, args.frames_todo, args.threadid, args.threadnum, *args.frame_queue, *args.frame_buffer_pool, args.decode_source, args.interleave, args.stop_reading, args.profiler, args.metrics, args.budget, args.dedup, args.score_queue);
 }
 
 void frame_worker_thread(frame_queue_t &input_queue,
                          frame_pool_t &frame_buffer_pool, GpuWorker &gpu_worker,
                          MetricType metric, float intensity_multiplier,
-                         score_queue_t &output_score_queue) {
+                         score_queue_t &output_score_queue,
+                         FeatureStore* feature_store, const std::vector<int>& frames_source,
+                         Profiler* profiler, int profile_track,
+                         LiveMetrics* metrics, int worker_index, dedup_t* dedup) {
     while (true) {
+        const auto pop_wait = Profiler::clock::now();
         std::optional<std::tuple<int, uint8_t *, uint8_t *>> maybe_task =
             input_queue.pop();
         if (!maybe_task.has_value()) {
             break;
         }
         auto [frame_index, src_buffer, enc_buffer] = *maybe_task;
+        if (profiler) profiler->record(profile_track, Stage::QueuePop, frame_index, pop_wait, Profiler::clock::now());
+        if (enc_buffer == nullptr) {
+            output_score_queue.mark_missing(frame_index);
+            continue;
+        }
+
+        const int source_frame = frames_source[frame_index];
 
         std::tuple<float, float, float> scores;
+        const auto compute_start = Profiler::clock::now();
         try {
-            scores = gpu_worker.compute_metric_score(src_buffer, enc_buffer);
+            if (src_buffer == nullptr) {
+                scores = gpu_worker.compute_metric_score_from_reference(feature_store->find(source_frame), enc_buffer);
+            } else if (feature_store != nullptr) {
+                scores = gpu_worker.compute_metric_score(src_buffer, enc_buffer, feature_store->slot_for(source_frame));
+                feature_store->mark_stored(source_frame);
+            } else {
+                scores = gpu_worker.compute_metric_score(src_buffer, enc_buffer);
+            }
         } catch (const VshipError &e) {
             std::cout << " error: " << e.getErrorMessage() << std::endl;
-            frame_buffer_pool.insert(src_buffer);
-            frame_buffer_pool.insert(enc_buffer);
+            if (src_buffer != nullptr) frame_buffer_pool.release(src_buffer);
+            frame_buffer_pool.release(enc_buffer);
+            output_score_queue.mark_missing(frame_index);
+            settle_duplicates(dedup, output_score_queue, frame_index, std::nullopt);
             continue;
         }
 
-        output_score_queue.insert(std::make_tuple(frame_index, scores));
+        if (profiler) {
+            const helper::StageTimes &times = gpu_worker.stage_times;
+            profiler->record_device(profile_track, frame_index, compute_start, times.upload, times.compute, times.reduce);
+        }
+        if (metrics) metrics->frame_scored(worker_index, compute_start, Profiler::clock::now());
+
+        if (src_buffer != nullptr) frame_buffer_pool.release(src_buffer);
+        frame_buffer_pool.release(enc_buffer);
 
-        frame_buffer_pool.insert(src_buffer);
-        frame_buffer_pool.insert(enc_buffer);
+        output_score_queue.push(frame_index, scores);
+        settle_duplicates(dedup, output_score_queue, frame_index, scores);
     }
 }
 
+//writes the frames whose result is settled, in frame order, to every writer
+void emit_ordered_scores(score_queue_t& score_queue, int64_t& written,
+                         const std::vector<int>& frames_source, const std::vector<int>& frames_encoded,
+                         std::vector<std::unique_ptr<ScoreWriter>>& writers) {
+    const int64_t ready = score_queue.ordered_prefix();
+    if (ready == written) return;
+    for (; written < ready; written++) {
+        float values[3];
+        const float* values_ptr = nullptr;
+        if (score_queue.has_value(written)) {
+            const score_tuple_t& scores_tuple = score_queue.value(written);
+            values[0] = std::get<0>(scores_tuple);
+            values[1] = std::get<1>(scores_tuple);
+            values[2] = std::get<2>(scores_tuple);
+            values_ptr = values;
+        }
+        for (auto& writer : writers) writer->write(written, frames_source[written], frames_encoded[written], values_ptr);
+    }
+    for (auto& writer : writers) writer->flush();
+}
+
+//every finished frame, restored or computed, goes into the checkpoint
+bool save_checkpoint(score_queue_t& score_queue, const std::vector<int>& frames_source,
+                     const std::vector<int>& frames_encoded, const Checkpoint& checkpoint) {
+    std::vector<Checkpoint::Entry> entries;
+    for (int64_t i = 0; i < score_queue.size(); i++) {
+        if (!score_queue.has_value(i)) continue;
+        const score_tuple_t& scores_tuple = score_queue.value(i);
+        entries.push_back({frames_source[i], frames_encoded[i],
+                           {std::get<0>(scores_tuple), std::get<1>(scores_tuple), std::get<2>(scores_tuple)}});
+    }
+    return checkpoint.save(entries);
+}
+
+struct score_output_arguments{
+    const std::vector<int>* frames_source; const std::vector<int>* frames_encoded;
+    std::vector<std::unique_ptr<ScoreWriter>>* writers;
+    const Checkpoint* checkpoint = nullptr; int checkpoint_interval = 30; //seconds
+    ScoreCache* score_cache = nullptr; const std::vector<char>* precomputed = nullptr; //frames not to store again
+    PrecisionTracker* precision = nullptr; std::atomic<bool>* stop_reading = nullptr; //--target-precision
+    LiveMetrics* metrics = nullptr;
+};
+
 void aggregate_scores_function(score_queue_t& input_score_queue,
                                std::vector<float>& aggregated_scores,
                                ProgressBarT* progressBar,
-                               MetricType metric, bool livePrint) {
+                               MetricType metric,
+                               score_output_arguments outputs) {
+    const std::vector<int>* frames_source = outputs.frames_source;
+    const std::vector<int>* frames_encoded = outputs.frames_encoded;
+    std::vector<std::unique_ptr<ScoreWriter>>* writers = outputs.writers;
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    int64_t written = 0;
     while (true) {
-        std::optional<std::tuple<int, std::tuple<float, float, float>>>
-            maybe_score = input_score_queue.pop();
+        std::optional<int64_t> maybe_index = input_score_queue.pop();
 
-        if (!maybe_score.has_value()) {
+        if (!maybe_index.has_value()) {
             break;
         }
 
-        const auto &[frame_index, scores_tuple] = *maybe_score;
-        const bool should_store_first_score = (metric == MetricType::SSIMULACRA2);
+        const int64_t frame_index = *maybe_index;
+        if (outputs.metrics) outputs.metrics->frame_done(input_score_queue.has_value(frame_index));
+        if (input_score_queue.has_value(frame_index)) { //failed frames only have their error printed
+            const score_tuple_t &scores_tuple = input_score_queue.value(frame_index);
+            const bool should_store_first_score = (metric == MetricType::SSIMULACRA2);
+
+            if (should_store_first_score) {
+                aggregated_scores[frame_index] = std::get<0>(scores_tuple);
+                if (progressBar) progressBar->add_value(std::get<0>(scores_tuple));
+                if (outputs.precision) outputs.precision->add(std::get<0>(scores_tuple));
+            } else {
+                aggregated_scores[frame_index * 3] = std::get<0>(scores_tuple);
+                aggregated_scores[frame_index * 3 + 1] = std::get<1>(scores_tuple);
+                aggregated_scores[frame_index * 3 + 2] = std::get<2>(scores_tuple);
+                if (progressBar) progressBar->add_value(std::get<2>(scores_tuple));
+                if (outputs.precision) outputs.precision->add(std::get<2>(scores_tuple));
+            }
+
+            //the frames already queued are still scored, they only tighten the intervals
+            if (outputs.precision && outputs.precision->reached()) outputs.stop_reading->store(true, std::memory_order_relaxed);
+
+            if (outputs.score_cache && !(*outputs.precomputed)[frame_index]) {
+                outputs.score_cache->append((*frames_source)[frame_index], (*frames_encoded)[frame_index],
+                                            {std::get<0>(scores_tuple), std::get<1>(scores_tuple), std::get<2>(scores_tuple)});
+            }
+        }
+
+        emit_ordered_scores(input_score_queue, written, *frames_source, *frames_encoded, *writers);
+
+        if (outputs.checkpoint && std::chrono::steady_clock::now() - last_checkpoint >= std::chrono::seconds(outputs.checkpoint_interval)) {
+            if (!save_checkpoint(input_score_queue, *frames_source, *frames_encoded, *outputs.checkpoint)) {
+                std::cerr << "\nFailed to write checkpoint, the previous one is kept" << std::endl;
+            }
+            last_checkpoint = std::chrono::steady_clock::now();
+        }
+    }
+
+    for (auto& writer : *writers) writer->finish();
+    if (outputs.score_cache) outputs.score_cache->flush();
+    if (outputs.checkpoint && !save_checkpoint(input_score_queue, *frames_source, *frames_encoded, *outputs.checkpoint)) {
+        std::cerr << "Failed to write checkpoint" << std::endl;
+    }
+}
+
+//--benchmark decode/convert: the reader decodes (and converts) its share of the frames, nothing is scored
+void benchmark_reader_thread(VideoManager &v1, VideoManager &v2, const std::vector<int> &frames_source, const std::vector<int> &frames_encoded,
+                             int threadid, int threadnum, bool convert, uint8_t *src_buffer, uint8_t *enc_buffer,
+                             std::atomic<int64_t> &frames_done) {
+    auto read = [convert](VideoManager &v, int frame, uint8_t *buffer) {
+        return convert ? v.fetch_frame_into_buffer(frame, buffer) : v.decode_frame(frame);
+    };
+    const int num_frames = frames_source.size();
+    for (int i = num_frames*threadid/threadnum; i < num_frames*(threadid+1)/threadnum; i++) {
+        //both videos at the same time, as frame_reader_thread does
+        auto future_src = std::async(std::launch::async, [&]() { return read(v1, frames_source[i], src_buffer); });
+        const bool encoded = read(v2, frames_encoded[i], enc_buffer);
+        if (!future_src.get() || !encoded) break; //end of a stream
+        frames_done.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+//--benchmark compute: the workers score the same pair until count scores are started
+void benchmark_worker_thread(GpuWorker &gpu_worker, uint8_t *src_buffer, uint8_t *enc_buffer, int64_t count,
+                             std::atomic<int64_t> &frames_started, std::atomic<bool> &failed) {
+    while (frames_started.fetch_add(1, std::memory_order_relaxed) < count) {
+        try {
+            gpu_worker.compute_metric_score(src_buffer, enc_buffer);
+        } catch (const VshipError &e) {
+            std::cout << " error: " << e.getErrorMessage() << std::endl;
+            failed.store(true);
+            return;
+        }
+    }
+}
+
+//--benchmark: the fps of one stage alone is the ceiling it puts on the pipeline. The frames are those of
+//--start/--end/--every, decode and convert read them on the same reader threads as a normal run
+int run_benchmark(const CommandLineOptions &cli_args, VideoManager &v1, VideoManager &v2,
+                  const VideoInput &source_input, const VideoInput &encoded_input,
+                  const std::vector<int> &frames_source, const std::vector<int> &frames_encoded,
+                  int reader_count, int width, int height) {
+    if (frames_source.empty()) {
+        std::cerr << "--benchmark has no frame to read" << std::endl;
+        return 1;
+    }
+    const bool compute = cli_args.benchmark == "compute";
+    const int thread_count = compute ? cli_args.gpu_threads : reader_count;
+
+    //the same kind of memory as the frame pool of a normal run
+    std::vector<uint8_t *> buffers;
+#ifndef VSHIP_NO_SYCL
+    std::optional<sycl::queue> buffer_queue;
+    if (cli_args.backend == BackendType::SYCL) buffer_queue.emplace(helper::getDevices()[cli_args.gpu_id], sycl::property::queue::in_order{});
+#endif
+    for (int i = 0; i < 2*thread_count; i++) {
+#ifndef VSHIP_NO_SYCL
+        if (buffer_queue) {
+            buffers.push_back(GpuWorker::allocate_external_rgb_buffer(width, height, *buffer_queue));
+            continue;
+        }
+#endif
+        buffers.push_back(GpuWorker::allocate_external_rgb_buffer(width, height));
+    }
+    auto free_buffers = [&]() {
+        for (uint8_t *buffer : buffers) {
+#ifndef VSHIP_NO_SYCL
+            if (buffer_queue) {
+                GpuWorker::deallocate_external_buffer(buffer, *buffer_queue);
+                continue;
+            }
+#endif
+            std::free(buffer);
+        }
+    };
 
-        if (should_store_first_score) {
-            aggregated_scores[frame_index] = std::get<0>(scores_tuple);
-            if (progressBar) progressBar->add_value(std::get<0>(scores_tuple));
-            if (livePrint) std::cout << frame_index << " " << std::get<0>(scores_tuple) << std::endl;
+    std::atomic<int64_t> frames_done(0);
+    std::atomic<bool> failed(false);
+    std::vector<GpuWorker> gpu_workers;
+    std::vector<std::unique_ptr<VideoManager>> managers;
+    std::vector<std::thread> threads;
+    int64_t frame_count = frames_source.size();
+
+    if (compute) {
+        //decoded once, outside of the timing
+        if (!v1.fetch_frame_into_buffer(frames_source[0], buffers[0]) || !v2.fetch_frame_into_buffer(frames_encoded[0], buffers[1])) {
+            std::cerr << "Frame " << frames_source[0] << "/" << frames_encoded[0] << " (source/encoded) could not be read" << std::endl;
+            free_buffers();
+            return 1;
+        }
+        const size_t frame_bytes = static_cast<size_t>(width) * height * sizeof(uint16_t) * 3;
+        for (int i = 2; i < 2*thread_count; i++) std::memcpy(buffers[i], buffers[i % 2], frame_bytes);
+
+        gpu_workers.reserve(thread_count);
+        try {
+            for (int i = 0; i < thread_count; i++) {
+                gpu_workers.emplace_back(cli_args.metric, width, height, cli_args.intensity_target_nits, cli_args.gpu_id, cli_args.backend);
+                gpu_workers.back().set_threshold(cli_args.threshold);
+                //first score builds the kernels, it is not timed
+                gpu_workers.back().compute_metric_score(buffers[2*i], buffers[2*i+1]);
+            }
+        } catch (const VshipError &e) {
+            std::cout << e.getErrorMessage() << std::endl;
+            gpu_workers.clear();
+            free_buffers();
+            return 1;
+        }
+    } else {
+        //opened beforehand, a decoder taking long to open is not a slow decoder
+        for (int i = 1; i < reader_count; i++) {
+            managers.push_back(std::make_unique<VideoManager>(source_input, width, height));
+            managers.push_back(std::make_unique<VideoManager>(encoded_input, width, height));
+        }
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < thread_count; i++) {
+        if (compute) {
+            threads.emplace_back(benchmark_worker_thread, std::ref(gpu_workers[i]), buffers[2*i], buffers[2*i+1], frame_count,
+                                 std::ref(frames_done), std::ref(failed));
         } else {
-            aggregated_scores[frame_index * 3] = std::get<0>(scores_tuple);
-            aggregated_scores[frame_index * 3 + 1] = std::get<1>(scores_tuple);
-            aggregated_scores[frame_index * 3 + 2] = std::get<2>(scores_tuple);
-            if (progressBar) progressBar->add_value(std::get<2>(scores_tuple));
-            if (livePrint) std::cout << frame_index << " " << std::get<0>(scores_tuple) << " " << std::get<1>(scores_tuple) << " " << std::get<2>(scores_tuple) << std::endl;
+            VideoManager &source = (i == 0) ? v1 : *managers[2*(i-1)];
+            VideoManager &encoded = (i == 0) ? v2 : *managers[2*(i-1)+1];
+            threads.emplace_back(benchmark_reader_thread, std::ref(source), std::ref(encoded), std::cref(frames_source), std::cref(frames_encoded),
+                                 i, thread_count, cli_args.benchmark == "convert", buffers[2*i], buffers[2*i+1], std::ref(frames_done));
         }
     }
+    for (auto &thread : threads) thread.join();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+#ifndef VSHIP_NO_SYCL
+    helper::KernelTrace::get().close();
+#endif
+
+    gpu_workers.clear();
+    free_buffers();
+    if (failed.load()) return 1;
+    if (!compute) frame_count = frames_done.load();
+
+    std::cout << "Benchmark " << cli_args.benchmark << ": " << frame_count << " frames on " << thread_count
+              << (compute ? " gpu threads" : " reader threads") << " in " << std::fixed << std::setprecision(2) << seconds
+              << " s, " << frame_count / std::max(seconds, 1e-9) << " fps" << std::endl;
+    return 0;
 }
 
 void print_aggergate_metric_statistics(const std::vector<float> &data,
@@ -192,6 +543,8 @@ void print_aggergate_metric_statistics(const std::vector<float> &data,
 }
 
 int main(int argc, char **argv) {
+    helper::enablePersistentKernelCache();
+
     CommandLineOptions cli_args = parse_command_line_arguments(argc, argv);
     if (cli_args.NoAssertExit){
         return 1; //error is already handled
@@ -213,14 +566,18 @@ int main(int argc, char **argv) {
         return 0;
     }
 
+#ifndef VSHIP_NO_SYCL
     // gpu sanity check
-    try {
-        // if succeed, this function also does hipSetDevice
-        helper::gpuFullCheck(cli_args.gpu_id);
-    } catch (const VshipError &e) {
-        std::cout << e.getErrorMessage() << std::endl;
-        return 1;
+    if (cli_args.backend == BackendType::SYCL) {
+        try {
+            // if succeed, this function also does hipSetDevice
+            helper::gpuFullCheck(cli_args.gpu_id);
+        } catch (const VshipError &e) {
+            std::cout << e.getErrorMessage() << std::endl;
+            return 1;
+        }
     }
+#endif
 
     auto init = std::chrono::high_resolution_clock::now();
 
@@ -229,16 +586,79 @@ int main(int argc, char **argv) {
     const int num_gpus = cli_args.gpu_threads;
     const int num_frame_buffer = num_gpus*2 + 2*queue_capacity + 2*cli_args.cpu_threads; //maximum number of buffers in nature possible
 
-    FFMSIndexResult source_index = FFMSIndexResult(cli_args.source_file, cli_args.source_index, cli_args.cache_index, !cli_args.live_index_score_output);
-    FFMSIndexResult encode_index = FFMSIndexResult(cli_args.encoded_file, cli_args.encoded_index, cli_args.cache_index, !cli_args.live_index_score_output);
+    //a resumed run should not have to index again either
+    const bool cache_index = cli_args.cache_index || !cli_args.checkpoint_file.empty();
+    VideoInput source_input = describe_input(cli_args.source_file, cli_args.raw_format);
+    VideoInput encoded_input = describe_input(cli_args.encoded_file, cli_args.raw_format);
+    if (source_input.type == InputType::Stream){
+        std::cerr << "The source must be a file, only the encoded input can be a pipe" << std::endl;
+        return 1;
+    }
+    const bool encoded_stream = (encoded_input.type == InputType::Stream);
+
+    //a sequential decoder reads every frame up to the last one asked for, worth it for dense schedules only
+    //(--target-precision reads the frames in random order, --scene-sampling a few frames per scene)
+    const bool dense_schedule = cli_args.every_nth_frame == 1 && cli_args.source_indices_list.empty() && cli_args.encoded_indices_list.empty()
+                                && cli_args.target_precision == 0 && cli_args.scene_sampling == 0;
+    if (cli_args.decoder == DecoderType::Libav || (cli_args.decoder == DecoderType::Auto && dense_schedule)){
+        if (source_input.type == InputType::FFMS) source_input.type = InputType::Libav;
+        if (encoded_input.type == InputType::FFMS) encoded_input.type = InputType::Libav;
+    }
+    if (encoded_stream && (!cli_args.checkpoint_file.empty() || !cli_args.score_cache_dir.empty())){
+        std::cerr << "--checkpoint and --score-cache need an encoded file, not a pipe" << std::endl;
+        return 1;
+    }
+
+    //both files are indexed at the same time, each on its own thread. Only FFMS inputs need an index
+    std::future<std::unique_ptr<FFMSIndexResult>> encode_index_future;
+    if (encoded_input.type == InputType::FFMS){
+        encode_index_future = std::async(std::launch::async, [&cli_args, cache_index](){
+            return std::make_unique<FFMSIndexResult>(cli_args.encoded_file, cli_args.encoded_index, cache_index, !cli_args.live_index_score_output);
+        });
+    }
+    std::unique_ptr<FFMSIndexResult> source_index;
+    if (source_input.type == InputType::FFMS){
+        source_index = std::make_unique<FFMSIndexResult>(cli_args.source_file, cli_args.source_index, cache_index, !cli_args.live_index_score_output);
+        source_input.index = source_index->index;
+        source_input.video_track = source_index->selected_video_track;
+    }
+    std::unique_ptr<FFMSIndexResult> encode_index;
+    if (encode_index_future.valid()){
+        encode_index = encode_index_future.get();
+        encoded_input.index = encode_index->index;
+        encoded_input.video_track = encode_index->selected_video_track;
+    }
+
+    //streams and sequential decoders are read by a single thread, in order. Their parallelism is inside the decoder
+    const bool sequential = sequential_input(source_input) || sequential_input(encoded_input);
+    const int reader_count = sequential ? 1 : cli_args.cpu_threads;
+
+    //decoders are given their threads when opened, the shared pool is created by the first VideoManager
+    bool cpu_compute = cli_args.backend == BackendType::CPU;
+#ifndef VSHIP_NO_SYCL
+    if (cli_args.backend == BackendType::SYCL) cpu_compute = helper::getDevices()[cli_args.gpu_id].is_cpu();
+#endif
+    ThreadBudget budget(cli_args.cpu_budget, reader_count*(compressed_input(source_input) + compressed_input(encoded_input)), cpu_compute);
+    budget.configure_pool();
+    const bool pinned = cli_args.pin_threads && budget.pin_process();
+    source_input.decoder_threads = encoded_input.decoder_threads = budget.decoder_threads();
+    if (cli_args.cpu_budget > 0 && !cli_args.live_index_score_output){
+        std::cout << "CPU budget: " << budget.cores() << " cores, " << budget.decoder_threads() << " threads per decoder, "
+                  << budget.pool_threads() << " of " << budget.pool_capacity() << " pool threads active at first" << std::endl;
+    }
 
     //initiliaze first sources to get width and height
-    VideoManager v1(cli_args.source_file, source_index.index,
-                    source_index.selected_video_track);
+    VideoManager v1(source_input);
     int width = v1.reader->frame_width, height = v1.reader->frame_height;
 
-    VideoManager v2(cli_args.encoded_file, encode_index.index,
-                    encode_index.selected_video_track, width, height);
+    VideoManager v2(encoded_input, width, height);
+    if (pinned) budget.pin_pool(helper::ThreadPool::shared());
+    budget.start(helper::ThreadPool::shared());
+
+    if (cli_args.target_precision > 0 && sequential){
+        std::cerr << "--target-precision reads frames in random order, it needs seekable inputs (files, --decoder ffms)" << std::endl;
+        return 1;
+    }
 
     //sanitize start_frame, end_frame, every_nth_frame and encoded_offset
     int start = cli_args.start_frame;
@@ -265,7 +685,23 @@ int main(int argc, char **argv) {
     std::vector<int> frames_source;
     std::vector<int> frames_encoded;
 
-    if (cli_args.source_indices_list.empty()){
+    std::vector<Scene> scenes;
+    if (cli_args.scene_sampling > 0){
+        if (cli_args.scene_detection == "keyframes"){
+            if (!source_index){
+                std::cerr << "--scene-detection keyframes needs a source indexed by FFMS2" << std::endl;
+                return 1;
+            }
+            scenes = scenes_from_keyframes(source_index->getKeyFrameIndices(), start, end);
+        } else {
+            //own reader: a sequential v1 could not go back to start afterwards
+            std::unique_ptr<FrameReader> scan_reader = open_frame_reader(source_input);
+            scenes = LumaSceneDetector().detect(*scan_reader, start, end, v1.processor->src_format.depth);
+        }
+        frames_source = sample_scenes(scenes, cli_args.scene_sampling);
+        for (const int frame : frames_source) frames_encoded.push_back(frame + encoded_offset);
+        if (!cli_args.live_index_score_output) std::cout << "Scene sampling: " << scenes.size() << " scenes, " << frames_source.size() << " of " << end - start << " frames to score" << std::endl;
+    } else if (cli_args.source_indices_list.empty()){
         frames_source.reserve((end - start + every-1)/every);
         for (int i = start; i < end; i += every) frames_source.push_back(i);
     } else {
@@ -278,7 +714,9 @@ int main(int argc, char **argv) {
         }
     }
 
-    if (cli_args.encoded_indices_list.empty() && cli_args.source_indices_list.empty()){
+    if (cli_args.scene_sampling > 0){
+        //already chosen with the source frames
+    } else if (cli_args.encoded_indices_list.empty() && cli_args.source_indices_list.empty()){
         frames_encoded.reserve((end - start + every-1)/every);
         for (int i = start; i < end; i += every) frames_encoded.push_back(i+encoded_offset);
     } else if (cli_args.encoded_indices_list.empty() && !cli_args.source_indices_list.empty()) {
@@ -306,69 +744,265 @@ int main(int argc, char **argv) {
 
     int num_frames = frames_source.size();
 
+    if (!cli_args.benchmark.empty()) {
+        return run_benchmark(cli_args, v1, v2, source_input, encoded_input, frames_source, frames_encoded, reader_count, width, height);
+    }
+
+    //--auto-crop: the region of the frames that is scored, the whole frame otherwise
+    CropRegion crop = {0, 0, width, height};
+    if (cli_args.auto_crop){
+        //own reader, like the scene detection
+        std::unique_ptr<FrameReader> scan_reader = open_frame_reader(source_input);
+        const zimg_image_format &format = v1.processor->src_format;
+        crop = LetterboxDetector().detect(*scan_reader, start, end, format.depth, format.pixel_range == ZIMG_RANGE_LIMITED);
+    }
+    const bool cropped = crop.width != width || crop.height != height;
+    //scores of another region are not those of this run
+    std::string crop_label;
+    if (cropped){
+        std::stringstream label;
+        label << " crop " << crop.left << "," << crop.top << "," << crop.width << "," << crop.height;
+        crop_label = label.str();
+    }
+    if (cli_args.auto_crop && !cli_args.live_index_score_output){
+        if (cropped){
+            std::cout << "Auto-crop: scoring " << crop.width << "x" << crop.height << " at (" << crop.left << ", " << crop.top
+                      << ") of " << width << "x" << height << std::endl;
+        } else {
+            std::cout << "Auto-crop: no letterbox found, scoring whole frames" << std::endl;
+        }
+    }
+
     if (cli_args.live_index_score_output) std::cout << num_frames << std::endl;
 
+    //results are streamed in frame order while the run is in progress
+    const int values_per_frame = (cli_args.metric == MetricType::SSIMULACRA2) ? 1 : 3;
+    const std::vector<std::string> value_names = (cli_args.metric == MetricType::SSIMULACRA2)
+        ? std::vector<std::string>{"ssimulacra2"}
+        : std::vector<std::string>{"norm2", "norm3", "norminf"};
+    std::vector<std::unique_ptr<ScoreWriter>> score_writers;
+    if (cli_args.live_index_score_output) score_writers.push_back(std::make_unique<LiveScoreWriter>(values_per_frame));
+    if (!cli_args.json_output_file.empty()) score_writers.push_back(std::make_unique<JsonScoreWriter>(cli_args.json_output_file, values_per_frame));
+    if (!cli_args.csv_output_file.empty()) score_writers.push_back(std::make_unique<CsvScoreWriter>(cli_args.csv_output_file, value_names));
+    if (!cli_args.binary_output_file.empty()) score_writers.push_back(std::make_unique<BinaryScoreWriter>(cli_args.binary_output_file, values_per_frame));
+    for (const auto& writer : score_writers) {
+        if (!writer->good()) {
+            std::cerr << "Failed to open output file" << std::endl;
+            return 1;
+        }
+    }
 
-    auto devices = sycl::device::get_devices(sycl::info::device_type::gpu);
-    std::set<uint8_t *> frame_buffers;
-    for (unsigned int i = 0; i < num_frame_buffer; ++i) {
-        sycl::queue q(devices[cli_args.gpu_id], sycl::property::queue::in_order{});
-        frame_buffers.insert(GpuWorker::allocate_external_rgb_buffer(width, height, q));
+    score_queue_t score_queue(num_frames);
+
+    //frames already scored by an interrupted run or found in the score cache are settled right away,
+    //only the others are decoded
+    std::map<std::pair<int, int>, Checkpoint::entry_values> checkpointed;
+    std::unique_ptr<Checkpoint> checkpoint;
+    if (!cli_args.checkpoint_file.empty()) {
+        //the parameters that change the scores, like those of the score cache
+        std::string checkpoint_metric = (cli_args.metric == MetricType::SSIMULACRA2) ? "SSIMULACRA2" : "Butteraugli";
+        if (cli_args.metric == MetricType::Butteraugli) checkpoint_metric += " " + std::to_string(cli_args.intensity_target_nits);
+        checkpoint = std::make_unique<Checkpoint>(cli_args.checkpoint_file, cli_args.source_file, cli_args.encoded_file,
+                                                  checkpoint_metric + crop_label, values_per_frame);
+        checkpointed = checkpoint->load();
     }
 
+    ScoreCache::Lookup cached;
+    std::unique_ptr<ScoreCache> score_cache;
+    if (!cli_args.score_cache_dir.empty()) {
+        //bump the version when a change of the metric implementation changes the scores
+        std::stringstream parameters;
+        parameters << "scores-v1 " << (cli_args.metric == MetricType::SSIMULACRA2 ? "SSIMULACRA2" : "Butteraugli");
+        if (cli_args.metric == MetricType::Butteraugli) parameters << " " << cli_args.intensity_target_nits;
+        parameters << crop_label;
+        score_cache = std::make_unique<ScoreCache>(cli_args.score_cache_dir, cli_args.source_file, cli_args.encoded_file, parameters.str());
+        cached = score_cache->load();
+        if (!score_cache->open_for_append()) {
+            std::cerr << "Cannot write to score cache [" << score_cache->file_path() << "], new scores will not be stored" << std::endl;
+        }
+    }
+
+    std::vector<int> frames_todo;
+    std::vector<char> precomputed(num_frames, 0);
+    int from_checkpoint = 0, from_cache = 0;
+    for (int i = 0; i < num_frames; i++) {
+        const auto it = checkpointed.find({frames_source[i], frames_encoded[i]});
+        const ScoreCache::entry_values* hit = cached.find(frames_source[i], frames_encoded[i]);
+        if (it != checkpointed.end()) {
+            score_queue.push(i, std::make_tuple(it->second[0], it->second[1], it->second[2]));
+            from_checkpoint++;
+        } else if (hit != nullptr) {
+            score_queue.push(i, std::make_tuple((*hit)[0], (*hit)[1], (*hit)[2]));
+            from_cache++;
+        } else {
+            frames_todo.push_back(i);
+            continue;
+        }
+        precomputed[i] = 1;
+    }
+    //every prefix of the stratified order is spread over the whole video, stopping anywhere leaves a fair sample
+    if (cli_args.target_precision > 0) frames_todo = stratified_order(frames_todo);
+    if (!cli_args.live_index_score_output) {
+        if (from_checkpoint) std::cout << "Resuming from checkpoint: " << from_checkpoint << " frames already scored" << std::endl;
+        if (from_cache) std::cout << "Score cache: " << from_cache << " of " << num_frames << " frames found" << std::endl;
+    }
+
+    std::vector<uint8_t *> frame_buffers;
+    if (cli_args.backend == BackendType::CPU) {
+        for (int i = 0; i < num_frame_buffer; ++i) {
+            frame_buffers.push_back(GpuWorker::allocate_external_rgb_buffer(width, height));
+        }
+    }
+#ifndef VSHIP_NO_SYCL
+    auto devices = helper::getDevices();
+    if (cli_args.backend == BackendType::SYCL) {
+        for (int i = 0; i < num_frame_buffer; ++i) {
+            sycl::queue q(devices[cli_args.gpu_id], sycl::property::queue::in_order{});
+            frame_buffers.push_back(GpuWorker::allocate_external_rgb_buffer(width, height, q));
+        }
+    }
+#endif
+
     frame_pool_t frame_buffer_pool(frame_buffers);
     frame_queue_t frame_queue(queue_capacity);
 
+#ifndef VSHIP_NO_SYCL
+    if (cli_args.autotune && cli_args.backend == BackendType::SYCL){
+        try {
+            sycl::queue tune_queue(devices[cli_args.gpu_id], helper::queueProperties());
+            ssimu2::autotuneKernels(tune_queue, crop.width, crop.height, !cli_args.live_index_score_output);
+        } catch (const VshipError &e) {
+            std::cout << e.getErrorMessage() << std::endl;
+            return 1;
+        }
+    }
+#endif
+
+    //reference features: reused if they cover every frame to compute, built by this run otherwise
+    std::unique_ptr<FeatureStore> feature_store;
+    bool decode_source = true;
+    if (!cli_args.reference_features_file.empty() && !frames_todo.empty()) {
+        std::vector<int> source_frames_todo;
+        source_frames_todo.reserve(frames_todo.size());
+        for (const int i : frames_todo) source_frames_todo.push_back(frames_source[i]);
+        const int64_t floats_per_frame = GpuWorker::reference_feature_size(cli_args.backend, width, height);
+        //the layout of the features depends on the backend, their values on the metric and the conversion of the source
+        std::stringstream parameters;
+        parameters << "features-v1 " << (cli_args.backend == BackendType::CPU ? "cpu" : "sycl") << " SSIMULACRA2 "
+                   << v1.processor->describe();
+        feature_store = std::make_unique<FeatureStore>(cli_args.reference_features_file, cli_args.source_file, parameters.str(), width, height, floats_per_frame);
+        if (feature_store->open(source_frames_todo)) {
+            decode_source = false;
+            if (!cli_args.live_index_score_output) std::cout << "Reference features loaded from [" << feature_store->file_path() << "]" << std::endl;
+        } else if (!feature_store->create(source_frames_todo)) {
+            std::cerr << "Cannot create reference features [" << feature_store->file_path() << "], they will not be stored" << std::endl;
+            feature_store.reset();
+        }
+    }
+
     std::vector<GpuWorker> gpu_workers;
     gpu_workers.reserve(num_gpus);
 
     for (int i = 0; i < num_gpus; i++){
-        gpu_workers.emplace_back(cli_args.metric, width, height, cli_args.intensity_target_nits, cli_args.gpu_id);
+        try {
+            gpu_workers.emplace_back(cli_args.metric, crop.width, crop.height, cli_args.intensity_target_nits, cli_args.gpu_id, cli_args.backend, !cli_args.profile_file.empty());
+            gpu_workers.back().set_threshold(cli_args.threshold);
+            gpu_workers.back().set_frame_region(width, height, crop.left, crop.top);
+        } catch (const VshipError &e) {
+            std::cout << e.getErrorMessage() << std::endl;
+            return 1;
+        }
     }
 
+    const bool early_termination = cli_args.target_precision > 0;
+    std::atomic<bool> stop_reading(false);
+    std::unique_ptr<PrecisionTracker> precision;
+    if (early_termination) precision = std::make_unique<PrecisionTracker>(cli_args.target_precision, num_frames);
+
+    std::unique_ptr<Profiler> profiler;
+    if (!cli_args.profile_file.empty()) profiler = std::make_unique<Profiler>(cli_args.profile_file);
+
+    std::unique_ptr<LiveMetrics> metrics;
+    std::unique_ptr<MetricsExporter> metrics_exporter;
+    if (!cli_args.metrics_file.empty() || !cli_args.metrics_socket.empty()) {
+        LiveMetrics::Sources sources;
+        sources.frame_queue_depth = [&frame_queue]() { return frame_queue.size(); };
+        sources.frame_queue_capacity = frame_queue.capacity();
+        sources.score_queue_depth = [&score_queue]() { return score_queue.backlog(); };
+        sources.buffers_in_use = [&frame_buffer_pool]() { return frame_buffer_pool.in_use(); };
+        sources.buffer_count = frame_buffer_pool.size();
+        metrics = std::make_unique<LiveMetrics>(num_frames, reader_count, num_gpus, sources);
+        const bool socket_mode = !cli_args.metrics_socket.empty();
+        metrics_exporter = std::make_unique<MetricsExporter>(*metrics, socket_mode ? cli_args.metrics_socket : cli_args.metrics_file, socket_mode);
+        if (!metrics_exporter->start()) return 1;
+    }
+
+    std::unique_ptr<dedup_t> dedup;
+    if (cli_args.dedup) dedup = std::make_unique<dedup_t>();
+
     std::vector<std::thread> reader_threads;
-    reader_threads.emplace_back(frame_reader_thread, std::ref(v1), std::ref(v2), &frames_source, &frames_encoded, 0, cli_args.cpu_threads,
-                            std::ref(frame_queue), std::ref(frame_buffer_pool));
+    reader_threads.emplace_back(frame_reader_thread, std::ref(v1), std::ref(v2), &frames_source, &frames_encoded, &frames_todo, 0, reader_count,
+                            std::ref(frame_queue), std::ref(frame_buffer_pool), decode_source, early_termination, &stop_reading, profiler.get(),
+                            metrics.get(), &budget, dedup.get(), &score_queue);
 
-    if (cli_args.cpu_threads > 1){
+    if (reader_count > 1){
         frame_reader_thread2_arguments reader_args;
-        reader_args.source_path = cli_args.source_file; reader_args.encoded_path = cli_args.encoded_file;
-        reader_args.source_index = source_index.index; reader_args.encoded_index = encode_index.index;
-        reader_args.source_video_track_index = source_index.selected_video_track; reader_args.encoded_video_track_index = encode_index.selected_video_track;
-        reader_args.threadnum = cli_args.cpu_threads;
+        reader_args.source_input = &source_input; reader_args.encoded_input = &encoded_input;
+        reader_args.threadnum = reader_count;
         reader_args.frames_source = &frames_source;
         reader_args.frames_encoded = &frames_encoded;
+        reader_args.frames_todo = &frames_todo;
+        reader_args.decode_source = decode_source;
+        reader_args.interleave = early_termination;
+        reader_args.stop_reading = &stop_reading;
+        reader_args.profiler = profiler.get();
+        reader_args.metrics = metrics.get();
+        reader_args.budget = &budget;
+        reader_args.dedup = dedup.get();
+        reader_args.score_queue = &score_queue;
         reader_args.width = width;
         reader_args.height = height;
         reader_args.frame_queue = &frame_queue;
         reader_args.frame_buffer_pool = &frame_buffer_pool;
 
-        for (int i = 1; i < cli_args.cpu_threads; i++){
+        for (int i = 1; i < reader_count; i++){
             reader_args.threadid = i;
             reader_threads.emplace_back(frame_reader_thread2, reader_args);
         }
     }
 
-    score_queue_t score_queue({});
-
     std::vector<std::thread> workers;
     for (int i = 0; i < num_gpus; ++i) {
         workers.emplace_back(frame_worker_thread, std::ref(frame_queue),
                              std::ref(frame_buffer_pool),
                              std::ref(gpu_workers[i]), cli_args.metric,
                              cli_args.intensity_target_nits,
-                             std::ref(score_queue));
+                             std::ref(score_queue), feature_store.get(), std::cref(frames_source),
+                             profiler.get(), profiler ? profiler->track("worker " + std::to_string(i)) : 0,
+                             metrics.get(), i, dedup.get());
     }
 
     const int score_vector_size = (cli_args.metric == MetricType::SSIMULACRA2)
                                       ? num_frames
                                       : num_frames * 3;
     std::vector<float> scores(score_vector_size);
-    ProgressBarT* progressBar;
+    ProgressBarT* progressBar = nullptr;
     if (!cli_args.live_index_score_output) progressBar = new ProgressBarT(num_frames);
 
+    score_output_arguments outputs;
+    outputs.frames_source = &frames_source;
+    outputs.frames_encoded = &frames_encoded;
+    outputs.writers = &score_writers;
+    outputs.checkpoint = checkpoint.get();
+    outputs.checkpoint_interval = cli_args.checkpoint_interval;
+    outputs.score_cache = score_cache.get();
+    outputs.precomputed = &precomputed;
+    outputs.precision = precision.get();
+    outputs.stop_reading = &stop_reading;
+    outputs.metrics = metrics.get();
+
     std::thread score_thread(aggregate_scores_function, std::ref(score_queue),
-                             std::ref(scores), progressBar, cli_args.metric, cli_args.live_index_score_output);
+                             std::ref(scores), progressBar, cli_args.metric, outputs);
 
     for (auto& reader_thread: reader_threads) reader_thread.join();
     frame_queue.close();
@@ -376,8 +1010,28 @@ int main(int argc, char **argv) {
     for (auto &w : workers)
         w.join();
 
+    //frames left behind by an early stop have no score
+    int frames_computed = 0;
+    for (const int i : frames_todo) {
+        if (!score_queue.is_settled(i)) score_queue.mark_missing(i);
+        if (score_queue.has_value(i)) frames_computed++;
+    }
+
     score_queue.close();
     score_thread.join();
+    if (metrics_exporter) metrics_exporter->stop();
+    budget.stop();
+#ifndef VSHIP_NO_SYCL
+    helper::KernelTrace::get().close();
+#endif
+
+    if (feature_store && feature_store->is_writing() && !feature_store->finish()) {
+        std::cerr << "Failed to write reference features [" << feature_store->file_path() << "]" << std::endl;
+    }
+
+    if (profiler && !profiler->write_trace()) {
+        std::cerr << "Failed to write profile [" << profiler->file_path() << "]" << std::endl;
+    }
 
     if (!cli_args.live_index_score_output){
         std::cout << std::endl; //end of progressbar
@@ -390,41 +1044,11 @@ int main(int argc, char **argv) {
         std::chrono::duration_cast<std::chrono::milliseconds>(fin - init)
             .count();
 
-    float fps = num_frames * 1000 / millitaken;
+    //frames restored from a checkpoint cost nothing and are not counted
+    float fps = frames_computed * 1000 / std::max(millitaken, 1);
 
     // posttreatment
 
-    // json output
-    if (cli_args.json_output_file != "") {
-        std::ofstream jsonfile(cli_args.json_output_file, std::ios_base::out);
-        if (!jsonfile) {
-            std::cerr << "Failed to open output file" << std::endl;
-            return 1;
-        }
-        jsonfile << "[";
-        for (int i = 0; i < num_frames; i++) {
-            jsonfile << "[";
-            switch (cli_args.metric) {
-            case MetricType::Butteraugli:
-                jsonfile << scores[3 * i] << ", ";
-                jsonfile << scores[3 * i + 1] << ", ";
-                jsonfile << scores[3 * i + 2];
-                break;
-            case MetricType::SSIMULACRA2:
-                jsonfile << scores[i];
-                break;
-            case MetricType::Unknown:
-                break;
-            }
-            if (i == num_frames - 1) {
-                jsonfile << "]";
-            } else {
-                jsonfile << "], ";
-            }
-        }
-        jsonfile << "]";
-    }
-
     if (cli_args.live_index_score_output) return 0;
 
     // console output
@@ -432,25 +1056,58 @@ int main(int argc, char **argv) {
                                                              : "SSIMU2")
               << " Result between " << cli_args.source_file << " and "
               << cli_args.encoded_file << std::endl;
-    std::cout << "Computed " << num_frames << " frames at " << fps << " fps\n"
-              << std::endl;
+    std::cout << "Computed " << frames_computed << " frames at " << fps << " fps" << std::endl;
+    if (dedup) std::cout << "Deduplicated " << dedup->duplicates() << " frames, which reused the score of the previous pair" << std::endl;
+    std::cout << std::endl;
+
+    //the statistics are those of the scored frames only: frames left by an early stop, past the end of an
+    //encoded stream or that failed have no score
+    std::vector<int> scored_frames;
+    for (int i = 0; i < num_frames; ++i) {
+        if (score_queue.has_value(i)) scored_frames.push_back(i);
+    }
+    const int frames_missing = num_frames - (int)scored_frames.size();
+    if (frames_missing > 0 && !early_termination) {
+        std::cout << frames_missing << " of " << num_frames << " frames could not be scored (end of the encoded stream or decoding errors), they are left out of the statistics" << std::endl << std::endl;
+    }
 
     if (cli_args.metric == MetricType::Butteraugli) {
-        std::vector<float> norm2(num_frames), norm3(num_frames),
-            norminf(num_frames);
+        std::vector<float> norm2, norm3, norminf;
 
-        for (int i = 0; i < num_frames; ++i) {
-            norm2[i] = scores[3 * i];
-            norm3[i] = scores[3 * i + 1];
-            norminf[i] = scores[3 * i + 2];
+        for (const int i : scored_frames) {
+            norm2.push_back(scores[3 * i]);
+            norm3.push_back(scores[3 * i + 1]);
+            norminf.push_back(scores[3 * i + 2]);
         }
 
         print_aggergate_metric_statistics(norm2, "2-Norm");
         print_aggergate_metric_statistics(norm3, "3-Norm");
         print_aggergate_metric_statistics(norminf, "INF-Norm");
+        if (precision) precision->print_report("INF-Norm");
 
+    } else if (cli_args.threshold != -INFINITY) {
+        //below the threshold scores may only be upper bounds, the usual statistics would be meaningless
+        int passing = 0;
+        for (const int i : scored_frames) {
+            if (scores[i] >= cli_args.threshold) passing++;
+        }
+        int64_t early_decisions = 0;
+        for (const GpuWorker &worker : gpu_workers) early_decisions += worker.early_decisions;
+        std::cout << "---SSIMULACRA2 threshold " << cli_args.threshold << "---" << std::endl;
+        std::cout << "Frames at least the threshold : " << passing << " of " << num_frames << std::endl;
+        std::cout << "Decided from the coarse scales : " << early_decisions << std::endl;
+        std::cout << std::endl;
     } else if (cli_args.metric == MetricType::SSIMULACRA2) {
-        print_aggergate_metric_statistics(scores, "SSIMULACRA2");
+        std::vector<float> ssimu2;
+        for (const int i : scored_frames) ssimu2.push_back(scores[i]);
+        print_aggergate_metric_statistics(ssimu2, "SSIMULACRA2");
+        if (precision) precision->print_report("SSIMULACRA2");
+        if (!scenes.empty()) {
+            std::vector<int> scored_source;
+            for (const int i : scored_frames) scored_source.push_back(frames_source[i]);
+            print_scene_statistics(scenes, scored_source, ssimu2, "SSIMULACRA2");
+        }
     }
+    if (profiler) profiler->print_summary();
     return 0;
 }
@@ -8,7 +8,7 @@
 namespace helper{
 
 struct ArgParser {
-    using TargetVariant = std::variant<bool*, int*, std::string*>;
+    using TargetVariant = std::variant<bool*, int*, float*, std::string*>;
 
     struct FlagGroup {
         bool set = false;
@@ -32,7 +32,7 @@ struct ArgParser {
     void add_flag(const std::vector<std::string>& flag_names, TargetType* target_pointer,
                   std::string help_description = "", bool positional = false) {
         static_assert(std::is_same_v<TargetType, bool> || std::is_same_v<TargetType, int> ||
-            std::is_same_v<TargetType, std::string>, "Unsupported flag type"
+            std::is_same_v<TargetType, float> || std::is_same_v<TargetType, std::string>, "Unsupported flag type"
         );
 
         for (const std::string& name : flag_names) alias_map[name] = flag_groups.size(); //new index
@@ -97,7 +97,7 @@ private:
         const std::string& flag = arguments[index];
 
         FlagGroup* group_ptr; //output of the if
-        bool positional = flag[0] != '-';
+        bool positional = flag[0] != '-' || flag == "-"; //"-" is stdin
         if (!positional){
             auto foundIndexIterator = alias_map.find(flag);
             if (foundIndexIterator == alias_map.end()) {
@@ -142,6 +142,18 @@ private:
             return true;
         }
     
+        if (std::holds_alternative<float*>(found)) {
+            float* ptr = std::get<float*>(found);
+            try {
+                *ptr = std::stof(arguments[++index]);
+                return true;
+            } catch (...) {
+                std::cerr << "Invalid number value: " << arguments[index] << " for arg "
+                    << flag << "\n";
+                return false;
+            }
+        }
+
         // Assume it is an int
         int* ptr = std::get<int*>(found);
         try {
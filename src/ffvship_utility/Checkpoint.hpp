@@ -0,0 +1,131 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//--checkpoint: the scores of every finished frame are periodically saved so that an interrupted run
+//only computes the missing frames when it is started again with the same arguments.
+//The file is written next to its final path, synced and renamed over it, so a kill during a save
+//leaves the previous checkpoint intact.
+//
+//format (text):
+//  vscycle-checkpoint 1
+//  <identity line: inputs, their sizes and the metric>
+//  <values per frame>
+//  <source_frame> <encoded_frame> <value>... (one line per finished frame)
+class Checkpoint {
+  public:
+    using entry_values = std::array<float, 3>;
+    struct Entry {
+        int source_frame;
+        int encoded_frame;
+        entry_values values;
+    };
+
+  private:
+    std::string path;
+    std::string identity;
+    int values_per_frame;
+
+    static uintmax_t size_or_zero(const std::string &file) {
+        std::error_code ec;
+        const uintmax_t size = std::filesystem::file_size(file, ec);
+        return ec ? 0 : size;
+    }
+
+  public:
+    Checkpoint(const std::string &path, const std::string &source_file, const std::string &encoded_file,
+               const std::string &metric_name, int values_per_frame)
+        : path(path), values_per_frame(values_per_frame) {
+        std::stringstream ss;
+        ss << source_file << "\t" << size_or_zero(source_file) << "\t" << encoded_file << "\t"
+           << size_or_zero(encoded_file) << "\t" << metric_name;
+        identity = ss.str();
+    }
+
+    //scores of a previous run with the same inputs and metric, keyed by (source frame, encoded frame)
+    std::map<std::pair<int, int>, entry_values> load() const {
+        std::map<std::pair<int, int>, entry_values> res;
+        std::ifstream file(path);
+        if (!file) return res; //first run
+
+        std::string header, file_identity, values_line;
+        std::getline(file, header);
+        std::getline(file, file_identity);
+        std::getline(file, values_line);
+        if (header != "vscycle-checkpoint 1" || file_identity != identity ||
+            values_line != std::to_string(values_per_frame)) {
+            std::cerr << "Checkpoint [" << path << "] belongs to another run, it will be overwritten" << std::endl;
+            return res;
+        }
+
+        std::string line;
+        while (std::getline(file, line)) {
+            std::stringstream ls(line);
+            int source_frame, encoded_frame;
+            entry_values values{};
+            ls >> source_frame >> encoded_frame;
+            for (int i = 0; i < values_per_frame; i++) ls >> values[i];
+            if (ls.fail()) break;
+            res[{source_frame, encoded_frame}] = values;
+        }
+        return res;
+    }
+
+    //false if the checkpoint could not be written, the previous one is then kept
+    bool save(const std::vector<Entry> &entries) const {
+        const std::string temp_path = path + ".tmp";
+        FILE *file = std::fopen(temp_path.c_str(), "wb");
+        if (file == nullptr) return false;
+
+        std::stringstream ss;
+        ss << "vscycle-checkpoint 1\n" << identity << "\n" << values_per_frame << "\n";
+        ss << std::setprecision(9); //round trips floats exactly
+        for (const Entry &entry : entries) {
+            ss << entry.source_frame << " " << entry.encoded_frame;
+            for (int i = 0; i < values_per_frame; i++) ss << " " << entry.values[i];
+            ss << "\n";
+        }
+        const std::string content = ss.str();
+
+        bool ok = std::fwrite(content.data(), 1, content.size(), file) == content.size();
+        ok = (std::fflush(file) == 0) && ok;
+#ifdef _WIN32
+        ok = (_commit(_fileno(file)) == 0) && ok;
+#else
+        ok = (fsync(fileno(file)) == 0) && ok;
+#endif
+        ok = (std::fclose(file) == 0) && ok;
+        if (!ok) return false;
+
+        std::error_code ec;
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec) return false;
+#ifndef _WIN32
+        //the rename itself only survives a crash once the directory is synced
+        std::string directory = std::filesystem::path(path).parent_path().string();
+        if (directory.empty()) directory = ".";
+        const int directory_fd = open(directory.c_str(), O_RDONLY);
+        if (directory_fd < 0) return false;
+        ok = fsync(directory_fd) == 0;
+        close(directory_fd);
+#endif
+        return ok;
+    }
+};
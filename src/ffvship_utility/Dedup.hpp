@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//--dedup: a frame pair whose decoded source and encoded frames are both identical to the previous pair read
+//by the same reader is not converted nor scored, it gets the result of that pair. Animation, screencasts and
+//frame rate conversions repeat frames for long stretches, and an encoder codes the repeats as skipped blocks
+//that decode to the same pixels.
+
+//64 bit fingerprint of a plane, 8 bytes per multiply. Not cryptographic: two different frames collide with
+//a probability of about 2^-64, far below anything a metric could notice
+inline uint64_t fingerprint_plane(const uint8_t *data, int64_t stride, int64_t row_bytes, int64_t rows, uint64_t hash) {
+    constexpr uint64_t multiplier = 0x9e3779b97f4a7c15ull;
+    for (int64_t y = 0; y < rows; y++) {
+        const uint8_t *row = data + y * stride;
+        int64_t x = 0;
+        for (; x + 8 <= row_bytes; x += 8) {
+            uint64_t word;
+            std::memcpy(&word, row + x, 8);
+            hash = (hash ^ word) * multiplier;
+            hash ^= hash >> 29;
+        }
+        if (x < row_bytes) {
+            uint64_t word = 0;
+            std::memcpy(&word, row + x, row_bytes - x);
+            hash = (hash ^ word) * multiplier;
+            hash ^= hash >> 29;
+        }
+        hash = (hash ^ (uint64_t)y) * multiplier; //rows of a different layout do not line up
+    }
+    return hash;
+}
+
+//pairs waiting for the result of the pair they duplicate. Readers register duplicates, the worker that
+//finishes a pair settles it and gets back the duplicates to settle the same way. A reader retires its
+//original once it has read a different pair, after which no duplicate of it can come: the maps hold at most
+//an original per reader plus those still in the queue.
+template <typename Value>
+class DuplicateFrames {
+    std::mutex mutex;
+    std::unordered_map<int, std::vector<int>> pending; //original -> duplicates
+    std::unordered_map<int, std::optional<Value>> settled; //nullopt when the original could not be scored
+    std::unordered_set<int> retired; //retired before being settled, their result is not kept
+    std::atomic<int64_t> count{0};
+
+  public:
+    //nullopt while original is not settled, duplicate is then settled along with it later
+    std::optional<std::optional<Value>> add(int original, int duplicate) {
+        count.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(mutex);
+        const auto it = settled.find(original);
+        if (it != settled.end()) return it->second;
+        pending[original].push_back(duplicate);
+        return std::nullopt;
+    }
+
+    std::vector<int> settle(int original, const std::optional<Value> &result) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (retired.erase(original) == 0) settled[original] = result;
+        const auto it = pending.find(original);
+        if (it == pending.end()) return {};
+        std::vector<int> duplicates = std::move(it->second);
+        pending.erase(it);
+        return duplicates;
+    }
+
+    //no duplicate of original will be added anymore
+    void retire(int original) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (settled.erase(original) == 0) retired.insert(original);
+    }
+
+    int64_t duplicates() const {
+        return count.load(std::memory_order_relaxed);
+    }
+};
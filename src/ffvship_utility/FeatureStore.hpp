@@ -0,0 +1,172 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "../util/hash.hpp"
+#include "../util/mappedfile.hpp"
+
+//--reference-features FILE: the reference side of ssimu2 (on the native backend the XYB pyramid, blurred mu1
+//and s11, on SYCL the XYB pyramid as the device holds it, see the referenceFeatureSize of both
+//implementations) is kept per source frame in a memory mapped file. The first run against a source range decodes the source and fills the file, the next
+//ones (other encodes of the same source, e.g. the trials of a target quality search) map it and
+//skip the source decode and its half of the computation.
+//
+//layout (little endian, sections aligned to 64 bytes):
+//  header (64 bytes): char magic[8] = "VSCYREF2", uint32 width, uint32 height, uint64 floats_per_frame,
+//                     uint64 source fingerprint (helper::fileFingerprint), uint32 frame_count, uint32 0,
+//                     uint64 parameters (xxh64 of what else changes the features: backend, metric,
+//                     source format and conversion)
+//  int32  source_frames[frame_count] (sorted)
+//  uint8  valid[frame_count]          (set once the slot has been written)
+//  float  features[frame_count][floats_per_frame]
+//
+//A new file is built next to its final path and renamed over it when the run ends, so a reader never
+//maps a file that is still being filled.
+class FeatureStore {
+    static constexpr char magic[8] = {'V', 'S', 'C', 'Y', 'R', 'E', 'F', '2'};
+    static constexpr size_t header_size = 64;
+
+    std::string path;
+    uint64_t fingerprint;
+    uint64_t parameters_hash;
+    uint32_t width, height;
+    uint64_t floats_per_frame;
+
+    helper::MappedFile file;
+    bool writing = false;
+    uint32_t frame_count = 0;
+    const int32_t *frames = nullptr;
+    uint8_t *valid = nullptr;
+    float *features = nullptr;
+
+    static size_t align(size_t size) { return (size + 63) / 64 * 64; }
+
+    static size_t file_size(uint32_t count, uint64_t floats_per_frame) {
+        return header_size + align(4 * (size_t)count) + align(count) + 4 * (size_t)count * floats_per_frame;
+    }
+
+    void set_sections() {
+        uint8_t *base = file.data();
+        frames = (const int32_t *)(base + header_size);
+        valid = base + header_size + align(4 * (size_t)frame_count);
+        features = (float *)(valid + align(frame_count));
+    }
+
+    int64_t slot(int source_frame) const {
+        const int32_t *it = std::lower_bound(frames, frames + frame_count, source_frame);
+        if (it == frames + frame_count || *it != source_frame) return -1;
+        return it - frames;
+    }
+
+    std::string temp_path() const { return path + ".tmp"; }
+
+  public:
+    //parameters: everything besides the source file and the size that changes the features
+    FeatureStore(const std::string &path, const std::string &source_file, const std::string &parameters, int width,
+                 int height, int64_t floats_per_frame)
+        : path(path), fingerprint(helper::fileFingerprint(source_file)), parameters_hash(helper::xxh64(parameters)),
+          width(width), height(height),
+          floats_per_frame(floats_per_frame) {}
+
+    FeatureStore(const FeatureStore &) = delete;
+    FeatureStore &operator=(const FeatureStore &) = delete;
+
+    //true if the existing file belongs to this source and holds every one of source_frames,
+    //the store is then read only
+    bool open(const std::vector<int> &source_frames) {
+        if (!file.open_read(path)) return false;
+        const uint8_t *base = file.data();
+        uint32_t file_width, file_height, count;
+        uint64_t file_floats, file_fingerprint, file_parameters;
+        if (file.size() < header_size) return false;
+        std::memcpy(&file_width, base + 8, 4);
+        std::memcpy(&file_height, base + 12, 4);
+        std::memcpy(&file_floats, base + 16, 8);
+        std::memcpy(&file_fingerprint, base + 24, 8);
+        std::memcpy(&count, base + 32, 4);
+        std::memcpy(&file_parameters, base + 40, 8);
+        if (std::memcmp(base, magic, 8) != 0 || file_width != width || file_height != height ||
+            file_floats != floats_per_frame || file_fingerprint != fingerprint || file_parameters != parameters_hash ||
+            file.size() != file_size(count, floats_per_frame)) {
+            file.close();
+            return false;
+        }
+        frame_count = count;
+        set_sections();
+        for (const int source_frame : source_frames) {
+            const int64_t index = slot(source_frame);
+            if (index < 0 || !valid[index]) {
+                file.close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //starts a new store for source_frames (duplicates allowed), filled with store() and published by finish()
+    bool create(std::vector<int> source_frames) {
+        std::sort(source_frames.begin(), source_frames.end());
+        source_frames.erase(std::unique(source_frames.begin(), source_frames.end()), source_frames.end());
+        frame_count = source_frames.size();
+
+        std::error_code ec;
+        const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+        if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+        if (!file.create(temp_path(), file_size(frame_count, floats_per_frame))) return false;
+        writing = true;
+
+        uint8_t *base = file.data();
+        std::memcpy(base, magic, 8);
+        std::memcpy(base + 8, &width, 4);
+        std::memcpy(base + 12, &height, 4);
+        std::memcpy(base + 16, &floats_per_frame, 8);
+        std::memcpy(base + 24, &fingerprint, 8);
+        std::memcpy(base + 32, &frame_count, 4);
+        std::memcpy(base + 40, &parameters_hash, 8);
+        std::memcpy(base + header_size, source_frames.data(), 4 * (size_t)frame_count);
+        set_sections();
+        return true;
+    }
+
+    bool is_writing() const { return writing; }
+
+    //features of a stored frame, nullptr if it is not there
+    const float *find(int source_frame) const {
+        const int64_t index = slot(source_frame);
+        if (index < 0 || !valid[index]) return nullptr;
+        return features + index * floats_per_frame;
+    }
+
+    //writing mode: where the features of source_frame go, mark_stored once they are there
+    float *slot_for(int source_frame) {
+        const int64_t index = slot(source_frame);
+        return index < 0 ? nullptr : features + index * floats_per_frame;
+    }
+
+    void mark_stored(int source_frame) {
+        const int64_t index = slot(source_frame);
+        if (index >= 0) valid[index] = 1;
+    }
+
+    //writing mode: syncs the new file and moves it to its final path
+    bool finish() {
+        if (!writing) return true;
+        writing = false;
+        const bool synced = file.sync();
+        file.close();
+        std::error_code ec;
+        if (!synced) {
+            std::filesystem::remove(temp_path(), ec);
+            return false;
+        }
+        std::filesystem::rename(temp_path(), path, ec);
+        return !ec;
+    }
+
+    const std::string &file_path() const { return path; }
+};
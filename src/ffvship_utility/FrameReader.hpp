@@ -0,0 +1,30 @@
+#pragma once
+
+#include <limits>
+
+extern "C" {
+#include <ffms.h>
+}
+
+//Source of decoded frames behind VideoManager. Whatever the input, a frame is described by an
+//FFMS_Frame since that is what ffmpegToZimgFormat and the zimg conversion consume.
+class FrameReader {
+  public:
+    //total_frame_count of a stream whose length is only known once it ends
+    static constexpr int unknown_frame_count = std::numeric_limits<int>::max();
+
+    int frame_width = 0;
+    int frame_height = 0;
+    int total_frame_count = 0;
+
+    //after construction it describes the format of the input, its planes may not be valid yet
+    const FFMS_Frame *current_frame = nullptr;
+
+    virtual ~FrameReader() = default;
+
+    //false if the frame cannot be read: past the end of a stream or before its current position
+    virtual bool fetch_frame(int frame_index) = 0;
+
+    //frames can only be read once in increasing order, by a single reader thread
+    virtual bool sequential() const { return false; }
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "FrameReader.hpp"
+
+//--auto-crop: the black bars of a letterboxed (or pillarboxed) source are found on a sample of its frames and
+//only the picture between them is scored. The bars compare equal in both videos, they would pull every score
+//up by the part of the frame they cover. The region is scored in place, the frames are not copied.
+
+//in pixels of the source frame
+struct CropRegion {
+    int left = 0;
+    int top = 0;
+    int width = 0;
+    int height = 0;
+};
+
+//a row (column) is part of a bar when at most 1/outlier_ratio of its luma samples are above black by more than
+//tolerance (at 8 bit), which lets grain and isolated bright pixels through. Each edge keeps the thinnest bar
+//of the sampled frames, frames without any picture (fades) are left out. Bars thinner than min_bar are
+//encoder padding rather than letterbox and are kept, a region smaller than half of the frame in either
+//direction is a dark picture rather than bars and nothing is cropped.
+class LetterboxDetector {
+    static constexpr int sample_count = 16;
+    static constexpr int tolerance = 8;
+    static constexpr int outlier_ratio = 64;
+    static constexpr int min_bar = 4;
+
+    struct Bars {
+        int top, bottom, left, right;
+    };
+
+    template <typename T>
+    static bool detect_bars(const uint8_t *plane, int linesize, int width, int height, int threshold, Bars &bars) {
+        auto bright_row = [&](int y) {
+            const T *row = (const T *)(plane + (int64_t)y * linesize);
+            int bright = 0;
+            for (int x = 0; x < width; x++) bright += row[x] > threshold;
+            return (int64_t)bright * outlier_ratio > width;
+        };
+        int top = 0, bottom = height;
+        while (top < height && !bright_row(top)) top++;
+        if (top == height) return false;
+        while (!bright_row(bottom - 1)) bottom--;
+
+        //columns only over the rows of the picture, the horizontal bars are dark in every column anyway
+        auto bright_column = [&](int x) {
+            int bright = 0;
+            for (int y = top; y < bottom; y++) bright += ((const T *)(plane + (int64_t)y * linesize))[x] > threshold;
+            return (int64_t)bright * outlier_ratio > bottom - top;
+        };
+        int left = 0, right = width;
+        while (left < width && !bright_column(left)) left++;
+        if (left == width) return false;
+        while (!bright_column(right - 1)) right--;
+
+        bars = {top, height - bottom, left, width - right};
+        return true;
+    }
+
+  public:
+    //reader must be able to read [start, end) in increasing order. bits_per_sample is the depth of its luma
+    //plane, limited_range whether black is at 16 (8 bit) rather than 0. The whole frame when no bar is found
+    CropRegion detect(FrameReader &reader, int start, int end, int bits_per_sample, bool limited_range) {
+        const int width = reader.frame_width, height = reader.frame_height;
+        CropRegion whole = {0, 0, width, height};
+        if (end <= start) return whole;
+
+        const int shift = bits_per_sample - 8;
+        const int threshold = ((limited_range ? 16 : 0) + tolerance) << shift;
+        const int count = std::min(end - start, sample_count);
+
+        bool found = false;
+        Bars thinnest = {height, height, width, width};
+        for (int j = 0; j < count; j++) {
+            const int frame = start + (int)(((int64_t)2 * j + 1) * (end - start) / (2 * count));
+            if (!reader.fetch_frame(frame)) break;
+            const FFMS_Frame *data = reader.current_frame;
+            Bars bars;
+            const bool picture = (bits_per_sample > 8)
+                ? detect_bars<uint16_t>(data->Data[0], data->Linesize[0], width, height, threshold, bars)
+                : detect_bars<uint8_t>(data->Data[0], data->Linesize[0], width, height, threshold, bars);
+            if (!picture) continue;
+            found = true;
+            thinnest.top = std::min(thinnest.top, bars.top);
+            thinnest.bottom = std::min(thinnest.bottom, bars.bottom);
+            thinnest.left = std::min(thinnest.left, bars.left);
+            thinnest.right = std::min(thinnest.right, bars.right);
+        }
+        if (!found) return whole;
+
+        for (int *bar : {&thinnest.top, &thinnest.bottom, &thinnest.left, &thinnest.right}) {
+            if (*bar < min_bar) *bar = 0;
+        }
+        CropRegion region = {thinnest.left, thinnest.top, width - thinnest.left - thinnest.right,
+                             height - thinnest.top - thinnest.bottom};
+        if (region.width * 2 < width || region.height * 2 < height) return whole;
+        return region;
+    }
+};
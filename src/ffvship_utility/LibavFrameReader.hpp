@@ -0,0 +1,189 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+extern "C" {
+#include <ffms.h>
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "FrameReader.hpp"
+
+#ifndef ASSERT_WITH_MESSAGE
+#define ASSERT_WITH_MESSAGE(condition, message)\
+if (!(condition)) {\
+    std::fprintf(stderr, "Assertion failed!\nExpression : %s\nFile       : %s\n  Line       : %d\nMessage    : %s\n", #condition, __FILE__, __LINE__, message);\
+    std::abort();\
+}
+#endif
+
+//--decoder libav: decodes the whole video front to back with libavcodec frame threading, with no
+//index and no seeking. Frames that are not requested are decoded and dropped, so it only pays off
+//for dense schedules (every frame between --start and --end), FFMS2 stays better for sparse ones.
+class LibavFrameReader : public FrameReader {
+    AVFormatContext *format_context = nullptr;
+    AVCodecContext *codec_context = nullptr;
+    AVPacket *packet = nullptr;
+    AVFrame *frame = nullptr;
+    int stream_index = -1;
+    int decoded_frame = -1; //index of the frame held in frame
+    int lost_frames = 0; //rejected by the decoder, still to be given out as copies of the previous frame
+    bool draining = false;
+    FFMS_Frame descriptor = {};
+
+    static std::string error_string(int error) {
+        char buffer[AV_ERROR_MAX_STRING_SIZE] = {};
+        av_strerror(error, buffer, sizeof(buffer));
+        return buffer;
+    }
+
+    //containers that do not store the frame count (mkv, webm...) need a demux only pass, much
+    //cheaper than decoding or indexing. A packet holds one frame in every modern container.
+    static int count_packets(const std::string &file_path, int stream_index) {
+        AVFormatContext *counting_context = nullptr;
+        if (avformat_open_input(&counting_context, file_path.c_str(), nullptr, nullptr) != 0) return 0;
+        for (unsigned int i = 0; i < counting_context->nb_streams; i++) {
+            if ((int)i != stream_index) counting_context->streams[i]->discard = AVDISCARD_ALL;
+        }
+        AVPacket *counting_packet = av_packet_alloc();
+        int count = 0;
+        while (av_read_frame(counting_context, counting_packet) >= 0) {
+            if (counting_packet->stream_index == stream_index) count++;
+            av_packet_unref(counting_packet);
+        }
+        av_packet_free(&counting_packet);
+        avformat_close_input(&counting_context);
+        return count;
+    }
+
+    void lose_frame(int error) {
+        std::fprintf(stderr, "libavcodec: frame %d could not be decoded (%s), the previous frame is repeated in its place\n",
+                     decoded_frame + lost_frames + 1, error_string(error).c_str());
+        lost_frames++;
+    }
+
+    //frames are counted in output order, a packet or frame the decoder rejects still takes its index so
+    //that the later frames keep theirs. The copy lands at the next output rather than at the exact place
+    //of the lost frame, which is at most the decoder delay away.
+    bool decode_next() {
+        while (true) {
+            if (lost_frames > 0 && decoded_frame >= 0) {
+                lost_frames--;
+                decoded_frame++; //frame still holds the previous frame
+                return true;
+            }
+            const int received = avcodec_receive_frame(codec_context, frame);
+            if (received == 0) {
+                decoded_frame++;
+                return true;
+            }
+            if (received == AVERROR_EOF) return false;
+            if (received != AVERROR(EAGAIN)) {
+                lose_frame(received);
+                continue;
+            }
+
+            if (av_read_frame(format_context, packet) < 0) {
+                if (draining) return false;
+                avcodec_send_packet(codec_context, nullptr); //flush the frames still in the threads
+                draining = true;
+                continue;
+            }
+            if (packet->stream_index == stream_index) {
+                const int sent = avcodec_send_packet(codec_context, packet);
+                if (sent < 0) lose_frame(sent);
+            }
+            av_packet_unref(packet);
+        }
+    }
+
+    //same fields as the FFMS_Frame that FFMS2 gives for this frame, including its fallbacks on the
+    //stream properties when the frame leaves them unspecified
+    void describe_frame() {
+        for (int p = 0; p < 4; p++) {
+            descriptor.Data[p] = frame->data[p];
+            descriptor.Linesize[p] = frame->linesize[p];
+        }
+        descriptor.EncodedWidth = frame->width;
+        descriptor.EncodedHeight = frame->height;
+        descriptor.EncodedPixelFormat = frame->format;
+        descriptor.ScaledWidth = -1;
+        descriptor.ScaledHeight = -1;
+        descriptor.ConvertedPixelFormat = frame->format;
+#ifdef AV_FRAME_FLAG_INTERLACED
+        descriptor.InterlacedFrame = (frame->flags & AV_FRAME_FLAG_INTERLACED) != 0;
+        descriptor.TopFieldFirst = (frame->flags & AV_FRAME_FLAG_TOP_FIELD_FIRST) != 0;
+#else
+        descriptor.InterlacedFrame = frame->interlaced_frame;
+        descriptor.TopFieldFirst = frame->top_field_first;
+#endif
+        descriptor.ColorSpace = frame->colorspace != AVCOL_SPC_UNSPECIFIED ? frame->colorspace : codec_context->colorspace;
+        descriptor.ColorRange = frame->color_range != AVCOL_RANGE_UNSPECIFIED ? frame->color_range : codec_context->color_range;
+        descriptor.ColorPrimaries = frame->color_primaries != AVCOL_PRI_UNSPECIFIED ? frame->color_primaries : codec_context->color_primaries;
+        descriptor.TransferCharateristics = frame->color_trc != AVCOL_TRC_UNSPECIFIED ? frame->color_trc : codec_context->color_trc;
+        descriptor.ChromaLocation = frame->chroma_location != AVCHROMA_LOC_UNSPECIFIED ? frame->chroma_location : codec_context->chroma_sample_location;
+    }
+
+  public:
+    //decoder_threads 0: libavcodec picks one thread per core
+    explicit LibavFrameReader(const std::string &file_path, int decoder_threads = 0) {
+        int error = avformat_open_input(&format_context, file_path.c_str(), nullptr, nullptr);
+        ASSERT_WITH_MESSAGE(error == 0, ("libavformat: Failed to open [" + file_path + "] - " + error_string(error)).c_str());
+        error = avformat_find_stream_info(format_context, nullptr);
+        ASSERT_WITH_MESSAGE(error >= 0, ("libavformat: No stream information in [" + file_path + "] - " + error_string(error)).c_str());
+
+        const AVCodec *codec = nullptr;
+        stream_index = av_find_best_stream(format_context, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+        ASSERT_WITH_MESSAGE(stream_index >= 0 && codec != nullptr, ("libavformat: No decodable video track found in file [" + file_path + "]").c_str());
+        //the demuxer does not even hand out the packets of the other tracks
+        for (unsigned int i = 0; i < format_context->nb_streams; i++) {
+            if ((int)i != stream_index) format_context->streams[i]->discard = AVDISCARD_ALL;
+        }
+        const AVStream *stream = format_context->streams[stream_index];
+
+        codec_context = avcodec_alloc_context3(codec);
+        ASSERT_WITH_MESSAGE(codec_context != nullptr, "libavcodec: Failed to allocate the decoder context.");
+        avcodec_parameters_to_context(codec_context, stream->codecpar);
+        codec_context->thread_count = decoder_threads;
+        codec_context->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+        error = avcodec_open2(codec_context, codec, nullptr);
+        ASSERT_WITH_MESSAGE(error == 0, ("libavcodec: Failed to open the decoder for [" + file_path + "] - " + error_string(error)).c_str());
+
+        packet = av_packet_alloc();
+        frame = av_frame_alloc();
+        ASSERT_WITH_MESSAGE(packet != nullptr && frame != nullptr, "libavcodec: Failed to allocate packet or frame.");
+
+        total_frame_count = stream->nb_frames > 0 ? (int)stream->nb_frames : count_packets(file_path, stream_index);
+        ASSERT_WITH_MESSAGE(total_frame_count > 0, ("libavformat: Failed to count the frames of [" + file_path + "]").c_str());
+
+        ASSERT_WITH_MESSAGE(decode_next(), ("libavcodec: Failed to decode the first frame of [" + file_path + "]").c_str());
+        frame_width = frame->width;
+        frame_height = frame->height;
+        describe_frame();
+        current_frame = &descriptor;
+    }
+
+    LibavFrameReader(const LibavFrameReader &) = delete;
+    LibavFrameReader &operator=(const LibavFrameReader &) = delete;
+
+    ~LibavFrameReader() {
+        av_frame_free(&frame);
+        av_packet_free(&packet);
+        avcodec_free_context(&codec_context);
+        avformat_close_input(&format_context);
+    }
+
+    bool fetch_frame(int frame_index) override {
+        if (frame_index < decoded_frame) return false;
+        while (decoded_frame < frame_index) {
+            if (!decode_next()) return false;
+        }
+        describe_frame();
+        return true;
+    }
+
+    bool sequential() const override { return true; }
+};
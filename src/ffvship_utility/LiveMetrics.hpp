@@ -0,0 +1,341 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "../util/concurrency.hpp"
+#include "../util/gpuhelper.hpp"
+
+//--metrics-file FILE / --metrics-socket PATH: live counters of the run in the Prometheus text format, for
+//orchestration that polls long jobs instead of parsing the progress bar. They are sampled every second.
+//The file is written next to its final path and renamed over it, so a reader never sees half of it
+//(node_exporter's textfile collector can pick it up). The Unix socket answers every connection with the
+//last sample and closes it: plain text for `nc -U PATH`, an HTTP response for `curl --unix-socket PATH x`.
+
+class LiveMetrics {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    //gauges read from the pipeline at every sample
+    struct Sources {
+        std::function<size_t()> frame_queue_depth;
+        size_t frame_queue_capacity = 0;
+        std::function<size_t()> score_queue_depth;
+        std::function<size_t()> buffers_in_use;
+        size_t buffer_count = 0;
+    };
+
+  private:
+    struct alignas(cache_line_size) Counter {
+        std::atomic<int64_t> value{0};
+    };
+    struct alignas(cache_line_size) Worker {
+        std::atomic<int64_t> frames{0};
+        std::atomic<int64_t> busy{0}; //nanoseconds
+    };
+
+    //counts of the previous sample, for the rates
+    struct Snapshot {
+        clock::time_point time;
+        int64_t scored = 0;
+        std::vector<int64_t> busy;
+    };
+
+    const int64_t total_frames;
+    const Sources sources;
+    const clock::time_point start = clock::now();
+    std::unique_ptr<Counter[]> readers;
+    std::unique_ptr<Worker[]> workers;
+    const int reader_count;
+    const int worker_count;
+    Counter done;
+    Counter missing;
+    std::atomic<int64_t> last_progress; //nanoseconds since start
+    std::atomic<bool> running{true};
+
+    std::mutex sample_mutex;
+    Snapshot previous;
+    std::string text; //last sample
+
+    static double seconds(int64_t nanoseconds) { return nanoseconds / 1e9; }
+
+    int64_t since_start(clock::time_point time) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time - start).count();
+    }
+
+  public:
+    LiveMetrics(int64_t total_frames, int reader_count, int worker_count, Sources sources)
+        : total_frames(total_frames), sources(std::move(sources)), readers(new Counter[std::max(reader_count, 1)]),
+          workers(new Worker[std::max(worker_count, 1)]), reader_count(reader_count), worker_count(worker_count), last_progress(0) {
+        previous.time = start;
+        previous.busy.assign(worker_count, 0);
+    }
+
+    //a reader pushed a decoded frame to the workers
+    void frame_decoded(int reader) { readers[reader].value.fetch_add(1, std::memory_order_relaxed); }
+
+    //a worker scored a frame between begin and end
+    void frame_scored(int worker, clock::time_point begin, clock::time_point end) {
+        workers[worker].frames.fetch_add(1, std::memory_order_relaxed);
+        workers[worker].busy.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count(), std::memory_order_relaxed);
+    }
+
+    //the result of a frame is settled, with a score or without one (unreadable, error, early stop)
+    void frame_done(bool has_score) {
+        done.value.fetch_add(1, std::memory_order_relaxed);
+        if (!has_score) missing.value.fetch_add(1, std::memory_order_relaxed);
+        last_progress.store(since_start(clock::now()), std::memory_order_relaxed);
+    }
+
+    void finish() { running.store(false, std::memory_order_relaxed); }
+
+    //takes a new sample, the rates are those since the previous one
+    void sample() {
+        const clock::time_point now = clock::now();
+        std::lock_guard<std::mutex> lock(sample_mutex);
+        const double interval = std::max(1e-9, seconds(std::chrono::duration_cast<std::chrono::nanoseconds>(now - previous.time).count()));
+        const double elapsed = std::max(1e-9, seconds(since_start(now)));
+
+        Snapshot current;
+        current.time = now;
+        for (int w = 0; w < worker_count; w++) {
+            current.scored += workers[w].frames.load(std::memory_order_relaxed);
+            current.busy.push_back(workers[w].busy.load(std::memory_order_relaxed));
+        }
+
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(3);
+        auto metric = [&ss](const char *name, const char *type, const char *help) {
+            ss << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+        };
+
+        metric("ffvship_running", "gauge", "1 while frames are being scored, 0 once the run is over.");
+        ss << "ffvship_running " << (running.load(std::memory_order_relaxed) ? 1 : 0) << "\n";
+        metric("ffvship_frames", "gauge", "Frames to settle in this run.");
+        ss << "ffvship_frames " << total_frames << "\n";
+        metric("ffvship_frames_done_total", "counter", "Frames whose result is settled, including frames restored from a checkpoint or the score cache.");
+        ss << "ffvship_frames_done_total " << done.value.load(std::memory_order_relaxed) << "\n";
+        metric("ffvship_frames_missing_total", "counter", "Settled frames without a score (unreadable, failed or left out by an early stop).");
+        ss << "ffvship_frames_missing_total " << missing.value.load(std::memory_order_relaxed) << "\n";
+        metric("ffvship_fps", "gauge", "Frames scored per second over the last sample interval.");
+        ss << "ffvship_fps " << (current.scored - previous.scored) / interval << "\n";
+        metric("ffvship_fps_average", "gauge", "Frames scored per second since the start of the run.");
+        ss << "ffvship_fps_average " << current.scored / elapsed << "\n";
+        metric("ffvship_elapsed_seconds", "gauge", "Time since the start of the run.");
+        ss << "ffvship_elapsed_seconds " << elapsed << "\n";
+        metric("ffvship_seconds_since_progress", "gauge", "Time since the last frame was settled (or since the start).");
+        ss << "ffvship_seconds_since_progress " << elapsed - seconds(last_progress.load(std::memory_order_relaxed)) << "\n";
+
+        metric("ffvship_frame_queue_depth", "gauge", "Decoded frames waiting for a worker.");
+        ss << "ffvship_frame_queue_depth " << (sources.frame_queue_depth ? sources.frame_queue_depth() : 0) << "\n";
+        metric("ffvship_frame_queue_capacity", "gauge", "Capacity of the decoded frame queue.");
+        ss << "ffvship_frame_queue_capacity " << sources.frame_queue_capacity << "\n";
+        metric("ffvship_score_queue_depth", "gauge", "Scores waiting to be written.");
+        ss << "ffvship_score_queue_depth " << (sources.score_queue_depth ? sources.score_queue_depth() : 0) << "\n";
+        metric("ffvship_frame_buffers_in_use", "gauge", "Frame buffers held by readers, the queue and workers.");
+        ss << "ffvship_frame_buffers_in_use " << (sources.buffers_in_use ? sources.buffers_in_use() : 0) << "\n";
+        metric("ffvship_frame_buffers", "gauge", "Frame buffers in the pool.");
+        ss << "ffvship_frame_buffers " << sources.buffer_count << "\n";
+        metric("ffvship_device_memory_bytes", "gauge", "Device memory allocated by the metric implementations.");
+        ss << "ffvship_device_memory_bytes " << helper::deviceBytesInUse().load(std::memory_order_relaxed) << "\n";
+
+        metric("ffvship_reader_frames_total", "counter", "Frames decoded and queued by each reader thread.");
+        for (int r = 0; r < reader_count; r++) {
+            ss << "ffvship_reader_frames_total{reader=\"" << r << "\"} " << readers[r].value.load(std::memory_order_relaxed) << "\n";
+        }
+        metric("ffvship_worker_frames_total", "counter", "Frames scored by each worker.");
+        for (int w = 0; w < worker_count; w++) {
+            ss << "ffvship_worker_frames_total{worker=\"" << w << "\"} " << workers[w].frames.load(std::memory_order_relaxed) << "\n";
+        }
+        metric("ffvship_worker_busy_seconds_total", "counter", "Time each worker spent scoring frames.");
+        for (int w = 0; w < worker_count; w++) {
+            ss << "ffvship_worker_busy_seconds_total{worker=\"" << w << "\"} " << seconds(current.busy[w]) << "\n";
+        }
+        metric("ffvship_worker_busy_ratio", "gauge", "Fraction of the last sample interval each worker spent scoring frames.");
+        for (int w = 0; w < worker_count; w++) {
+            ss << "ffvship_worker_busy_ratio{worker=\"" << w << "\"} " << std::min(1.0, seconds(current.busy[w] - previous.busy[w]) / interval) << "\n";
+        }
+
+        text = ss.str();
+        previous = std::move(current);
+    }
+
+    std::string last_sample() {
+        std::lock_guard<std::mutex> lock(sample_mutex);
+        return text;
+    }
+};
+
+//samples a LiveMetrics every second on its own thread and publishes it to a file or a Unix socket
+class MetricsExporter {
+    static constexpr auto period = std::chrono::seconds(1);
+
+    LiveMetrics &metrics;
+    const std::string path;
+    const bool socket_mode;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    bool reported_error = false;
+#ifndef _WIN32
+    int listen_fd = -1;
+#endif
+
+    void write_file() {
+        const std::string temp_path = path + ".tmp";
+        {
+            std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+            out << metrics.last_sample();
+            if (!out) return report_error();
+        }
+        std::error_code ec;
+        std::filesystem::rename(temp_path, path, ec);
+        if (ec) report_error();
+    }
+
+    void report_error() {
+        if (!reported_error) std::cerr << "\nCannot write metrics to [" << path << "]" << std::endl;
+        reported_error = true;
+    }
+
+#ifndef _WIN32
+    //an HTTP client sends its request first, anything else gets the bare text
+    void serve(int client) {
+        std::string response = metrics.last_sample();
+        pollfd request = {client, POLLIN, 0};
+        char buffer[1024];
+        if (poll(&request, 1, 200) > 0) {
+            const ssize_t received = recv(client, buffer, sizeof(buffer), 0);
+            if (received >= 4 && std::memcmp(buffer, "GET ", 4) == 0) {
+                response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                           + std::to_string(response.size()) + "\r\nConnection: close\r\n\r\n" + response;
+            }
+        }
+        for (size_t sent = 0; sent < response.size();) {
+            const ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            sent += n;
+        }
+        close(client);
+    }
+#endif
+
+    void run() {
+        auto next_sample = LiveMetrics::clock::now();
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (stopping) break;
+            }
+            if (LiveMetrics::clock::now() >= next_sample) {
+                metrics.sample();
+                if (!socket_mode) write_file();
+                next_sample += period;
+            }
+#ifndef _WIN32
+            if (socket_mode) {
+                //short waits so that stop does not hold the end of the run
+                pollfd listener = {listen_fd, POLLIN, 0};
+                if (poll(&listener, 1, 100) > 0) {
+                    const int client = accept(listen_fd, nullptr, nullptr);
+                    if (client >= 0) serve(client);
+                }
+                continue;
+            }
+#endif
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait_until(lock, next_sample, [this]() { return stopping; });
+        }
+        //the final counters, with ffvship_running 0
+        metrics.finish();
+        metrics.sample();
+        if (!socket_mode) write_file();
+    }
+
+  public:
+    MetricsExporter(LiveMetrics &metrics, std::string path, bool socket_mode)
+        : metrics(metrics), path(std::move(path)), socket_mode(socket_mode) {}
+
+    MetricsExporter(const MetricsExporter &) = delete;
+    MetricsExporter &operator=(const MetricsExporter &) = delete;
+
+    ~MetricsExporter() { stop(); }
+
+    //false with an error printed if the socket cannot be created
+    bool start() {
+        if (socket_mode) {
+#ifdef _WIN32
+            std::cerr << "--metrics-socket is not supported on Windows, use --metrics-file" << std::endl;
+            return false;
+#else
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(address.sun_path)) {
+                std::cerr << "Metrics socket path [" << path << "] is too long" << std::endl;
+                return false;
+            }
+            std::strcpy(address.sun_path, path.c_str());
+            //only a socket left behind by a killed run is removed, never a file the path was mistyped onto
+            struct stat existing;
+            if (lstat(path.c_str(), &existing) == 0) {
+                if (!S_ISSOCK(existing.st_mode)) {
+                    std::cerr << "Metrics socket path [" << path << "] already exists and is not a socket" << std::endl;
+                    return false;
+                }
+                unlink(path.c_str());
+            }
+            listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&address, sizeof(address)) != 0 || listen(listen_fd, 8) != 0) {
+                std::cerr << "Cannot listen on metrics socket [" << path << "]: " << std::strerror(errno) << std::endl;
+                if (listen_fd >= 0) close(listen_fd);
+                listen_fd = -1;
+                return false;
+            }
+#endif
+        }
+        thread = std::thread(&MetricsExporter::run, this);
+        return true;
+    }
+
+    //publishes the final counters, then the socket goes away (the file stays)
+    void stop() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+#ifndef _WIN32
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            unlink(path.c_str());
+            listen_fd = -1;
+        }
+#endif
+    }
+};
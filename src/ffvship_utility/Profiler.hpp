@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//--profile FILE: every stage of every frame is timed, then FFVship prints the p50/p99 of each stage and
+//writes all the events to FILE in the Chrome trace format (chrome://tracing, ui.perfetto.dev).
+//Events go on tracks: one per reader thread and video for decoding, one per reader thread for its waits,
+//one per worker. Decode and convert events carry the frame number in the video, the others the position
+//of the frame in the schedule.
+
+enum class Stage : int {
+    Decode,    //FrameReader::fetch_frame
+    Convert,   //zimg conversion to planar RGB
+    PoolWait,  //reader waiting for a free frame buffer
+    QueuePush, //reader waiting for room in the frame queue
+    QueuePop,  //worker waiting for a decoded frame
+    Upload,    //host to device copies, device time
+    Compute,   //conversions and kernels
+    Reduce,    //copy back and host side sums
+};
+constexpr int stage_count = 8;
+
+inline const char *stage_name(Stage stage) {
+    static const char *names[stage_count] = {"decode", "convert", "pool_wait", "queue_push", "queue_pop", "upload", "compute", "reduce"};
+    return names[(int)stage];
+}
+
+class Profiler {
+  public:
+    using clock = std::chrono::steady_clock;
+
+  private:
+    struct Event {
+        Stage stage;
+        int track;
+        int frame;
+        int64_t start; //nanoseconds since the creation of the profiler
+        int64_t duration;
+    };
+
+    const std::string path;
+    const clock::time_point origin = clock::now();
+    std::mutex mutex;
+    std::vector<Event> events;
+    std::vector<std::string> tracks;
+
+    int64_t since_origin(clock::time_point time) const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(time - origin).count();
+    }
+
+  public:
+    explicit Profiler(std::string file_path) : path(std::move(file_path)) {}
+
+    const std::string &file_path() const { return path; }
+
+    //id of a new track named name in the trace
+    int track(const std::string &name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tracks.push_back(name);
+        return tracks.size() - 1;
+    }
+
+    void record(int track, Stage stage, int frame, clock::time_point start, clock::time_point end) {
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back({stage, track, frame, since_origin(start), since_origin(end) - since_origin(start)});
+    }
+
+    //device durations have no host timestamps, they are laid end to end from start
+    void record_device(int track, int frame, clock::time_point start, int64_t upload, int64_t compute, int64_t reduce) {
+        std::lock_guard<std::mutex> lock(mutex);
+        int64_t position = since_origin(start);
+        events.push_back({Stage::Upload, track, frame, position, upload});
+        position += upload;
+        events.push_back({Stage::Compute, track, frame, position, compute});
+        position += compute;
+        events.push_back({Stage::Reduce, track, frame, position, reduce});
+    }
+
+    bool write_trace() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::ofstream out(path, std::ios::binary);
+        if (!out) return false;
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        bool first = true;
+        for (size_t t = 0; t < tracks.size(); t++) {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+                << ",\"args\":{\"name\":\"" << tracks[t] << "\"}}";
+            first = false;
+        }
+        for (const Event &event : events) {
+            out << (first ? "" : ",\n") << "{\"name\":\"" << stage_name(event.stage) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.track
+                << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << event.duration / 1000.0
+                << ",\"args\":{\"frame\":" << event.frame << "}}";
+            first = false;
+        }
+        out << "\n]}\n";
+        return (bool)out;
+    }
+
+    void print_summary() {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::vector<int64_t>> durations(stage_count);
+        for (const Event &event : events) durations[(int)event.stage].push_back(event.duration);
+
+        std::cout << "---Profile (ms per frame)---" << std::endl;
+        std::cout << std::setw(12) << std::left << "stage" << std::right << std::setw(8) << "count" << std::setw(12) << "total"
+                  << std::setw(10) << "p50" << std::setw(10) << "p99" << std::setw(10) << "max" << std::endl;
+        for (int s = 0; s < stage_count; s++) {
+            std::vector<int64_t> &values = durations[s];
+            if (values.empty()) continue;
+            std::sort(values.begin(), values.end());
+            int64_t total = 0;
+            for (const int64_t value : values) total += value;
+            auto milliseconds = [](int64_t nanoseconds) { return nanoseconds / 1e6; };
+            std::cout << std::setw(12) << std::left << stage_name((Stage)s) << std::right << std::setw(8) << values.size()
+                      << std::fixed << std::setprecision(1) << std::setw(12) << milliseconds(total) << std::setprecision(3)
+                      << std::setw(10) << milliseconds(values[values.size() / 2])
+                      << std::setw(10) << milliseconds(values[std::min(values.size() - 1, values.size() * 99 / 100)])
+                      << std::setw(10) << milliseconds(values.back()) << std::endl;
+        }
+        std::cout << std::endl;
+    }
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "FrameReader.hpp"
+
+//--scene-sampling N: instead of scoring every frame (or every --every), the source is cut into scenes
+//and N frames spread over each scene are scored. Each scored frame then stands for
+//scene length / frames scored in its scene when the global statistics are computed.
+
+//source frames [start, end)
+struct Scene {
+    int start;
+    int end;
+};
+
+//--scene-detection luma: mean absolute difference of the 8x8 block averages of the luma plane
+//between consecutive source frames, relative to the maximum value. A cut is placed where it
+//goes above cut_threshold and the current scene has at least min_scene_length frames.
+class LumaSceneDetector {
+    static constexpr double cut_threshold = 0.1;
+    static constexpr int min_scene_length = 4;
+    static constexpr int block = 8;
+
+    std::vector<float> previous, current;
+
+    template <typename T>
+    void block_means(const uint8_t *plane, int linesize, int width, int height, double max_value) {
+        const int blocks_w = width / block, blocks_h = height / block;
+        current.assign((size_t)blocks_w * blocks_h, 0.f);
+        for (int by = 0; by < blocks_h; by++) {
+            for (int y = by * block; y < (by + 1) * block; y++) {
+                const T *row = (const T *)(plane + (int64_t)y * linesize);
+                for (int bx = 0; bx < blocks_w; bx++) {
+                    uint32_t sum = 0;
+                    for (int x = bx * block; x < (bx + 1) * block; x++) sum += row[x];
+                    current[by * blocks_w + bx] += sum;
+                }
+            }
+        }
+        for (float &value : current) value /= block * block * max_value;
+    }
+
+  public:
+    //reader must be able to read [start, end) in order, bits_per_sample is the depth of its luma plane
+    std::vector<Scene> detect(FrameReader &reader, int start, int end, int bits_per_sample) {
+        std::vector<Scene> scenes;
+        if (end <= start) return scenes;
+        const double max_value = (1 << bits_per_sample) - 1;
+        const int width = reader.frame_width, height = reader.frame_height;
+
+        int scene_start = start;
+        for (int frame = start; frame < end; frame++) {
+            if (!reader.fetch_frame(frame)) {
+                end = frame; //a shorter video than announced, the last scene ends here
+                break;
+            }
+            const FFMS_Frame *data = reader.current_frame;
+            if (bits_per_sample > 8) {
+                block_means<uint16_t>(data->Data[0], data->Linesize[0], width, height, max_value);
+            } else {
+                block_means<uint8_t>(data->Data[0], data->Linesize[0], width, height, max_value);
+            }
+
+            if (frame != start && frame - scene_start >= min_scene_length) {
+                double difference = 0;
+                for (size_t i = 0; i < current.size(); i++) difference += std::abs(current[i] - previous[i]);
+                difference /= std::max<size_t>(current.size(), 1);
+                if (difference >= cut_threshold) {
+                    scenes.push_back({scene_start, frame});
+                    scene_start = frame;
+                }
+            }
+            std::swap(previous, current);
+        }
+        if (end > scene_start) scenes.push_back({scene_start, end});
+        return scenes;
+    }
+};
+
+//--scene-detection keyframes: the keyframes of the source (an index lookup, no decoding), meaningful
+//when the source encoder placed them on scene changes
+inline std::vector<Scene> scenes_from_keyframes(const std::set<int> &keyframes, int start, int end) {
+    std::vector<Scene> scenes;
+    int scene_start = start;
+    for (auto it = keyframes.upper_bound(start); it != keyframes.end() && *it < end; ++it) {
+        scenes.push_back({scene_start, *it});
+        scene_start = *it;
+    }
+    if (end > scene_start) scenes.push_back({scene_start, end});
+    return scenes;
+}
+
+//frames_per_scene frames at the middle of equal parts of each scene, every frame of shorter scenes
+inline std::vector<int> sample_scenes(const std::vector<Scene> &scenes, int frames_per_scene) {
+    std::vector<int> frames;
+    for (const Scene &scene : scenes) {
+        const int length = scene.end - scene.start;
+        const int count = std::min(length, frames_per_scene);
+        for (int j = 0; j < count; j++) {
+            frames.push_back(scene.start + (int)(((int64_t)2 * j + 1) * length / (2 * count)));
+        }
+    }
+    return frames;
+}
+
+//per scene results then the global ones with every scored frame weighted by the part of the
+//video it stands for. frames_source are the sampled frames in increasing order and scores their values.
+inline void print_scene_statistics(const std::vector<Scene> &scenes, const std::vector<int> &frames_source,
+                                   const std::vector<float> &scores, const std::string &label) {
+    std::vector<std::pair<float, double>> weighted; //score, weight
+    std::cout << "---Scenes (" << label << ")---" << std::endl;
+    size_t next = 0;
+    for (size_t s = 0; s < scenes.size(); s++) {
+        const Scene &scene = scenes[s];
+        const size_t first = next;
+        while (next < frames_source.size() && frames_source[next] < scene.end) next++;
+        const size_t count = next - first;
+        if (count == 0) continue;
+
+        double sum = 0;
+        float minimum = scores[first];
+        for (size_t i = first; i < next; i++) {
+            sum += scores[i];
+            minimum = std::min(minimum, scores[i]);
+            weighted.push_back({scores[i], (double)(scene.end - scene.start) / count});
+        }
+        std::cout << "Scene " << s << " [" << scene.start << ", " << scene.end << ") " << count << " frames : average "
+                  << std::fixed << std::setprecision(6) << sum / count << " minimum " << minimum << std::endl;
+    }
+    if (weighted.empty()) return;
+
+    std::sort(weighted.begin(), weighted.end());
+    const double total_weight = std::accumulate(weighted.begin(), weighted.end(), 0.0,
+                                                [](double acc, const std::pair<float, double> &el) { return acc + el.second; });
+    double average = 0;
+    for (const auto &[score, weight] : weighted) average += score * weight;
+    average /= total_weight;
+
+    //smallest score whose cumulated weight reaches the given part of the video
+    auto percentile = [&](double part) {
+        double cumulated = 0;
+        for (const auto &[score, weight] : weighted) {
+            cumulated += weight;
+            if (cumulated >= part * total_weight) return score;
+        }
+        return weighted.back().first;
+    };
+
+    std::cout << "Weighted average : " << std::setw(12) << average << std::endl;
+    std::cout << "Weighted median  : " << std::setw(12) << percentile(0.5) << std::endl;
+    std::cout << "Weighted 5th percentile : " << std::setw(12) << percentile(0.05) << std::endl;
+    std::cout << std::endl;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <sys/file.h>
+#endif
+
+#include "../util/hash.hpp"
+
+//--score-cache DIR: scores persist across runs, keyed by the content of both videos, the frame pair,
+//the metric and its parameters. Every (source, encoded, parameters) combination has its own file
+//  DIR/<source fingerprint>-<encoded fingerprint>-<parameters hash>.scores
+//made of an 8 byte magic followed by fixed 24 byte records appended as frames finish:
+//  int32 source_frame, int32 encoded_frame, float values[3], uint32 check (low bits of the xxh64 of the rest)
+//A record cut by a crash fails its check and is skipped, and the next writer pads the file back to
+//a record boundary. A new file appears with its magic already written (hard link of a complete temporary
+//file) and the padding is decided under an flock (POSIX), so processes opening the same file at the same
+//time agree on the record boundaries. Appending itself needs no locking.
+class ScoreCache {
+  public:
+    using entry_values = std::array<float, 3>;
+
+  private:
+    static constexpr char magic[8] = {'V', 'S', 'C', 'Y', 'C', 'A', 'C', '1'};
+    static constexpr size_t record_size = 24;
+
+    std::string path;
+    FILE *append_file = nullptr;
+    std::chrono::steady_clock::time_point last_flush = std::chrono::steady_clock::now();
+
+    static uint32_t check(const char *record) { return (uint32_t)helper::xxh64(record, record_size - 4); }
+
+    static uint64_t key(int source_frame, int encoded_frame) {
+        return ((uint64_t)(uint32_t)source_frame << 32) | (uint32_t)encoded_frame;
+    }
+
+  public:
+    //parameters: everything besides the inputs that changes the scores (metric, intensity target...)
+    ScoreCache(const std::string &directory, const std::string &source_file, const std::string &encoded_file,
+               const std::string &parameters) {
+        char name[64];
+        std::snprintf(name, sizeof(name), "%016" PRIx64 "-%016" PRIx64 "-%016" PRIx64 ".scores",
+                      helper::fileFingerprint(source_file), helper::fileFingerprint(encoded_file),
+                      helper::xxh64(parameters));
+        path = (std::filesystem::path(directory) / name).string();
+    }
+
+    ScoreCache(const ScoreCache &) = delete;
+    ScoreCache &operator=(const ScoreCache &) = delete;
+
+    ~ScoreCache() {
+        if (append_file != nullptr) std::fclose(append_file);
+    }
+
+    class Lookup {
+        std::unordered_map<uint64_t, entry_values> entries;
+        friend class ScoreCache;
+
+      public:
+        const entry_values *find(int source_frame, int encoded_frame) const {
+            const auto it = entries.find(key(source_frame, encoded_frame));
+            return it == entries.end() ? nullptr : &it->second;
+        }
+        size_t size() const { return entries.size(); }
+    };
+
+    Lookup load() const {
+        Lookup res;
+        FILE *file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr) return res;
+
+        char header[8];
+        if (std::fread(header, 1, 8, file) == 8 && std::memcmp(header, magic, 8) == 0) {
+            char record[record_size];
+            while (std::fread(record, 1, record_size, file) == record_size) {
+                uint32_t record_check;
+                std::memcpy(&record_check, record + 20, 4);
+                if (record_check != check(record)) continue;
+                int32_t source_frame, encoded_frame;
+                entry_values values;
+                std::memcpy(&source_frame, record, 4);
+                std::memcpy(&encoded_frame, record + 4, 4);
+                std::memcpy(values.data(), record + 8, 12);
+                res.entries[key(source_frame, encoded_frame)] = values;
+            }
+        }
+        std::fclose(file);
+        return res;
+    }
+
+    //false if the cache cannot be written, the run then goes on without storing its scores
+    bool open_for_append() {
+        std::error_code ec;
+        std::filesystem::create_directories(std::filesystem::path(path).parent_path(), ec);
+        if (!std::filesystem::exists(path, ec)) create_with_magic();
+        append_file = std::fopen(path.c_str(), "ab");
+        if (append_file == nullptr) return false;
+        //several processes may append to the same file: every write() must hold whole records
+        std::setvbuf(append_file, nullptr, _IOFBF, record_size * 256);
+#ifndef _WIN32
+        flock(fileno(append_file), LOCK_EX);
+#endif
+        std::fseek(append_file, 0, SEEK_END);
+        const long size = std::ftell(append_file);
+        const bool usable = size >= 8; //a shorter header is left alone
+        if (usable && (size - 8) % record_size != 0) {
+            //a previous run died in the middle of a record
+            const char padding[record_size] = {};
+            std::fwrite(padding, 1, record_size - (size - 8) % record_size, append_file);
+        }
+        std::fflush(append_file);
+#ifndef _WIN32
+        flock(fileno(append_file), LOCK_UN);
+#endif
+        if (!usable) {
+            std::fclose(append_file);
+            append_file = nullptr;
+        }
+        return usable;
+    }
+
+    void append(int source_frame, int encoded_frame, const entry_values &values) {
+        if (append_file == nullptr) return;
+        char record[record_size];
+        const int32_t src = source_frame, enc = encoded_frame;
+        std::memcpy(record, &src, 4);
+        std::memcpy(record + 4, &enc, 4);
+        std::memcpy(record + 8, values.data(), 12);
+        const uint32_t record_check = check(record);
+        std::memcpy(record + 20, &record_check, 4);
+        std::fwrite(record, 1, record_size, append_file);
+
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_flush >= std::chrono::seconds(1)) {
+            last_flush = now;
+            std::fflush(append_file);
+        }
+    }
+
+    void flush() {
+        if (append_file != nullptr) std::fflush(append_file);
+    }
+
+    const std::string &file_path() const { return path; }
+
+  private:
+    //the file only gets its name once the magic is in it, the link fails if another process created it first
+    void create_with_magic() const {
+        const std::string temp_path = path + ".tmp" + std::to_string(helper::xxh64(
+            std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()) + std::to_string((uintptr_t)this)));
+        FILE *file = std::fopen(temp_path.c_str(), "wb");
+        if (file == nullptr) return;
+        const bool written = std::fwrite(magic, 1, 8, file) == 8;
+        std::fclose(file);
+        std::error_code ec;
+        if (written) std::filesystem::create_hard_link(temp_path, path, ec);
+        std::filesystem::remove(temp_path, ec);
+    }
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+//Writers receive every frame exactly once, in frame order, while the run is in progress.
+//values is nullptr for a frame whose computation failed.
+class ScoreWriter {
+  public:
+    virtual ~ScoreWriter() = default;
+    virtual void write(int index, int source_frame, int encoded_frame, const float *values) = 0;
+    //called after each batch of frames, writers decide themselves whether it is worth a syscall
+    virtual void flush() = 0;
+    //end of the run, after the last frame
+    virtual void finish() = 0;
+    virtual bool good() const = 0;
+};
+
+//files are flushed at most once per second so a crash loses at most about one second of results
+class FileScoreWriter : public ScoreWriter {
+  protected:
+    std::ofstream file;
+    const int values_per_frame;
+    std::chrono::steady_clock::time_point last_flush = std::chrono::steady_clock::now();
+
+  public:
+    FileScoreWriter(const std::string &path, int values_per_frame, std::ios_base::openmode mode = std::ios_base::out)
+        : file(path, mode), values_per_frame(values_per_frame) {}
+
+    void flush() override {
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_flush < std::chrono::seconds(1)) return;
+        last_flush = now;
+        file.flush();
+    }
+
+    bool good() const override { return file.good(); }
+};
+
+//[[score], [score], ...] or [[2norm, 3norm, infnorm], ...], null for failed frames.
+//A file cut by a crash only lacks the closing bracket.
+class JsonScoreWriter : public FileScoreWriter {
+    bool first = true;
+
+  public:
+    JsonScoreWriter(const std::string &path, int values_per_frame) : FileScoreWriter(path, values_per_frame) {
+        file << "[";
+    }
+
+    void write(int index, int source_frame, int encoded_frame, const float *values) override {
+        if (!first) file << ", ";
+        first = false;
+        if (values == nullptr) {
+            file << "null";
+            return;
+        }
+        file << "[";
+        for (int i = 0; i < values_per_frame; i++) {
+            if (i != 0) file << ", ";
+            file << values[i];
+        }
+        file << "]";
+    }
+
+    void finish() override {
+        file << "]";
+        file.flush();
+    }
+};
+
+//one line per frame: index,source_frame,encoded_frame,values... with an empty value for failed frames
+class CsvScoreWriter : public FileScoreWriter {
+  public:
+    CsvScoreWriter(const std::string &path, const std::vector<std::string> &value_names)
+        : FileScoreWriter(path, value_names.size()) {
+        file << "index,source_frame,encoded_frame";
+        for (const auto &name : value_names) file << "," << name;
+        file << "\n";
+    }
+
+    void write(int index, int source_frame, int encoded_frame, const float *values) override {
+        file << index << "," << source_frame << "," << encoded_frame;
+        for (int i = 0; i < values_per_frame; i++) {
+            file << ",";
+            if (values != nullptr) file << values[i];
+        }
+        file << "\n";
+    }
+
+    void finish() override { file.flush(); }
+};
+
+//Fixed size little endian records meant to be mmapped:
+//  header (32 bytes): char magic[8] = "VSCYSCR1", uint32 values_per_record, uint32 record_size,
+//                     uint64 record_count (0 while the run is in progress), uint64 reserved
+//  record:            int32 source_frame, int32 encoded_frame, float values[values_per_record] (NaN if failed)
+//While running, the number of complete records is (file_size - 32) / record_size.
+class BinaryScoreWriter : public FileScoreWriter {
+    static constexpr char magic[8] = {'V', 'S', 'C', 'Y', 'S', 'C', 'R', '1'};
+    uint64_t record_count = 0;
+    std::vector<char> record;
+
+    template <typename T> static void put(char *dst, T value) { std::memcpy(dst, &value, sizeof(T)); }
+
+    void write_header() {
+        char header[32] = {};
+        std::memcpy(header, magic, 8);
+        put<uint32_t>(header + 8, values_per_frame);
+        put<uint32_t>(header + 12, record.size());
+        put<uint64_t>(header + 16, record_count);
+        file.write(header, sizeof(header));
+    }
+
+  public:
+    BinaryScoreWriter(const std::string &path, int values_per_frame)
+        : FileScoreWriter(path, values_per_frame, std::ios_base::out | std::ios_base::binary),
+          record(8 + 4 * values_per_frame) {
+        write_header();
+    }
+
+    void write(int index, int source_frame, int encoded_frame, const float *values) override {
+        put<int32_t>(record.data(), source_frame);
+        put<int32_t>(record.data() + 4, encoded_frame);
+        for (int i = 0; i < values_per_frame; i++) {
+            put<float>(record.data() + 8 + 4 * i, values ? values[i] : std::numeric_limits<float>::quiet_NaN());
+        }
+        file.write(record.data(), record.size());
+        record_count++;
+    }
+
+    void finish() override {
+        file.seekp(0);
+        write_header();
+        file.flush();
+    }
+};
+
+//--live-score-output: "index score..." lines on stdout, flushed once per batch instead of once per line
+class LiveScoreWriter : public ScoreWriter {
+    const int values_per_frame;
+
+  public:
+    explicit LiveScoreWriter(int values_per_frame) : values_per_frame(values_per_frame) {}
+
+    void write(int index, int source_frame, int encoded_frame, const float *values) override {
+        if (values == nullptr) return; //the error has been printed already
+        std::cout << index;
+        for (int i = 0; i < values_per_frame; i++) std::cout << " " << values[i];
+        std::cout << "\n";
+    }
+
+    void flush() override { std::cout << std::flush; }
+    void finish() override { std::cout << std::flush; }
+    bool good() const override { return std::cout.good(); }
+};
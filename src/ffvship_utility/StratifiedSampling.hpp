@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+//--target-precision: frames are scored in a stratified random order and the run stops as soon as the
+//mean and the 5th percentile are known to within +-target_precision (95% confidence).
+
+//Permutation of frames such that every prefix is a stratified sample of the whole video: the frames are
+//cut into about sqrt(n) contiguous strata, and round r takes the r-th frame of a random shuffle of every
+//stratum, visiting the strata in a new random order each round. The seed is fixed so that two runs on
+//the same frames score the same ones.
+inline std::vector<int> stratified_order(const std::vector<int> &frames, uint64_t seed = 0x5eed) {
+    const int64_t n = frames.size();
+    if (n == 0) return {};
+    const int64_t strata_count = std::min<int64_t>(n, std::max<int64_t>(16, (int64_t)std::sqrt((double)n)));
+    std::mt19937_64 rng(seed);
+
+    std::vector<std::vector<int>> strata(strata_count);
+    for (int64_t s = 0; s < strata_count; s++) {
+        strata[s].assign(frames.begin() + n * s / strata_count, frames.begin() + n * (s + 1) / strata_count);
+        std::shuffle(strata[s].begin(), strata[s].end(), rng);
+    }
+
+    std::vector<int> order;
+    order.reserve(n);
+    std::vector<int64_t> visit(strata_count);
+    for (int64_t s = 0; s < strata_count; s++) visit[s] = s;
+    for (size_t round = 0; (int64_t)order.size() < n; round++) {
+        std::shuffle(visit.begin(), visit.end(), rng);
+        for (const int64_t s : visit) {
+            if (round < strata[s].size()) order.push_back(strata[s][round]);
+        }
+    }
+    return order;
+}
+
+//running estimates of the scores of a population of frames from the ones scored so far
+class PrecisionTracker {
+  public:
+    struct Interval {
+        double estimate;
+        double low;
+        double high;
+        double half_width() const { return std::max(estimate - low, high - estimate); }
+    };
+
+  private:
+    static constexpr double z = 1.959964; //95% two sided
+    //the normal approximations of the intervals need a few samples in the tail of the 5th percentile
+    static constexpr int64_t min_samples = 100;
+
+    const double target;
+    const int64_t population;
+    mutable std::vector<float> values; //sorted lazily
+    double sum = 0;
+    double squared_sum = 0;
+    mutable bool sorted = true;
+    int64_t next_check = 0;
+
+    const std::vector<float> &sorted_values() const {
+        if (!sorted) {
+            std::sort(values.begin(), values.end());
+            sorted = true;
+        }
+        return values;
+    }
+
+  public:
+    PrecisionTracker(double target_precision, int64_t population) : target(target_precision), population(population) {}
+
+    void add(float value) {
+        values.push_back(value);
+        sum += value;
+        squared_sum += (double)value * value;
+        sorted = false;
+    }
+
+    int64_t count() const { return values.size(); }
+
+    //normal interval with the finite population correction, the sample being drawn without replacement
+    Interval mean() const {
+        const int64_t n = values.size();
+        const double average = n ? sum / n : 0;
+        if (n < 2) return {average, -INFINITY, INFINITY};
+        const double variance = std::max(0.0, (squared_sum - n * average * average) / (n - 1));
+        const double correction = population > 1 ? std::sqrt(std::max(0.0, (double)(population - n) / (population - 1))) : 0;
+        const double half = z * std::sqrt(variance / n) * correction;
+        return {average, average - half, average + half};
+    }
+
+    //distribution free interval: the ranks of the bounds come from the binomial count of samples below the percentile
+    Interval percentile(double p) const {
+        const std::vector<float> &v = sorted_values();
+        const int64_t n = v.size();
+        if (n == 0) return {0, -INFINITY, INFINITY};
+        const int64_t index = std::min<int64_t>(n - 1, (int64_t)(p * n));
+        if (n == population) return {v[index], v[index], v[index]};
+        const double spread = z * std::sqrt(n * p * (1 - p));
+        const int64_t low = (int64_t)std::floor(p * n - spread);
+        const int64_t high = (int64_t)std::ceil(p * n + spread);
+        return {v[index], low < 0 ? -INFINITY : v[low], high >= n ? INFINITY : v[high]};
+    }
+
+    //checked on a growing interval of new samples so that the sorts stay negligible
+    bool reached() {
+        const int64_t n = values.size();
+        if (n >= population) return true;
+        if (n < std::min(min_samples, population) || n < next_check) return false;
+        next_check = n + std::max<int64_t>(1, n / 16);
+        return mean().half_width() <= target && percentile(0.05).half_width() <= target;
+    }
+
+    void print_report(const std::string &label) const {
+        auto print_interval = [](const std::string &name, const Interval &interval) {
+            std::cout << std::setw(16) << std::right << name << " : " << std::setw(12) << interval.estimate << "  ["
+                      << interval.low << ", " << interval.high << "]" << std::endl;
+        };
+        std::cout << "---" << label << " estimates (95% confidence)---" << std::endl;
+        std::cout << "Frames evaluated : " << values.size() << " of " << population << " ("
+                  << std::setprecision(2) << 100.0 * values.size() / std::max<int64_t>(population, 1) << "%)"
+                  << std::setprecision(6) << std::endl;
+        print_interval("Average", mean());
+        print_interval("Median", percentile(0.5));
+        print_interval("5th percentile", percentile(0.05));
+        std::cout << std::endl;
+    }
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include "../util/threadpool.hpp"
+
+//--cpu-budget N: the cores FFVship may use, split between the decoders (threads of every FFMS2/libav decoder)
+//and the shared thread pool (zimg conversion slices and, on the native backend, the metric). The decoder threads
+//count against the budget. Without --cpu-budget nothing changes: each decoder asks for one thread per core and
+//the pool has one thread per core.
+//The thread count of a decoder is fixed when it is opened: the pool first gets its share of the work (half the
+//cores when the metric runs on the host, a third otherwise) and the decoders split the rest, at least a thread
+//each. The pool then activates the cores the decoders leave: once a second the decoders are charged their
+//threads for the share of the second they spent decoding, and the active pool threads drop to what is left
+//at once or grow halfway to it. A decoder waiting on a full queue thus lends its cores to the conversion.
+//The pool never goes past one core less than the budget per open decoder. The SYCL worker threads (-g) mostly
+//wait on their queue and count for nothing. The threads a SYCL CPU device runs its kernels on belong to its
+//runtime and are not limited.
+//--pin-threads (Linux) keeps the process on the first N cores it may run on, and each pool thread on one of them.
+class ThreadBudget {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    //cores 0: no budget, every hardware thread. decoders: decoders open at the same time. cpu_compute: the
+    //metric runs in the pool
+    ThreadBudget(int cores, int decoders, bool cpu_compute) {
+        const int hardware = std::max(1u, std::thread::hardware_concurrency());
+        total = (cores > 0) ? cores : hardware;
+        pool_size = total;
+        pool_initial = total;
+        if (cores <= 0 || decoders == 0) return;
+
+        //the metric is the larger half of the work when it runs on the host, the conversion a smaller part
+        const int pool_share = std::max(1, cpu_compute ? total/2 : total/3);
+        per_decoder = std::max(1, (total - pool_share) / decoders);
+        pool_size = std::max(1, total - decoders);
+        pool_initial = std::clamp(total - decoders * per_decoder, 1, pool_size);
+        rebalancing = true;
+    }
+
+    ThreadBudget(const ThreadBudget &) = delete;
+    ThreadBudget &operator=(const ThreadBudget &) = delete;
+
+    ~ThreadBudget() { stop(); }
+
+    int cores() const { return total; }
+    //threads each decoder is opened with, 0 for one per core
+    int decoder_threads() const { return per_decoder; }
+    //threads the shared pool is created with, of which pool_threads() are active at first
+    int pool_capacity() const { return pool_size; }
+    int pool_threads() const { return pool_initial; }
+
+    //before the first use of helper::ThreadPool::shared()
+    void configure_pool() const {
+        helper::ThreadPool::setSharedSize(pool_size);
+    }
+
+    //restricts the calling thread, and the threads it creates from now on, to the first cores of the budget.
+    //false with an error printed when the platform or the system refuses
+    bool pin_process() {
+#ifdef __linux__
+        cpu_set_t allowed;
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return pin_error();
+        cpu_set_t budget_set;
+        CPU_ZERO(&budget_set);
+        for (int cpu = 0; cpu < CPU_SETSIZE && (int)cpus.size() < total; cpu++) {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            CPU_SET(cpu, &budget_set);
+            cpus.push_back(cpu);
+        }
+        if (sched_setaffinity(0, sizeof(budget_set), &budget_set) != 0) return pin_error();
+        return true;
+#else
+        return pin_error();
+#endif
+    }
+
+    //one core per pool thread, the pool threads past the budget wrap around
+    bool pin_pool(helper::ThreadPool &pool) {
+#ifdef __linux__
+        if (!cpus.empty() && pool.pinWorkers(cpus)) return true;
+#endif
+        return pin_error();
+    }
+
+    void add_decode(clock::duration duration) { decode_ns.fetch_add(to_ns(duration), std::memory_order_relaxed); }
+
+    void start(helper::ThreadPool &threadpool) {
+        pool = &threadpool;
+        pool->setActiveThreads(pool_initial);
+        if (!rebalancing) return;
+        thread = std::thread(&ThreadBudget::run, this);
+    }
+
+    void stop() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+
+  private:
+    static constexpr auto period = std::chrono::seconds(1);
+
+    int total = 1;
+    int per_decoder = 0;
+    int pool_size = 1;
+    int pool_initial = 1;
+    bool rebalancing = false;
+    std::vector<int> cpus;
+
+    std::atomic<int64_t> decode_ns{0};
+
+    helper::ThreadPool *pool = nullptr;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    static int64_t to_ns(clock::duration duration) {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    }
+
+    bool pin_error() {
+        std::cerr << "--pin-threads: cannot set the thread affinity, threads are not pinned" << std::endl;
+        return false;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        clock::time_point last = clock::now();
+        while (!wake.wait_for(lock, period, [this]() { return stopping; })) {
+            const clock::time_point now = clock::now();
+            //decoders decoding at the same time on average, each running all of its threads
+            const double decoding = decode_ns.exchange(0, std::memory_order_relaxed) / (double)std::max<int64_t>(1, to_ns(now - last));
+            last = now;
+            const int target = std::clamp(total - (int)std::ceil(decoding * per_decoder), 1, pool_size);
+            const int current = pool->activeThreads();
+            if (target < current) {
+                pool->setActiveThreads(target);
+            } else if (target > current) {
+                pool->setActiveThreads(current + std::max(1, (target - current) / 2));
+            }
+        }
+    }
+};
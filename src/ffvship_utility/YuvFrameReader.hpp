@@ -0,0 +1,399 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+extern "C" {
+#include <ffms.h>
+#include <libavutil/pixfmt.h>
+}
+
+#include "FrameReader.hpp"
+#include "../util/mappedfile.hpp"
+
+#ifndef ASSERT_WITH_MESSAGE
+#define ASSERT_WITH_MESSAGE(condition, message)\
+if (!(condition)) {\
+    std::fprintf(stderr, "Assertion failed!\nExpression : %s\nFile       : %s\n  Line       : %d\nMessage    : %s\n", #condition, __FILE__, __LINE__, message);\
+    std::abort();\
+}
+#endif
+
+//Uncompressed planar YUV inputs: Y4M and headerless raw files are memory mapped and zimg reads aligned
+//planes straight from the mapping, Y4M or raw coming from stdin ("-") or a FIFO is read sequentially.
+
+struct YuvPixelFormat {
+    const char *name; //ffmpeg pix_fmt name, used by --raw-format
+    const char *y4m_tag; //Y4M C parameter without its chroma siting suffix
+    AVPixelFormat format;
+    int subsample_w;
+    int subsample_h;
+    int bytes_per_sample;
+};
+
+inline const YuvPixelFormat *find_yuv_pixel_format(const std::string &name, bool y4m_tag = false) {
+    static const YuvPixelFormat formats[] = {
+        {"yuv420p", "420", AV_PIX_FMT_YUV420P, 1, 1, 1},
+        {"yuv422p", "422", AV_PIX_FMT_YUV422P, 1, 0, 1},
+        {"yuv444p", "444", AV_PIX_FMT_YUV444P, 0, 0, 1},
+        {"yuv411p", "411", AV_PIX_FMT_YUV411P, 2, 0, 1},
+        {"yuv420p9le", "420p9", AV_PIX_FMT_YUV420P9LE, 1, 1, 2},
+        {"yuv420p10le", "420p10", AV_PIX_FMT_YUV420P10LE, 1, 1, 2},
+        {"yuv420p12le", "420p12", AV_PIX_FMT_YUV420P12LE, 1, 1, 2},
+        {"yuv420p14le", "420p14", AV_PIX_FMT_YUV420P14LE, 1, 1, 2},
+        {"yuv420p16le", "420p16", AV_PIX_FMT_YUV420P16LE, 1, 1, 2},
+        {"yuv422p9le", "422p9", AV_PIX_FMT_YUV422P9LE, 1, 0, 2},
+        {"yuv422p10le", "422p10", AV_PIX_FMT_YUV422P10LE, 1, 0, 2},
+        {"yuv422p12le", "422p12", AV_PIX_FMT_YUV422P12LE, 1, 0, 2},
+        {"yuv422p14le", "422p14", AV_PIX_FMT_YUV422P14LE, 1, 0, 2},
+        {"yuv422p16le", "422p16", AV_PIX_FMT_YUV422P16LE, 1, 0, 2},
+        {"yuv444p9le", "444p9", AV_PIX_FMT_YUV444P9LE, 0, 0, 2},
+        {"yuv444p10le", "444p10", AV_PIX_FMT_YUV444P10LE, 0, 0, 2},
+        {"yuv444p12le", "444p12", AV_PIX_FMT_YUV444P12LE, 0, 0, 2},
+        {"yuv444p14le", "444p14", AV_PIX_FMT_YUV444P14LE, 0, 0, 2},
+        {"yuv444p16le", "444p16", AV_PIX_FMT_YUV444P16LE, 0, 0, 2},
+    };
+    for (const YuvPixelFormat &format : formats) {
+        if (name == (y4m_tag ? format.y4m_tag : format.name)) return &format;
+    }
+    return nullptr;
+}
+
+//--raw-width, --raw-height and --raw-format, shared by every raw input
+struct RawVideoFormat {
+    int width = 0;
+    int height = 0;
+    std::string pixel_format = "yuv420p";
+};
+
+//format of a frame and where its planes are inside the frame data. zimg wants planes and strides aligned
+//to 64 bytes: a frame whose planes are not (Y4M frame headers, widths such as 720 or 1366) is copied to an
+//aligned staging frame with padded strides, the others are read in place.
+class YuvFrameLayout {
+  public:
+    static constexpr size_t alignment = 64;
+
+    const YuvPixelFormat *format = nullptr;
+    int width = 0;
+    int height = 0;
+    size_t plane_offset[3] = {};
+    size_t frame_size = 0;
+    FFMS_Frame frame = {};
+
+    static uint8_t *align_up(uint8_t *pointer) {
+        return pointer + (alignment - (uintptr_t)pointer % alignment) % alignment;
+    }
+
+  private:
+    size_t packed_linesize[3] = {};
+    size_t padded_linesize[3] = {};
+    int plane_rows[3] = {};
+    size_t staging_offset[3] = {};
+    size_t staging_size = 0;
+    std::vector<uint8_t> staging; //allocated by the first frame that needs it
+
+  public:
+
+    void init(const YuvPixelFormat *pixel_format, int frame_width, int frame_height, int chroma_location,
+              int color_range) {
+        format = pixel_format;
+        width = frame_width;
+        height = frame_height;
+        const int chroma_width = (width + (1 << format->subsample_w) - 1) >> format->subsample_w;
+        const int chroma_height = (height + (1 << format->subsample_h) - 1) >> format->subsample_h;
+        const size_t luma_size = (size_t)width * height * format->bytes_per_sample;
+        const size_t chroma_size = (size_t)chroma_width * chroma_height * format->bytes_per_sample;
+        plane_offset[0] = 0;
+        plane_offset[1] = luma_size;
+        plane_offset[2] = luma_size + chroma_size;
+        frame_size = luma_size + 2 * chroma_size;
+
+        staging_size = 0;
+        for (int p = 0; p < 3; p++) {
+            packed_linesize[p] = (size_t)(p == 0 ? width : chroma_width) * format->bytes_per_sample;
+            padded_linesize[p] = (packed_linesize[p] + alignment - 1) / alignment * alignment;
+            plane_rows[p] = (p == 0) ? height : chroma_height;
+            staging_offset[p] = staging_size;
+            staging_size += padded_linesize[p] * plane_rows[p];
+        }
+        staging.clear();
+
+        frame = {};
+        frame.Linesize[0] = width * format->bytes_per_sample;
+        frame.Linesize[1] = chroma_width * format->bytes_per_sample;
+        frame.Linesize[2] = chroma_width * format->bytes_per_sample;
+        frame.EncodedWidth = width;
+        frame.EncodedHeight = height;
+        frame.EncodedPixelFormat = format->format;
+        frame.ScaledWidth = -1;
+        frame.ScaledHeight = -1;
+        frame.ConvertedPixelFormat = format->format;
+        frame.KeyFrame = 1;
+        frame.PictType = 'I';
+        //like FFMS2 on a Y4M file, the interlacing tag does not change the conversion
+        frame.InterlacedFrame = 0;
+        frame.ColorSpace = AVCOL_SPC_UNSPECIFIED;
+        frame.ColorRange = color_range;
+        frame.ColorPrimaries = AVCOL_PRI_UNSPECIFIED;
+        frame.TransferCharateristics = AVCOL_TRC_UNSPECIFIED;
+        frame.ChromaLocation = chroma_location;
+    }
+
+    //data stays valid as long as the frame is used when its planes are aligned
+    void set_data(const uint8_t *data) {
+        bool aligned = true;
+        for (int p = 0; p < 3; p++) {
+            aligned = aligned && (uintptr_t)(data + plane_offset[p]) % alignment == 0 && packed_linesize[p] % alignment == 0;
+        }
+        if (aligned) {
+            for (int p = 0; p < 3; p++) {
+                frame.Data[p] = data + plane_offset[p];
+                frame.Linesize[p] = packed_linesize[p];
+            }
+            return;
+        }
+        if (staging.empty()) staging.resize(staging_size + alignment);
+        uint8_t *base = align_up(staging.data());
+        for (int p = 0; p < 3; p++) {
+            uint8_t *dst = base + staging_offset[p];
+            const uint8_t *src = data + plane_offset[p];
+            for (int y = 0; y < plane_rows[p]; y++) {
+                std::memcpy(dst + y * padded_linesize[p], src + y * packed_linesize[p], packed_linesize[p]);
+            }
+            frame.Data[p] = dst;
+            frame.Linesize[p] = padded_linesize[p];
+        }
+    }
+};
+
+//"YUV4MPEG2 W1920 H1080 F24:1 Ip A1:1 C420jpeg XCOLORRANGE=LIMITED" without its trailing newline.
+//Tags are interpreted the way libavformat does so that scores match the FFMS2 path: a bare C420 has its
+//chroma at the center, without C tag the format is 420 of unspecified siting unless the older XYSCSS
+//extension gives it (then still of unspecified siting).
+inline void parse_y4m_header(const std::string &header, const std::string &file_path, YuvFrameLayout &layout) {
+    std::stringstream ss(header);
+    std::string token;
+    ss >> token;
+    ASSERT_WITH_MESSAGE(token == "YUV4MPEG2", ("Y4M: missing YUV4MPEG2 signature in [" + file_path + "]").c_str());
+
+    int width = 0, height = 0;
+    std::string colorspace; //empty without C tag
+    std::string yscss; //XYSCSS= value lowercased, empty without it
+    int color_range = AVCOL_RANGE_UNSPECIFIED;
+    while (ss >> token) {
+        switch (token[0]) {
+        case 'W':
+            width = std::atoi(token.c_str() + 1);
+            break;
+        case 'H':
+            height = std::atoi(token.c_str() + 1);
+            break;
+        case 'C':
+            colorspace = token.substr(1);
+            break;
+        case 'X':
+            if (token == "XCOLORRANGE=FULL") color_range = AVCOL_RANGE_JPEG;
+            if (token == "XCOLORRANGE=LIMITED") color_range = AVCOL_RANGE_MPEG;
+            if (token.compare(0, 7, "XYSCSS=") == 0) {
+                yscss = token.substr(7);
+                for (char &c : yscss) c = std::tolower(c);
+            }
+            break;
+        default: //frame rate, interlacing, aspect ratio
+            break;
+        }
+    }
+    ASSERT_WITH_MESSAGE(width > 0 && height > 0, ("Y4M: invalid frame size in [" + file_path + "]").c_str());
+
+    int chroma_location = AVCHROMA_LOC_UNSPECIFIED;
+    std::string tag = colorspace;
+    if (colorspace.empty()) {
+        tag = yscss.empty() ? "420" : yscss;
+        if (tag == "420jpeg" || tag == "420mpeg2" || tag == "420paldv") tag = "420";
+    } else if (colorspace == "420") {
+        chroma_location = AVCHROMA_LOC_CENTER;
+    } else if (colorspace == "420jpeg") {
+        tag = "420";
+        chroma_location = AVCHROMA_LOC_CENTER;
+    } else if (colorspace == "420mpeg2") {
+        tag = "420";
+        chroma_location = AVCHROMA_LOC_LEFT;
+    } else if (colorspace == "420paldv") {
+        tag = "420";
+        chroma_location = AVCHROMA_LOC_TOPLEFT;
+    }
+    const YuvPixelFormat *format = find_yuv_pixel_format(tag, true);
+    ASSERT_WITH_MESSAGE(format != nullptr,
+                        ("Y4M: unsupported colorspace " + (colorspace.empty() ? "XYSCSS=" + yscss : "C" + colorspace) + " in [" + file_path + "]").c_str());
+    layout.init(format, width, height, chroma_location, color_range);
+}
+
+inline const YuvPixelFormat *raw_pixel_format(const RawVideoFormat &raw, const std::string &file_path) {
+    ASSERT_WITH_MESSAGE(raw.width > 0 && raw.height > 0,
+                        ("Raw input [" + file_path + "] needs --raw-width and --raw-height").c_str());
+    const YuvPixelFormat *format = find_yuv_pixel_format(raw.pixel_format);
+    ASSERT_WITH_MESSAGE(format != nullptr, ("Unsupported --raw-format " + raw.pixel_format).c_str());
+    return format;
+}
+
+//Y4M or raw file, memory mapped: any frame can be read by any number of readers, zimg converts
+//from the mapping without an intermediate copy when the planes are aligned
+class YuvFileReader : public FrameReader {
+    helper::MappedFile file;
+    YuvFrameLayout layout;
+    std::vector<size_t> frame_offsets; //start of the data of each frame
+
+  public:
+    YuvFileReader(const std::string &file_path, bool y4m, const RawVideoFormat &raw) {
+        ASSERT_WITH_MESSAGE(file.open_read(file_path), ("Failed to map [" + file_path + "]").c_str());
+        const uint8_t *data = file.data();
+        const size_t size = file.size();
+
+        if (y4m) {
+            const uint8_t *header_end = (const uint8_t *)std::memchr(data, '\n', size);
+            ASSERT_WITH_MESSAGE(header_end != nullptr, ("Y4M: truncated header in [" + file_path + "]").c_str());
+            parse_y4m_header(std::string((const char *)data, header_end - data), file_path, layout);
+
+            //every frame has its own "FRAME[ params]\n" header, usually 6 bytes but not always
+            size_t offset = header_end - data + 1;
+            while (offset + 5 <= size && std::memcmp(data + offset, "FRAME", 5) == 0) {
+                const uint8_t *frame_header_end = (const uint8_t *)std::memchr(data + offset, '\n', size - offset);
+                if (frame_header_end == nullptr) break;
+                const size_t frame_start = frame_header_end - data + 1;
+                if (frame_start + layout.frame_size > size) break; //truncated last frame
+                frame_offsets.push_back(frame_start);
+                offset = frame_start + layout.frame_size;
+            }
+        } else {
+            layout.init(raw_pixel_format(raw, file_path), raw.width, raw.height, AVCHROMA_LOC_UNSPECIFIED,
+                        AVCOL_RANGE_UNSPECIFIED);
+            for (size_t offset = 0; offset + layout.frame_size <= size; offset += layout.frame_size) {
+                frame_offsets.push_back(offset);
+            }
+        }
+        ASSERT_WITH_MESSAGE(!frame_offsets.empty(), ("No complete frame found in [" + file_path + "]").c_str());
+
+        frame_width = layout.width;
+        frame_height = layout.height;
+        total_frame_count = frame_offsets.size();
+        layout.set_data(data + frame_offsets[0]);
+        current_frame = &layout.frame;
+    }
+
+    bool fetch_frame(int frame_index) override {
+        if (frame_index < 0 || frame_index >= total_frame_count) return false;
+        layout.set_data(file.data() + frame_offsets[frame_index]);
+        return true;
+    }
+};
+
+//Y4M or raw read from stdin or a FIFO while it is being written, e.g. by an encoder.
+//The length is unknown until the end and frames can only go forward.
+class YuvStreamReader : public FrameReader {
+    FILE *stream = nullptr;
+    bool owns_stream = false;
+    bool y4m = false;
+    YuvFrameLayout layout;
+    std::vector<uint8_t> buffer;
+    uint8_t *frame_data = nullptr; //aligned inside buffer, so that aligned strides need no copy
+    int buffered_frame = -1;
+    std::string pending; //bytes read while looking for the signature that belong to the first frame
+
+    bool read_exact(uint8_t *dst, size_t size) {
+        const size_t from_pending = std::min(size, pending.size());
+        std::memcpy(dst, pending.data(), from_pending);
+        pending.erase(0, from_pending);
+        return std::fread(dst + from_pending, 1, size - from_pending, stream) == size - from_pending;
+    }
+
+    bool read_line(std::string &line) {
+        line.clear();
+        while (true) {
+            int c;
+            if (!pending.empty()) {
+                c = (unsigned char)pending[0];
+                pending.erase(0, 1);
+            } else {
+                c = std::fgetc(stream);
+            }
+            if (c == EOF) return false;
+            if (c == '\n') return true;
+            line.push_back((char)c);
+        }
+    }
+
+    bool read_next_frame() {
+        if (y4m) {
+            std::string frame_header;
+            if (!read_line(frame_header) || frame_header.compare(0, 5, "FRAME") != 0) return false;
+        }
+        if (!read_exact(frame_data, layout.frame_size)) return false;
+        buffered_frame++;
+        return true;
+    }
+
+  public:
+    YuvStreamReader(const std::string &file_path, const RawVideoFormat &raw) {
+        if (file_path == "-") {
+#ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+#endif
+            stream = stdin;
+        } else {
+            stream = std::fopen(file_path.c_str(), "rb");
+            owns_stream = true;
+        }
+        ASSERT_WITH_MESSAGE(stream != nullptr, ("Failed to open [" + file_path + "]").c_str());
+        std::setvbuf(stream, nullptr, _IOFBF, 1 << 20);
+
+        char signature[9];
+        const size_t got = std::fread(signature, 1, sizeof(signature), stream);
+        y4m = got == sizeof(signature) && std::memcmp(signature, "YUV4MPEG2", sizeof(signature)) == 0;
+        if (y4m) {
+            std::string header;
+            ASSERT_WITH_MESSAGE(read_line(header), ("Y4M: truncated header in [" + file_path + "]").c_str());
+            parse_y4m_header("YUV4MPEG2" + header, file_path, layout);
+        } else {
+            pending.assign(signature, got);
+            layout.init(raw_pixel_format(raw, file_path), raw.width, raw.height, AVCHROMA_LOC_UNSPECIFIED,
+                        AVCOL_RANGE_UNSPECIFIED);
+        }
+
+        buffer.resize(layout.frame_size + YuvFrameLayout::alignment);
+        frame_data = YuvFrameLayout::align_up(buffer.data());
+        frame_width = layout.width;
+        frame_height = layout.height;
+        total_frame_count = unknown_frame_count;
+        layout.set_data(frame_data);
+        current_frame = &layout.frame;
+    }
+
+    ~YuvStreamReader() {
+        if (owns_stream) std::fclose(stream);
+    }
+
+    //frames between the current one and frame_index are read and dropped
+    bool fetch_frame(int frame_index) override {
+        if (frame_index < buffered_frame) return false;
+        if (buffered_frame == frame_index) return true;
+        while (buffered_frame < frame_index) {
+            if (!read_next_frame()) return false;
+        }
+        layout.set_data(frame_data);
+        return true;
+    }
+
+    bool sequential() const override { return true; }
+};
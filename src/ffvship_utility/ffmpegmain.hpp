@@ -8,11 +8,27 @@ extern "C" {
 
 // #include "util/CLI_Parser.hpp"
 #include "ffmpegToZimgFormat.hpp"
+#include "FrameReader.hpp"
+#include "YuvFrameReader.hpp"
+#include "LibavFrameReader.hpp"
+#include "Profiler.hpp"
+#include "ThreadBudget.hpp"
+#include "Dedup.hpp"
 #include "../util/preprocessor.hpp"
+#include "../util/threadpool.hpp"
 
+#include <cmath>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <mutex>
 #include <optional>
+#include <sstream>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
 
 #ifndef ASSERT_WITH_MESSAGE
 #define ASSERT_WITH_MESSAGE(condition, message)\
@@ -24,6 +40,15 @@ if (!(condition)) {\
 
 enum class MetricType { SSIMULACRA2, Butteraugli, Unknown };
 
+//SYCL: ssimu2 on a SYCL device (gpu_id), CPU: native ssimu2cpu implementation on the host cores
+enum class BackendType { SYCL, CPU, Unknown };
+
+#ifdef VSHIP_NO_SYCL
+constexpr BackendType default_backend = BackendType::CPU;
+#else
+constexpr BackendType default_backend = BackendType::SYCL;
+#endif
+
 static void print_zimg_error(void) {
     char err_msg[1024];
     int err_code = zimg_get_last_error(err_msg, sizeof(err_msg));
@@ -35,40 +60,139 @@ class GpuWorker {
   private:
     int image_width;
     int image_height;
+    //layout of the frames given, image_width x image_height is the region scored in them (--auto-crop)
+    int frame_width;
+    int frame_height;
+    int region_left = 0;
+    int region_top = 0;
 
     MetricType selected_metric;
+    BackendType selected_backend;
 
-    ssimu2::SSIMU2ComputingImplementation ssimu2worker;
+    //only the one of the selected backend is constructed
+#ifndef VSHIP_NO_SYCL
+    std::optional<ssimu2::SSIMU2ComputingImplementation> ssimu2worker;
+#endif
+    std::optional<ssimu2cpu::SSIMU2ComputingImplementation> ssimu2cpuworker;
     //butter::ButterComputingImplementation butterworker;
 
+    double threshold = -INFINITY; //--threshold, -INFINITY when every score is computed in full
+    bool profiling = false;
+
   public:
-    GpuWorker(MetricType metric, int width, int height, float intensity_multiplier, int gpu_id)
-        : image_width(width), image_height(height), selected_metric(metric),
-        ssimu2worker(width, height, gpu_id) {
+    //profiling: every computation fills stage_times (SYCL event profiling on the device queue)
+    GpuWorker(MetricType metric, int width, int height, float intensity_multiplier, int gpu_id, BackendType backend = default_backend, bool profiling = false)
+        : image_width(width), image_height(height), frame_width(width), frame_height(height), selected_metric(metric), selected_backend(backend), profiling(profiling) {
+        if (selected_backend == BackendType::CPU) {
+            ssimu2cpuworker.emplace(width, height);
+        } else {
+#ifndef VSHIP_NO_SYCL
+            ssimu2worker.emplace(width, height, gpu_id, profiling);
+#endif
+        }
         //allocate_gpu_memory(intensity_multiplier);
     }
     ~GpuWorker(){
         deallocate_gpu_memory();
     }
 
-    std::tuple<float, float, float>
-    compute_metric_score(uint8_t *source_frame, uint8_t *encoded_frame) {
-        const int stride_bytes =
-            image_width * static_cast<int>(sizeof(uint16_t));
-        const int channel_offset_bytes =
-            image_width * image_height * static_cast<int>(sizeof(uint16_t));
+    //frames scored by this worker whose score is only an upper bound below the threshold
+    int64_t early_decisions = 0;
+
+    //stages of the last computation when profiling
+    helper::StageTimes stage_times;
+
+    //--threshold: scores below value may be returned as an upper bound, see ssimu2::ThresholdResult
+    void set_threshold(double value) { threshold = value; }
 
-        const uint8_t *source_channels[3] = {
-            source_frame, source_frame + channel_offset_bytes,
-            source_frame + 2 * channel_offset_bytes};
+    //--auto-crop: frames are width x height and the region scored starts at (left, top)
+    void set_frame_region(int width, int height, int left, int top) {
+        ASSERT_WITH_MESSAGE(left >= 0 && top >= 0 && left + image_width <= width && top + image_height <= height,
+                            "GpuWorker: region outside of the frame.");
+        frame_width = width;
+        frame_height = height;
+        region_left = left;
+        region_top = top;
+    }
 
-        const uint8_t *encoded_channels[3] = {
-            encoded_frame, encoded_frame + channel_offset_bytes,
-            encoded_frame + 2 * channel_offset_bytes};
+    //floats of the reference features stored by --reference-features for a width x height region, their
+    //layout depends on the backend
+    static int64_t reference_feature_size(BackendType backend, int width, int height) {
+#ifndef VSHIP_NO_SYCL
+        if (backend == BackendType::SYCL) return ssimu2::SSIMU2ComputingImplementation::referenceFeatureSize(width, height);
+#endif
+        return ssimu2cpu::SSIMU2ComputingImplementation::referenceFeatureSize(width, height);
+    }
+
+    //compares encoded_frame to the stored features of its source frame instead of the decoded source
+    std::tuple<float, float, float>
+    compute_metric_score_from_reference(const float *reference_features, uint8_t *encoded_frame) {
+        ASSERT_WITH_MESSAGE(selected_metric == MetricType::SSIMULACRA2,
+                            "Reference features are only supported by ssimulacra2.");
+        const int stride_bytes = frame_stride_bytes();
+        const uint8_t *encoded_channels[3];
+        region_channels(encoded_frame, encoded_channels);
+
+        connect_stage_times();
+        double score = 0.0;
+        if (ssimu2cpuworker) {
+            if (threshold != -INFINITY) {
+                score = count_decision(ssimu2cpuworker->runWithReferenceThreshold<UINT16>(
+                    reference_features, encoded_channels, stride_bytes, threshold));
+            } else {
+                score = ssimu2cpuworker->runWithReference<UINT16>(
+                    reference_features, encoded_channels, stride_bytes);
+            }
+        }
+#ifndef VSHIP_NO_SYCL
+        if (ssimu2worker) {
+            if (threshold != -INFINITY) {
+                score = count_decision(ssimu2worker->runWithReferenceThreshold<UINT16>(
+                    reference_features, encoded_channels, stride_bytes, threshold));
+            } else {
+                score = ssimu2worker->runWithReference<UINT16>(
+                    reference_features, encoded_channels, stride_bytes);
+            }
+        }
+#endif
+        const float s = static_cast<float>(score);
+        return {s, s, s};
+    }
+
+    //reference_features_out (reference_feature_size floats) also receives the features of source_frame
+    std::tuple<float, float, float>
+    compute_metric_score(uint8_t *source_frame, uint8_t *encoded_frame, float *reference_features_out = nullptr) {
+        const int stride_bytes = frame_stride_bytes();
+        const uint8_t *source_channels[3];
+        const uint8_t *encoded_channels[3];
+        region_channels(source_frame, source_channels);
+        region_channels(encoded_frame, encoded_channels);
 
         if (selected_metric == MetricType::SSIMULACRA2) {
-            const double score = ssimu2worker.run<UINT16>(
-                source_channels, encoded_channels, stride_bytes);
+            connect_stage_times();
+            double score = 0.0;
+            //features being stored need the full resolution scale, these frames are always scored in full
+            const bool use_threshold = threshold != -INFINITY && reference_features_out == nullptr;
+            if (ssimu2cpuworker) {
+                if (use_threshold) {
+                    score = count_decision(ssimu2cpuworker->runThreshold<UINT16>(
+                        source_channels, encoded_channels, stride_bytes, threshold));
+                } else {
+                    score = ssimu2cpuworker->run<UINT16>(
+                        source_channels, encoded_channels, stride_bytes, reference_features_out);
+                }
+            }
+#ifndef VSHIP_NO_SYCL
+            if (ssimu2worker) {
+                if (use_threshold) {
+                    score = count_decision(ssimu2worker->runThreshold<UINT16>(
+                        source_channels, encoded_channels, stride_bytes, threshold));
+                } else {
+                    score = ssimu2worker->run<UINT16>(
+                        source_channels, encoded_channels, stride_bytes, reference_features_out);
+                }
+            }
+#endif
             float s = static_cast<float>(score);
             return {s, s, s};
         }
@@ -82,6 +206,7 @@ class GpuWorker {
         return {0.0f, 0.0f, 0.0f};
     }
 
+#ifndef VSHIP_NO_SYCL
     static uint8_t *allocate_external_rgb_buffer(int width, int height, sycl::queue& q) {
         const size_t buffer_size_bytes = static_cast<size_t>(width) * height * sizeof(uint16_t) * 3;
         uint8_t *buffer_ptr = sycl::malloc_host<uint8_t>(buffer_size_bytes, q);
@@ -98,11 +223,54 @@ class GpuWorker {
             sycl::free(buffer_ptr, q);
         }
     }
+#endif
+
+    //plain host memory for the CPU backend
+    static uint8_t *allocate_external_rgb_buffer(int width, int height) {
+        const size_t buffer_size_bytes = static_cast<size_t>(width) * height * sizeof(uint16_t) * 3;
+        uint8_t *buffer_ptr = static_cast<uint8_t *>(std::malloc(buffer_size_bytes));
+
+        ASSERT_WITH_MESSAGE(
+            buffer_ptr,
+            "Host buffer allocation failed in allocate_external_rgb_buffer");
+
+        return buffer_ptr;
+    }
 
   private:
+    int frame_stride_bytes() const {
+        return frame_width * static_cast<int>(sizeof(uint16_t));
+    }
+
+    //the planes of a frame buffer, starting at the region scored
+    void region_channels(const uint8_t *frame, const uint8_t *channels[3]) const {
+        const int64_t channel_offset_bytes =
+            static_cast<int64_t>(frame_width) * frame_height * sizeof(uint16_t);
+        const int64_t region_offset_bytes =
+            static_cast<int64_t>(region_top) * frame_stride_bytes() + region_left * static_cast<int64_t>(sizeof(uint16_t));
+        for (int c = 0; c < 3; c++) channels[c] = frame + c * channel_offset_bytes + region_offset_bytes;
+    }
+
+    //done before every computation rather than once, GpuWorker can be moved after construction
+    void connect_stage_times() {
+        if (!profiling) return;
+        if (ssimu2cpuworker) ssimu2cpuworker->setStageTimes(&stage_times);
+#ifndef VSHIP_NO_SYCL
+        if (ssimu2worker) ssimu2worker->setStageTimes(&stage_times);
+#endif
+    }
+
+    double count_decision(const ssimu2::ThresholdResult &answer) {
+        if (!answer.exact) early_decisions++;
+        return answer.score;
+    }
+
     void deallocate_gpu_memory() {
         if (selected_metric == MetricType::SSIMULACRA2) {
-            ssimu2worker.destroy();
+            if (ssimu2cpuworker) ssimu2cpuworker->destroy();
+#ifndef VSHIP_NO_SYCL
+            if (ssimu2worker) ssimu2worker->destroy();
+#endif
         /*} else if (selected_metric == MetricType::Butteraugli) {
             butterworker.destroy();*/
         }
@@ -128,7 +296,9 @@ class FFMSIndexResult {
     explicit FFMSIndexResult(const std::string& input_file_path, std::string input_index_file_path, const bool cache_index, const bool debug_out = false) {
         file_path = input_file_path;
         index_file_path = input_index_file_path;
-        FFMS_Init(0, 0);
+        //source and encoded are indexed from two threads
+        static std::once_flag ffms_initialized;
+        std::call_once(ffms_initialized, [](){ FFMS_Init(0, 0); });
 
         error_info.Buffer = error_message_buffer;
         error_info.BufferSize = error_message_buffer_size;
@@ -159,6 +329,17 @@ class FFMSIndexResult {
                             input_file_path + "] - " + error_message_buffer)
                                 .c_str());
 
+            //only the video track that is compared, the other tracks (audio above all) would only make indexing slower
+            FFMS_TrackTypeIndexSettings(indexer, FFMS_TYPE_VIDEO, 0, 0);
+            FFMS_TrackTypeIndexSettings(indexer, FFMS_TYPE_AUDIO, 0, 0);
+            const int num_tracks = FFMS_GetNumTracksI(indexer);
+            for (int i = 0; i < num_tracks; i++){
+                if (FFMS_GetTrackTypeI(indexer, i) == FFMS_TYPE_VIDEO){
+                    FFMS_TrackIndexSettings(indexer, i, 1, 0);
+                    break;
+                }
+            }
+
             index = FFMS_DoIndexing2(indexer, FFMS_IEH_ABORT, &error_info);
             ASSERT_WITH_MESSAGE(index != nullptr,
                             ("FFMS2: Failed to index file [" + input_file_path +
@@ -218,27 +399,25 @@ class FFMSIndexResult {
     }
 };
 
-class FFMSFrameReader {
+class FFMSFrameReader : public FrameReader {
   private:
     int num_decoder_threads = std::thread::hardware_concurrency();
     int seek_mode = FFMS_SEEK_NORMAL;
 
   public:
     const FFMS_VideoProperties *video_properties = nullptr;
-    const FFMS_Frame *current_frame = nullptr;
 
     AVPixelFormat video_pixel_format = AV_PIX_FMT_NONE;
-    int frame_width = 0;
-    int frame_height = 0;
-    int total_frame_count = 0;
 
     FFMS_VideoSource *video_source = nullptr;
 
     FFMS_ErrorInfo error_info;
     char error_message_buffer[1024] = {};
 
+    //decoder_threads 0: one thread per core
     explicit FFMSFrameReader(const std::string &file_path, FFMS_Index *index,
-                             int video_track_index) {
+                             int video_track_index, int decoder_threads = 0) {
+        if (decoder_threads > 0) num_decoder_threads = decoder_threads;
         initialize_error_info();
         create_video_source(file_path, index, video_track_index);
         load_video_properties();
@@ -253,13 +432,14 @@ class FFMSFrameReader {
         }
     }
 
-    void fetch_frame(int frame_index) {
+    bool fetch_frame(int frame_index) override {
         current_frame = FFMS_GetFrame(video_source, frame_index, &error_info);
         ASSERT_WITH_MESSAGE(current_frame != nullptr,
                             ("FFMS2: Failed to fetch frame [" +
                              std::to_string(frame_index) + "] - " +
                              error_message_buffer)
                                 .c_str());
+        return true;
     }
 
   private:
@@ -320,6 +500,11 @@ class FFMSFrameReader {
     }
 };
 
+//Conversion of decoded frames to planar 16 bit RGB. Without resizing, the frame is cut into horizontal slices
+//converted in parallel on the shared thread pool, so that the conversion of a reader uses every core whatever
+//-t is. Each slice has its own graph, temporary buffer and output ring, and converts slice_margin rows more
+//on each side than it writes: the chroma upsampling of its edge rows then sees the same neighbours as in a
+//whole frame conversion, and the result is identical.
 class ZimgProcessor {
   public:
     zimg_filter_graph *graph = nullptr;
@@ -330,11 +515,20 @@ class ZimgProcessor {
     void *tmp_buffer = nullptr;
     size_t tmp_size = 0;
 
+    //luma rows, a multiple of every chroma subsampling so that slices keep the chroma phase of the frame
+    static constexpr int slice_margin = 16;
+    //below this a slice spends more on its margins than it gains
+    static constexpr int min_slice_rows = 128;
+
     ZimgProcessor(const FFMS_Frame *ref_frame, int target_width,
-                  int target_height) {
+                  int target_height, helper::ThreadPool &threadpool = helper::ThreadPool::shared())
+        : pool(&threadpool) {
         initialize_formats(ref_frame, target_width, target_height);
-        build_graph();
-        allocate_tmp_buffer();
+        build_slices();
+        if (slices.empty()) {
+            build_graph();
+            allocate_tmp_buffer();
+        }
     }
 
     ~ZimgProcessor() {
@@ -342,10 +536,35 @@ class ZimgProcessor {
             zimg_filter_graph_free(graph);
         if (tmp_buffer)
             free(tmp_buffer);
+        for (Slice &slice : slices) {
+            zimg_filter_graph_free(slice.graph);
+            free(slice.tmp);
+            free(slice.ring);
+        }
+    }
+
+    //every parameter of the conversion (source format, colour properties, output size and format), part
+    //of the identity of what is stored from its output
+    std::string describe() const {
+        std::stringstream ss;
+        for (const zimg_image_format *format : {&src_format, &dst_format}) {
+            ss << format->width << "x" << format->height << " " << format->pixel_type << " " << format->subsample_w
+               << format->subsample_h << " " << format->color_family << " " << format->matrix_coefficients << " "
+               << format->transfer_characteristics << " " << format->color_primaries << " " << format->depth << " "
+               << format->pixel_range << " " << format->field_parity << " " << format->chroma_location << ";";
+        }
+        return ss.str();
     }
 
     void process(const FFMS_Frame *src, uint8_t *dst, int stride,
                  int plane_size) {
+        if (!slices.empty()) {
+            pool->parallel_for(slices.size(), [&](int64_t i) {
+                process_slice(slices[i], src, dst, stride, plane_size);
+            });
+            return;
+        }
+
         for (int p = 0; p < 3; ++p) {
             dst_buffer.plane[p].data = dst + p * plane_size;
             dst_buffer.plane[p].stride = stride;
@@ -363,6 +582,123 @@ class ZimgProcessor {
     }
 
   private:
+    struct Slice {
+        zimg_filter_graph *graph = nullptr;
+        int top = 0; //first source row converted
+        int rows = 0; //rows converted
+        int first = 0; //rows written to the frame: [first, last) relative to top
+        int last = 0;
+        void *tmp = nullptr;
+        uint8_t *ring = nullptr; //3 planes of ring_rows rows, the graph writes its output lines there
+        size_t ring_stride = 0;
+        unsigned ring_mask = ZIMG_BUFFER_MAX;
+        unsigned ring_rows = 0;
+    };
+
+    //output lines of a slice leave its ring as soon as they are written, only the rows the slice owns
+    struct PackTarget {
+        const Slice *slice;
+        uint8_t *dst;
+        int stride;
+        int plane_size;
+    };
+
+    helper::ThreadPool *pool;
+    std::vector<Slice> slices;
+
+    static int pack_rows(void *user, unsigned i, unsigned left, unsigned right) {
+        const PackTarget &target = *static_cast<const PackTarget *>(user);
+        const Slice &slice = *target.slice;
+        if ((int)i < slice.first || (int)i >= slice.last) return 0;
+        const size_t ring_row = (slice.ring_mask == ZIMG_BUFFER_MAX) ? i : (i & slice.ring_mask);
+        for (int p = 0; p < 3; ++p) {
+            const uint8_t *line = slice.ring + (p * slice.ring_rows + ring_row) * slice.ring_stride;
+            uint8_t *out = target.dst + p * target.plane_size + (size_t)(slice.top + i) * target.stride;
+            std::memcpy(out + left * sizeof(uint16_t), line + left * sizeof(uint16_t), (right - left) * sizeof(uint16_t));
+        }
+        return 0;
+    }
+
+    void process_slice(const Slice &slice, const FFMS_Frame *src, uint8_t *dst, int stride, int plane_size) {
+        zimg_image_buffer_const slice_src = {ZIMG_API_VERSION};
+        zimg_image_buffer slice_dst = {ZIMG_API_VERSION};
+        for (int p = 0; p < 3; ++p) {
+            const int row = (p == 0) ? slice.top : (slice.top >> src_format.subsample_h);
+            slice_src.plane[p].data = src->Data[p] + (ptrdiff_t)row * src->Linesize[p];
+            slice_src.plane[p].stride = src->Linesize[p];
+            slice_src.plane[p].mask = ZIMG_BUFFER_MAX;
+
+            slice_dst.plane[p].data = slice.ring + p * slice.ring_rows * slice.ring_stride;
+            slice_dst.plane[p].stride = slice.ring_stride;
+            slice_dst.plane[p].mask = slice.ring_mask;
+        }
+
+        PackTarget target = {&slice, dst, stride, plane_size};
+        int ret = zimg_filter_graph_process(slice.graph, &slice_src, &slice_dst,
+                                            slice.tmp, 0, 0, pack_rows, &target);
+
+        ASSERT_WITH_MESSAGE(ret == 0, "zimg: Filter graph processing failed.");
+    }
+
+    //no slices when resizing (a slice is not a fixed set of source rows anymore) or when one would do
+    void build_slices() {
+        const int height = dst_format.height;
+        if (src_format.width != dst_format.width || src_format.height != dst_format.height) return;
+        if ((1 << src_format.subsample_h) > slice_margin) return;
+        const int count = std::min(pool->size(), height / min_slice_rows);
+        if (count < 2) return;
+
+        zimg_graph_builder_params params;
+        zimg_graph_builder_params_default(&params, ZIMG_API_VERSION);
+
+        slices.resize(count);
+        for (int s = 0; s < count; ++s) {
+            Slice &slice = slices[s];
+            //boundaries on multiples of the margin, the last slice takes the remainder
+            const int begin = (int64_t)height * s / count / slice_margin * slice_margin;
+            const int end = (s == count - 1) ? height : (int64_t)height * (s + 1) / count / slice_margin * slice_margin;
+            slice.top = std::max(0, begin - slice_margin);
+            slice.rows = std::min(height, end + slice_margin) - slice.top;
+            slice.first = begin - slice.top;
+            slice.last = end - slice.top;
+
+            zimg_image_format slice_src_format = src_format;
+            zimg_image_format slice_dst_format = dst_format;
+            slice_src_format.height = slice.rows;
+            slice_dst_format.height = slice.rows;
+            slice.graph = zimg_filter_graph_build(&slice_src_format, &slice_dst_format, &params);
+            ASSERT_WITH_MESSAGE(slice.graph != nullptr,
+                                "zimg: Failed to build filter graph.");
+
+            size_t size = 0;
+            int result = zimg_filter_graph_get_tmp_size(slice.graph, &size);
+            ASSERT_WITH_MESSAGE(result == 0,
+                                "zimg: Failed to get temporary buffer size.");
+            slice.tmp = aligned_alloc(64, std::max<size_t>(size, 64));
+            ASSERT_WITH_MESSAGE(slice.tmp != nullptr,
+                                "zimg: Failed to allocate temporary buffer.");
+
+            //the ring must be a power of 2 of rows holding the lines the graph needs at once
+            unsigned buffering = 0;
+            result = zimg_filter_graph_get_output_buffering(slice.graph, &buffering);
+            ASSERT_WITH_MESSAGE(result == 0,
+                                "zimg: Failed to get output buffering.");
+            unsigned ring_rows = 1;
+            while (ring_rows < buffering && ring_rows < (unsigned)slice.rows) ring_rows <<= 1;
+            if (ring_rows >= (unsigned)slice.rows) {
+                slice.ring_rows = slice.rows;
+                slice.ring_mask = ZIMG_BUFFER_MAX;
+            } else {
+                slice.ring_rows = ring_rows;
+                slice.ring_mask = ring_rows - 1;
+            }
+            slice.ring_stride = (dst_format.width * sizeof(uint16_t) + 63) / 64 * 64;
+            slice.ring = static_cast<uint8_t *>(aligned_alloc(64, 3 * slice.ring_rows * slice.ring_stride));
+            ASSERT_WITH_MESSAGE(slice.ring != nullptr,
+                                "zimg: Failed to allocate output ring.");
+        }
+    }
+
     void initialize_formats(const FFMS_Frame *frame, int width, int height) {
         int result = ffmpegToZimgFormat(src_format, frame);
         ASSERT_WITH_MESSAGE(
@@ -402,20 +738,98 @@ class ZimgProcessor {
     }
 };
 
+//FFMS: any container, through an FFMS2 index. Libav: any container, decoded in order without index.
+//Y4M and Raw: memory mapped uncompressed files. Stream: Y4M or raw from stdin ("-") or a FIFO, read once in order.
+enum class InputType { FFMS, Libav, Y4M, Raw, Stream };
+
+//--decoder: which reader compressed inputs go through, auto is libav for dense schedules only
+enum class DecoderType { FFMS, Libav, Auto, Unknown };
+
+//how to open an input, every reader thread opens its own reader from it
+struct VideoInput {
+    std::string path;
+    InputType type = InputType::FFMS;
+    RawVideoFormat raw;
+    FFMS_Index *index = nullptr; //FFMS only, once indexed
+    int video_track = -1;
+    int decoder_threads = 0; //FFMS and Libav only, 0 for one per core
+};
+
+//read by a single thread in order, their parallelism is inside the decoder
+bool sequential_input(const VideoInput &input) {
+    return input.type == InputType::Libav || input.type == InputType::Stream;
+}
+
+//inputs going through a multithreaded decoder
+bool compressed_input(const VideoInput &input) {
+    return input.type == InputType::FFMS || input.type == InputType::Libav;
+}
+
+VideoInput describe_input(const std::string &path, const RawVideoFormat &raw) {
+    VideoInput input;
+    input.path = path;
+    input.raw = raw;
+
+    bool is_fifo = (path == "-");
+#ifndef _WIN32
+    struct stat st;
+    if (!is_fifo && stat(path.c_str(), &st) == 0 && S_ISFIFO(st.st_mode)) is_fifo = true;
+#endif
+    std::string extension = std::filesystem::path(path).extension().string();
+    for (char &c : extension) c = std::tolower(c);
+
+    if (is_fifo) {
+        input.type = InputType::Stream;
+    } else if (extension == ".y4m") {
+        input.type = InputType::Y4M;
+    } else if (extension == ".yuv" || extension == ".raw") {
+        input.type = InputType::Raw;
+    }
+    return input;
+}
+
+std::unique_ptr<FrameReader> open_frame_reader(const VideoInput &input) {
+    switch (input.type) {
+    case InputType::Y4M:
+        return std::make_unique<YuvFileReader>(input.path, true, input.raw);
+    case InputType::Raw:
+        return std::make_unique<YuvFileReader>(input.path, false, input.raw);
+    case InputType::Stream:
+        return std::make_unique<YuvStreamReader>(input.path, input.raw);
+    case InputType::Libav:
+        return std::make_unique<LibavFrameReader>(input.path, input.decoder_threads);
+    default:
+        return std::make_unique<FFMSFrameReader>(input.path, input.index, input.video_track, input.decoder_threads);
+    }
+}
+
 class VideoManager {
   public:
     int plane_size_bytes = 0;
     int plane_stride_bytes = 0;
 
-    std::unique_ptr<FFMSFrameReader> reader;
+    std::unique_ptr<FrameReader> reader;
     std::unique_ptr<ZimgProcessor> processor;
 
+    //--profile: decode and convert times of every frame go to this track
+    Profiler *profiler = nullptr;
+    int profile_track = 0;
+    //--cpu-budget: decode times steer the split of the cores
+    ThreadBudget *budget = nullptr;
+
     VideoManager(const std::string &file_path, FFMS_Index *index,
                  int video_track_index, int resize_width = -1,
+                 int resize_height = -1)
+        : VideoManager(std::make_unique<FFMSFrameReader>(file_path, index, video_track_index),
+                       resize_width, resize_height) {}
+
+    VideoManager(const VideoInput &input, int resize_width = -1, int resize_height = -1)
+        : VideoManager(open_frame_reader(input), resize_width, resize_height) {}
+
+    VideoManager(std::unique_ptr<FrameReader> frame_reader, int resize_width = -1,
                  int resize_height = -1) {
 
-        reader = std::make_unique<FFMSFrameReader>(file_path, index,
-                                                   video_track_index);
+        reader = std::move(frame_reader);
 
         if (resize_width < 0)
             resize_width = reader->frame_width;
@@ -433,10 +847,43 @@ class VideoManager {
             "VideoManager: Failed to initialize ZimgProcessor.");
     }
 
-    void fetch_frame_into_buffer(int frame_index, uint8_t *output_buffer) {
-        reader->fetch_frame(frame_index);
+    //decode only, the frame stays in reader->current_frame until convert_frame
+    bool decode_frame(int frame_index) {
+        const auto start = Profiler::clock::now();
+        if (!reader->fetch_frame(frame_index)) return false;
+        const auto decoded = Profiler::clock::now();
+        if (profiler) profiler->record(profile_track, Stage::Decode, frame_index, start, decoded);
+        if (budget) budget->add_decode(decoded - start);
+        return true;
+    }
+
+    void convert_frame(int frame_index, uint8_t *output_buffer) {
+        const auto start = Profiler::clock::now();
         processor->process(reader->current_frame, output_buffer,
                            plane_stride_bytes, plane_size_bytes);
+        const auto converted = Profiler::clock::now();
+        if (profiler) profiler->record(profile_track, Stage::Convert, frame_index, start, converted);
+    }
+
+    //false if the reader has no such frame (end of a stream)
+    bool fetch_frame_into_buffer(int frame_index, uint8_t *output_buffer) {
+        if (!decode_frame(frame_index)) return false;
+        convert_frame(frame_index, output_buffer);
+        return true;
+    }
+
+    //--dedup: fingerprint of the visible pixels of the frame last decoded
+    uint64_t frame_fingerprint() const {
+        const FFMS_Frame *frame = reader->current_frame;
+        const zimg_image_format &format = processor->src_format;
+        const int64_t sample_bytes = (format.pixel_type == ZIMG_PIXEL_BYTE) ? 1 : 2;
+        uint64_t hash = 0;
+        for (int p = 0; p < 3; ++p) {
+            const int64_t width = (p == 0) ? format.width : (format.width + (1 << format.subsample_w) - 1) >> format.subsample_w;
+            const int64_t height = (p == 0) ? format.height : (format.height + (1 << format.subsample_h) - 1) >> format.subsample_h;
+            hash = fingerprint_plane(frame->Data[p], frame->Linesize[p], width * sample_bytes, height, hash);
+        }
+        return hash;
     }
 };
 
@@ -444,8 +891,15 @@ struct CommandLineOptions {
     std::string source_file;
     std::string encoded_file;
     std::string json_output_file;
+    std::string csv_output_file;
+    std::string binary_output_file;
+    std::string checkpoint_file;
+    int checkpoint_interval = 30; //seconds
+    std::string score_cache_dir;
+    std::string reference_features_file;
     std::string source_index;
     std::string encoded_index;
+    RawVideoFormat raw_format;
 
     int start_frame = 0;
     int end_frame = -1;
@@ -455,6 +909,27 @@ struct CommandLineOptions {
     std::vector<int> source_indices_list;
     std::vector<int> encoded_indices_list;
 
+    int scene_sampling = 0; //frames per scene, 0 when disabled
+    std::string scene_detection = "luma";
+
+    float target_precision = 0; //0 when every frame is scored
+
+    float threshold = -INFINITY; //--threshold, -INFINITY when not given
+
+    std::string profile_file;
+
+    std::string metrics_file; //--metrics-file, Prometheus text rewritten every second
+    std::string metrics_socket; //--metrics-socket, Unix socket answering with the same text
+
+    bool dedup = false;
+
+    bool auto_crop = false;
+
+    int cpu_budget = 0; //--cpu-budget, 0 for every hardware thread
+    bool pin_threads = false;
+
+    std::string benchmark; //--benchmark, empty for a normal run, else decode, convert or compute
+
     int intensity_target_nits = 203;
     int gpu_id = 0;
     int gpu_threads = 3;
@@ -463,12 +938,16 @@ struct CommandLineOptions {
     bool list_gpus = false;
     bool version = false;
     MetricType metric = MetricType::SSIMULACRA2; //SSIMULACRA2 by default
+    BackendType backend = default_backend;
+    DecoderType decoder = DecoderType::FFMS;
 
     bool NoAssertExit = false; //please exit without creating an assertion failed scary error
 
     bool live_index_score_output = false;
 
     bool cache_index = false;
+
+    bool autotune = false;
 };
 
 std::vector<int> splitPerToken(std::string inp){
@@ -503,6 +982,31 @@ MetricType parse_metric_name(const std::string &name) {
     return MetricType::Unknown;
 }
 
+DecoderType parse_decoder_name(const std::string &name) {
+    std::string lowered;
+    lowered.resize(name.size());
+    for (unsigned int i = 0; i < name.size(); i++){
+        lowered[i] = std::tolower(name[i]);
+    }
+    if (lowered == "ffms" || lowered == "ffms2") return DecoderType::FFMS;
+    if (lowered == "libav" || lowered == "libavcodec") return DecoderType::Libav;
+    if (lowered == "auto") return DecoderType::Auto;
+    return DecoderType::Unknown;
+}
+
+BackendType parse_backend_name(const std::string &name) {
+    std::string lowered;
+    lowered.resize(name.size());
+    for (unsigned int i = 0; i < name.size(); i++){
+        lowered[i] = std::tolower(name[i]);
+    }
+    if (lowered == "cpu") return BackendType::CPU;
+#ifndef VSHIP_NO_SYCL
+    if (lowered == "sycl" || lowered == "gpu") return BackendType::SYCL;
+#endif
+    return BackendType::Unknown;
+}
+
 CommandLineOptions parse_command_line_arguments(int argc, char **argv) {
     std::vector<std::string> args(argc);
     for (int i = 0; i < argc; i++){
@@ -512,19 +1016,31 @@ CommandLineOptions parse_command_line_arguments(int argc, char **argv) {
     helper::ArgParser parser;
 
     std::string metric_name;
+    std::string backend_name;
+    std::string decoder_name;
     std::string source_indices_str;
     std::string encoded_indices_str;
 
     CommandLineOptions opts;
 
     parser.add_flag({"--source", "-s"}, &opts.source_file, "Reference video to compare to", true);
-    parser.add_flag({"--encoded", "-e"}, &opts.encoded_file, "Distorted encode of the source", true);
+    parser.add_flag({"--encoded", "-e"}, &opts.encoded_file, "Distorted encode of the source, - reads Y4M or raw frames from stdin", true);
     parser.add_flag({"--metric", "-m"}, &metric_name, "Which metric to use [SSIMULACRA2, Butteraugli]");
     parser.add_flag({"--json"}, &opts.json_output_file, "Outputs metric results to a json file");
+    parser.add_flag({"--csv"}, &opts.csv_output_file, "Outputs metric results to a csv file (index,source_frame,encoded_frame,scores)");
+    parser.add_flag({"--binary"}, &opts.binary_output_file, "Outputs metric results to a file of fixed size binary records, see ScoreWriter.hpp");
     parser.add_flag({"--live-score-output"}, &opts.live_index_score_output, "replace stdout output with index-score lines");
+    parser.add_flag({"--checkpoint"}, &opts.checkpoint_file, "Periodically save finished frames to this file and skip them when the same run is started again (implies --cache-index)");
+    parser.add_flag({"--checkpoint-interval"}, &opts.checkpoint_interval, "Seconds between checkpoint saves, default 30");
+    parser.add_flag({"--score-cache"}, &opts.score_cache_dir, "Directory of a persistent score cache keyed by the content of both videos, frames already scored in any previous run are not decoded again");
+    parser.add_flag({"--reference-features"}, &opts.reference_features_file, "Memory mapped store of the source side of the metric. The first run fills it, the next ones against the same source frames skip decoding the source and its half of the metric");
     parser.add_flag({"--source-index"}, &opts.source_index, "FFMS2 index file for source video");
     parser.add_flag({"--encoded-index"}, &opts.encoded_index, "FFMS2 index file for encoded video");
     parser.add_flag({"--cache-index"}, &opts.cache_index, "Write index files to disk and reuse if available");
+    parser.add_flag({"--decoder"}, &decoder_name, "How compressed inputs are decoded [ffms, libav, auto]. libav decodes front to back with frame threading and no index, auto uses it when every frame between --start and --end is scored. Default ffms");
+    parser.add_flag({"--raw-width"}, &opts.raw_format.width, "Width of .yuv/.raw inputs and of raw streams");
+    parser.add_flag({"--raw-height"}, &opts.raw_format.height, "Height of .yuv/.raw inputs and of raw streams");
+    parser.add_flag({"--raw-format"}, &opts.raw_format.pixel_format, "Pixel format of raw inputs, ffmpeg names such as yuv420p or yuv420p10le, default yuv420p");
 
     parser.add_flag({"--start"}, &opts.start_frame, "Starting frame of source");
     parser.add_flag({"--end"}, &opts.end_frame, "Ending frame of source");
@@ -532,11 +1048,25 @@ CommandLineOptions parse_command_line_arguments(int argc, char **argv) {
     parser.add_flag({"--every"}, &opts.every_nth_frame, "Frame sampling rate");
     parser.add_flag({"--source-indices"}, &source_indices_str, "List of source indices subjective to --start, --end, --every and --encoded-offset. If --encoded-indices isnt specified, this will be applied to encoded-indices too. Format is integers separated by comma");
     parser.add_flag({"--encoded-indices"}, &encoded_indices_str, "List of encoded indices subjective to --start, --end, --every and --encoded-offset. Format is integers separated by comma");
+    parser.add_flag({"--scene-sampling"}, &opts.scene_sampling, "Score this many frames per scene of the source instead of every frame, and print per scene and scene weighted statistics");
+    parser.add_flag({"--target-precision"}, &opts.target_precision, "Score the frames in stratified random order and stop once the average and 5th percentile are known to +-this value with 95% confidence (SSIMULACRA2 score, INF-Norm for Butteraugli)");
+    parser.add_flag({"--threshold"}, &opts.threshold, "Only tell whether each frame scores at least this SSIMULACRA2 value. Frames whose coarse scales already put them below it skip the full resolution scale and report an upper bound of their score");
+    parser.add_flag({"--profile"}, &opts.profile_file, "Time every stage of every frame (decode, convert, buffer and queue waits, upload, compute, reduce), print their p50/p99 and write a Chrome trace JSON to this file");
+    parser.add_flag({"--metrics-file"}, &opts.metrics_file, "Rewrite this file every second with live counters of the run (progress, fps, queue depths, buffer pool, worker busy ratio, device memory) in the Prometheus text format");
+    parser.add_flag({"--metrics-socket"}, &opts.metrics_socket, "Serve the same counters on this Unix socket, each connection gets the last sample");
+    parser.add_flag({"--benchmark"}, &opts.benchmark, "Measure the highest fps of one stage alone and exit [decode, convert, compute]. decode only runs the decoders on --threads readers, convert adds the conversion to planar RGB, compute scores the first frame pair again and again on --gpu-threads workers");
+    parser.add_flag({"--scene-detection"}, &opts.scene_detection, "How scenes are found for --scene-sampling [luma, keyframes]. luma compares the downscaled luma of consecutive source frames, keyframes uses the keyframes of the FFMS2 index. Default luma");
     parser.add_flag({"--intensity-target"}, &opts.intensity_target_nits, "Target nits for Butteraugli");
     parser.add_flag({"--threads", "-t"}, &opts.cpu_threads, "Number of Decoder process, recommended is 2");
     parser.add_flag({"--gpu-threads", "-g"}, &opts.gpu_threads, "GPU thread count, recommended is 3");
+    parser.add_flag({"--dedup"}, &opts.dedup, "Give a frame pair whose decoded source and encoded frames both equal those of the previous pair the score of that pair, without converting nor scoring it, and print how many were");
+    parser.add_flag({"--auto-crop"}, &opts.auto_crop, "Find the black bars of a letterboxed or pillarboxed source on a sample of its frames and only score the picture between them");
+    parser.add_flag({"--cpu-budget"}, &opts.cpu_budget, "Cores shared by the decoder threads, the conversion to RGB and the native backend, rebalanced every second from the decode times. Default every hardware thread, with one decoder thread per core");
+    parser.add_flag({"--pin-threads"}, &opts.pin_threads, "Keep FFVship on the first --cpu-budget cores and each thread of the shared pool on one of them (Linux)");
     parser.add_flag({"--gpu-id"}, &opts.gpu_id, "GPU index");
+    parser.add_flag({"--backend"}, &backend_name, "Where to compute the metric [sycl, cpu]. cpu runs the native implementation on all host cores, --gpu-threads is then the number of frames in flight");
     parser.add_flag({"--list-gpu"}, &opts.list_gpus, "List available GPUs");
+    parser.add_flag({"--autotune"}, &opts.autotune, "Benchmark kernel work-group sizes for this GPU and resolution and store them in the tuning file");
     parser.add_flag({"--version"}, &opts.version, "Print FFVship version");
 
     if (parser.parse_cli_args(args) != 0) { //the parser will have already printed an error
@@ -571,6 +1101,76 @@ CommandLineOptions parse_command_line_arguments(int argc, char **argv) {
         opts.NoAssertExit = true;
     }
 
+    if (find_yuv_pixel_format(opts.raw_format.pixel_format) == nullptr){
+        std::cerr << "Unknown --raw-format " << opts.raw_format.pixel_format << ", expected planar yuv such as yuv420p, yuv422p10le or yuv444p16le" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.scene_sampling < 0){
+        std::cerr << "--scene-sampling must be positive" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.scene_sampling > 0 && (opts.every_nth_frame != 1 || !opts.source_indices_list.empty() || !opts.encoded_indices_list.empty())){
+        std::cerr << "--scene-sampling chooses the frames itself, it cannot be combined with --every or index lists" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.scene_detection != "luma" && opts.scene_detection != "keyframes"){
+        std::cerr << "Unknown --scene-detection. Expected 'luma' or 'keyframes'." << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (!opts.metrics_file.empty() && !opts.metrics_socket.empty()){
+        std::cerr << "--metrics-file and --metrics-socket cannot be used together" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (!opts.benchmark.empty() && opts.benchmark != "decode" && opts.benchmark != "convert" && opts.benchmark != "compute"){
+        std::cerr << "Unknown --benchmark. Expected 'decode', 'convert' or 'compute'." << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (!opts.benchmark.empty() && (opts.live_index_score_output || !opts.json_output_file.empty() || !opts.csv_output_file.empty()
+                                    || !opts.binary_output_file.empty() || !opts.checkpoint_file.empty() || !opts.score_cache_dir.empty()
+                                    || !opts.reference_features_file.empty() || opts.target_precision > 0 || !opts.profile_file.empty()
+                                    || !opts.metrics_file.empty() || !opts.metrics_socket.empty())){
+        std::cerr << "--benchmark produces no scores, it cannot be combined with score outputs, --checkpoint, --score-cache, --reference-features, --target-precision, --profile or metrics" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.auto_crop && (!opts.benchmark.empty() || !opts.reference_features_file.empty())){
+        std::cerr << "--auto-crop cannot be combined with --benchmark, which measures whole frames, nor with --reference-features, which are stored for whole frames" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.cpu_budget < 0){
+        std::cerr << "--cpu-budget must be positive" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.target_precision < 0){
+        std::cerr << "--target-precision must be positive" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.target_precision > 0 && opts.scene_sampling > 0){
+        std::cerr << "--target-precision cannot be combined with --scene-sampling, whose frames do not weigh the same" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    //a bound stored by --checkpoint or --score-cache would be read back as the score by the next run
+    if (opts.threshold != -INFINITY && (opts.target_precision > 0 || opts.scene_sampling > 0
+                                        || !opts.checkpoint_file.empty() || !opts.score_cache_dir.empty())){
+        std::cerr << "--threshold gives upper bounds instead of scores, it cannot be combined with --target-precision, --scene-sampling, --checkpoint or --score-cache" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.checkpoint_interval < 1){
+        std::cerr << "--checkpoint-interval must be at least 1 second" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
     if (!metric_name.empty()) {
         opts.metric = parse_metric_name(metric_name);
         if (opts.metric == MetricType::Unknown){
@@ -579,5 +1179,40 @@ CommandLineOptions parse_command_line_arguments(int argc, char **argv) {
         }
     }
 
+    if (!decoder_name.empty()) {
+        opts.decoder = parse_decoder_name(decoder_name);
+        if (opts.decoder == DecoderType::Unknown){
+            std::cerr << "Unknown decoder. Expected 'ffms', 'libav' or 'auto'." << std::endl;
+            opts.NoAssertExit = true;
+        }
+    }
+
+    if (!backend_name.empty()) {
+        opts.backend = parse_backend_name(backend_name);
+        if (opts.backend == BackendType::Unknown){
+#ifdef VSHIP_NO_SYCL
+            std::cerr << "Unknown backend. This build has no SYCL support, the only backend is 'cpu'." << std::endl;
+#else
+            std::cerr << "Unknown backend. Expected 'sycl' or 'cpu'." << std::endl;
+#endif
+            opts.NoAssertExit = true;
+        }
+    }
+
+    if (!opts.reference_features_file.empty() && opts.metric != MetricType::SSIMULACRA2){
+        std::cerr << "--reference-features requires the SSIMULACRA2 metric" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.dedup && !opts.reference_features_file.empty()){
+        std::cerr << "--dedup compares the decoded source frames, it cannot be combined with --reference-features" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
+    if (opts.threshold != -INFINITY && opts.metric != MetricType::SSIMULACRA2){
+        std::cerr << "--threshold is only available for SSIMULACRA2" << std::endl;
+        opts.NoAssertExit = true;
+    }
+
     return opts;
 }
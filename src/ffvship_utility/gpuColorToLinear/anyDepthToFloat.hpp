@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../../util/kerneltrace.hpp"
+
 namespace VshipColorConvert{
 
 enum Sample_Type : int {
@@ -87,14 +89,14 @@ template<Sample_Type T>
 void convertToFloatPlane(float* output_plane, const uint8_t* const source_plane, const int stride, const int width, const int height, sycl::queue& q){
     const size_t total = static_cast<size_t>(width) * height;
 
-    q.submit([&](sycl::handler& cgh) {
+    helper::traceCommand("convertToFloatPlane", q, q.submit([&](sycl::handler& cgh) {
         cgh.parallel_for<ConvertToFloatPlaneKernel<T>>(
             sycl::range<1>(total),
             [=](sycl::id<1> idx) {
                 size_t x = idx[0];
                 output_plane[x] = PickValue<T>(source_plane, x, stride, width);
             });
-    });
+    }));
 }
 
 bool inline convertToFloatPlaneSwitch(float* output_plane, const uint8_t* const source_plane, const int stride, const int width, const int height, Sample_Type T, sycl::queue &q){
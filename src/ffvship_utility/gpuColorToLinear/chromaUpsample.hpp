@@ -1,5 +1,7 @@
 #pragma once
 
+#include "../../util/kerneltrace.hpp"
+
 namespace VshipColorConvert{
 
 class CubicHermitSplineInterpolator{
@@ -145,7 +147,7 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
         case (AVCHROMA_LOC_TOPLEFT):
             if (subw == 0){
             } else if (subw == 1){                
-                q.submit([&](sycl::handler& cgh) {
+                helper::traceCommand("upsample_horizontal_left_x2", q, q.submit([&](sycl::handler& cgh) {
                     cgh.parallel_for<class BicubicHorizontalLeftUpscaleX2Single>(
                         sycl::nd_range<2>(globalLeft, local),
                         [=](sycl::nd_item<2> it) {
@@ -153,10 +155,10 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
                             bicubicHorizontalLeftUpscaleX2_Kernel(dst[2], src[2], width, height, it);
                         }
                     );
-                });
+                }));
                 width *= 2;                
             } else if (subw == 2) {
-                q.submit([&](sycl::handler& cgh) {
+                helper::traceCommand("upsample_horizontal_left_x4", q, q.submit([&](sycl::handler& cgh) {
                     cgh.parallel_for<class BicubicHorizontalLeftUpscaleX4Single>(
                         sycl::nd_range<2>(globalLeft, local),
                         [=](sycl::nd_item<2> it) {
@@ -164,7 +166,7 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
                             bicubicHorizontalLeftUpscaleX4_Kernel(dst[2], src[2], width, height, it);
                         }
                     );
-                });
+                }));
                 width *= 4;
             } else {
                 return 1; //not implemented
@@ -174,7 +176,7 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
         case (AVCHROMA_LOC_TOP):
             if (subw == 0){
             } else if (subw == 1){
-                q.submit([&](sycl::handler& cgh) {
+                helper::traceCommand("upsample_horizontal_center_x2", q, q.submit([&](sycl::handler& cgh) {
                     cgh.parallel_for<class BicubicHorizontalCenterUpscaleX2Single>(
                         sycl::nd_range<2>(globalHCenter, local),
                         [=](sycl::nd_item<2> it) {
@@ -182,10 +184,10 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
                             bicubicHorizontalCenterUpscaleX2_Kernel(dst[2], src[2], width, height, it);
                         }
                     );
-                });
+                }));
                 width *= 2;
             } else if (subw == 2){
-                q.submit([&](sycl::handler& cgh) {
+                helper::traceCommand("upsample_horizontal_center_x4", q, q.submit([&](sycl::handler& cgh) {
                     cgh.parallel_for<class BicubicHorizontalCenterUpscaleX4Single>(
                         sycl::nd_range<2>(globalHCenter, local),
                         [=](sycl::nd_item<2> it) {
@@ -193,7 +195,7 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
                             bicubicHorizontalCenterUpscaleX4_Kernel(dst[2], src[2], width, height, it);
                         }
                     );
-                });
+                }));
                 width *= 4;
             } else {
                 return 1; //not implemented
@@ -208,7 +210,7 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
         case (AVCHROMA_LOC_TOPLEFT):
             if (subh == 0){
             } else if (subh == 1){
-                q.submit([&](sycl::handler& cgh) {
+                helper::traceCommand("upsample_vertical_left_x2", q, q.submit([&](sycl::handler& cgh) {
                     cgh.parallel_for<class BicubicVertialLeftUpscaleX2Single>(
                         sycl::nd_range<2>(globalLeft, local),
                         [=](sycl::nd_item<2> it) {
@@ -216,7 +218,7 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
                             bicubicVerticalTopUpscaleX2_Kernel(dst[2], src[2], width, height, it);
                         }
                     );
-                });
+                }));
                 height *= 2;
             } else {
                 return 1; //not implemented
@@ -226,7 +228,7 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
         case (AVCHROMA_LOC_LEFT):
             if (subh == 0){
             } else if (subh == 1){
-                q.submit([&](sycl::handler& cgh) {
+                helper::traceCommand("upsample_vertical_center_x4", q, q.submit([&](sycl::handler& cgh) {
                     cgh.parallel_for<class BicubicVerticalCenterUpscaleX4Single>(
                         sycl::nd_range<2>(globalVCenter, local),
                         [=](sycl::nd_item<2> it) {
@@ -234,7 +236,7 @@ int inline upsample(float* dst[3], float* src[3], int64_t width, int64_t height,
                             bicubicVerticalCenterUpscaleX2_Kernel(dst[2], src[2], width, height, it);
                         }
                     );
-                });
+                }));
                 height *= 2;
             } else {
                 return 1; //not implemented
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <limits>
+
+#include "main.hpp"
+
+namespace ssimu2{
+
+//best of a few runs in milliseconds, the first launch is discarded
+template <typename F>
+double timeLaunch(sycl::queue& q, F launch, int repeat = 5){
+    launch();
+    q.wait();
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < repeat; i++){
+        const auto begin = std::chrono::steady_clock::now();
+        launch();
+        q.wait();
+        const auto end = std::chrono::steady_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(end - begin).count());
+    }
+    return best;
+}
+
+//benchmarks the candidate work-group sizes of every tunable kernel on the device of q at this resolution,
+//stores the winners in the tuning file (and for this process) and returns them
+KernelConfig autotuneKernels(sycl::queue& q, int64_t width, int64_t height, bool verbose = false){
+    const sycl::device dev = q.get_device();
+    const int64_t maxgroup = dev.get_info<sycl::info::device::max_work_group_size>();
+    const int64_t maxshared = dev.get_info<sycl::info::device::local_mem_size>();
+    const int64_t totalscalesize = getTotalScaleSize(width, height);
+    const int64_t stride = width*sizeof(uint16_t);
+
+    KernelConfig best;
+
+    //reduction candidates first, the pinned buffer must fit the smallest of them
+    std::vector<int64_t> reduce_candidates;
+    for (int64_t th = 64; th <= 1024; th *= 2){
+        if (th <= maxgroup && reduceThreads(maxshared, std::numeric_limits<int64_t>::max(), th) >= 32) reduce_candidates.push_back(th);
+    }
+    int64_t pinnedsize = 0;
+    for (const int64_t th : reduce_candidates) pinnedsize = std::max(pinnedsize, allocsizeScore(width, height, maxshared, th));
+    pinnedsize = std::max(pinnedsize, allocsizeScore(width, height, maxshared, best.reduce_threads));
+
+    GaussianHandle gaussianhandle;
+    gaussianhandle.init(q);
+    sycl::float3* mem = NULL;
+    sycl::float3* pinned = NULL;
+    try {
+        mem = sycl::malloc_device<sycl::float3>(3*totalscalesize, q);
+        pinned = sycl::malloc_host<sycl::float3>(pinnedsize, q);
+    } catch (...) {
+        mem = NULL;
+    }
+    if (mem == NULL || pinned == NULL){
+        if (mem != NULL) sycl::free(mem, q);
+        if (pinned != NULL) sycl::free(pinned, q);
+        gaussianhandle.destroy(q);
+        VSHIP_THROW(OutOfVRAM);
+    }
+    sycl::float3* src1_d = mem;
+    sycl::float3* src2_d = mem + totalscalesize;
+    sycl::float3* temp_d = mem + 2*totalscalesize;
+    uint8_t* planes_d = (uint8_t*)temp_d; //3 UINT16 planes fit in a float3 plane
+    q.memset(mem, 0, sizeof(sycl::float3)*3*totalscalesize).wait();
+
+    auto report = [&](const char* name, const std::string& value, double ms){
+        if (verbose) std::cout << "autotune: " << name << " -> " << value << " (" << ms << " ms)" << std::endl;
+    };
+
+    std::vector<int64_t> linear_candidates;
+    for (int64_t th = 32; th <= 1024; th *= 2){
+        if (th <= maxgroup) linear_candidates.push_back(th);
+    }
+
+    //memoryorganizer
+    double besttime = std::numeric_limits<double>::max();
+    for (const int64_t th : linear_candidates){
+        const double t = timeLaunch(q, [&](){
+            memoryorganizer<UINT16>(src1_d, planes_d, planes_d + stride*height, planes_d + 2*stride*height, stride, width, height, q, th);
+        });
+        if (t < besttime){ besttime = t; best.organizer_threads = th; }
+    }
+    report("memoryorganizer", std::to_string(best.organizer_threads), besttime);
+
+    //rgb_to_linear and rgb_to_positive_xyb share one setting
+    besttime = std::numeric_limits<double>::max();
+    for (const int64_t th : linear_candidates){
+        const double t = timeLaunch(q, [&](){
+            rgb_to_linear(src1_d, totalscalesize, q, th);
+            rgb_to_positive_xyb(src1_d, totalscalesize, q, th);
+        });
+        if (t < besttime){ besttime = t; best.pointwise_threads = th; }
+    }
+    report("rgb_to_linear/rgb_to_positive_xyb", std::to_string(best.pointwise_threads), besttime);
+    q.memset(mem, 0, sizeof(sycl::float3)*2*totalscalesize).wait();
+
+    //downsample over the whole pyramid
+    const std::pair<int64_t, int64_t> tile_candidates[] = {{8, 8}, {16, 8}, {32, 4}, {16, 16}, {32, 8}, {64, 4}, {32, 16}, {64, 8}, {128, 2}, {256, 1}};
+    besttime = std::numeric_limits<double>::max();
+    for (const auto& [tx, ty] : tile_candidates){
+        if (tx*ty > maxgroup) continue;
+        const double t = timeLaunch(q, [&](){
+            int64_t nw = width;
+            int64_t nh = height;
+            int64_t index = 0;
+            for (int scale = 1; scale <= 5; scale++){
+                downsample(src1_d+index, src1_d+index+nw*nh, nw, nh, q, tx, ty);
+                index += nw*nh;
+                nw = (nw-1)/2+1;
+                nh = (nh-1)/2+1;
+            }
+        });
+        if (t < besttime){ besttime = t; best.downsample_x = tx; best.downsample_y = ty; }
+    }
+    report("downsample", std::to_string(best.downsample_x) + "x" + std::to_string(best.downsample_y), besttime);
+
+    //reduction stages, timed through the whole allscore_map since they cannot run alone
+    besttime = std::numeric_limits<double>::max();
+    for (const int64_t th : reduce_candidates){
+        const double t = timeLaunch(q, [&](){
+            allscore_map(src1_d, src2_d, temp_d, pinned, width, height, maxshared, gaussianhandle, q, th);
+        });
+        if (t < besttime){ besttime = t; best.reduce_threads = th; }
+    }
+    report("reduction", std::to_string(best.reduce_threads), besttime);
+
+    sycl::free(mem, q);
+    sycl::free(pinned, q);
+    gaussianhandle.destroy(q);
+
+    if (!saveKernelConfig(dev, width, height, best) && verbose){
+        std::cout << "autotune: could not write the tuning file [" << tuningFilePath() << "], results only apply to this run (set VSCYCLE_TUNING_FILE)" << std::endl;
+    }
+    return best;
+}
+
+}
@@ -0,0 +1,203 @@
+#pragma once
+
+//Variants for SYCL CPU devices. Work-groups and barriers are emulated there, so these kernels are plain
+//parallel_for without local memory: each work-item owns a whole row or a vertical strip and walks it sequentially.
+
+namespace ssimu2{
+
+//columns handled by one work-item of allscore_map_cpu
+constexpr int64_t CPU_STRIP = 16;
+
+void downsample_cpu(sycl::float3* src, sycl::float3* dst, int64_t width, int64_t height, sycl::queue& q){
+    const int64_t newh = (height - 1) / 2 + 1;
+    const int64_t neww = (width - 1) / 2 + 1;
+
+    helper::traceCommand("downsample_cpu", q, q.submit([&](sycl::handler& h) {
+        h.parallel_for(sycl::range<1>(newh), [=](sycl::item<1> item) {
+            const int64_t y = item.get_id(0);
+            const sycl::float3* row0 = src + sycl::min(2 * y, height - 1) * width;
+            const sycl::float3* row1 = src + sycl::min(2 * y + 1, height - 1) * width;
+            sycl::float3* out = dst + y * neww;
+            for (int64_t x = 0; x < neww; x++){
+                const int64_t x0 = sycl::min(2 * x, width - 1);
+                const int64_t x1 = sycl::min(2 * x + 1, width - 1);
+                out[x] = (row0[x0] + row1[x0] + row0[x1] + row1[x1]) * 0.25f;
+            }
+        });
+    }));
+}
+
+//pinned memory needed by allscore_map_cpu: 6 partial sums per strip and per scale
+int64_t allocsizeScoreCPU(int64_t width, int64_t height){
+    int64_t w = width;
+    int64_t h = height;
+    int64_t pinnedsize = 0;
+    for (int scale = 0; scale < 6; scale++){
+        pinnedsize += 6*((w-1)/CPU_STRIP + 1);
+        w = (w-1)/2 + 1;
+        h = (h-1)/2 + 1;
+    }
+    return pinnedsize;
+}
+
+//One work-item per strip of CPU_STRIP columns going down the image. The horizontal blur of the 5 moments
+//(im1, im2, im1², im2², im1*im2) is kept in a ring of 17 rows, the vertical blur of row y is done as soon as
+//row y+8 is available. Same border normalization as GaussianSmart_Device so results match the GPU kernel.
+void allscore_map_cpu_Kernel(
+    sycl::queue &q,
+    sycl::float3* dst, //6*strips partial sums
+    const sycl::float3* im1,
+    const sycl::float3* im2,
+    int64_t width,
+    int64_t height,
+    const float* gaussiankernel,
+    const float* gaussiankernel_integral
+) {
+    const int64_t strips = (width - 1)/CPU_STRIP + 1;
+
+    helper::traceCommand("allscore_map_cpu_Kernel", q, q.submit([&](sycl::handler& h) {
+        h.parallel_for(sycl::range<1>(strips), [=](sycl::item<1> item) {
+            const int64_t strip = item.get_id(0);
+            const int64_t x0 = strip*CPU_STRIP;
+
+            //ring[row%17][moment][column]
+            sycl::float3 ring[2*GAUSSIANSIZE+1][5][CPU_STRIP];
+
+            float hnorm[CPU_STRIP];
+            for (int c = 0; c < CPU_STRIP; c++){
+                const int64_t x = x0 + c;
+                if (x >= width) break;
+                const int beg = sycl::max<int64_t>(0, x - 8) - (x - 8);
+                const int end = sycl::min<int64_t>(width, x + 9) - (x - 8);
+                hnorm[c] = 1.0f / (gaussiankernel_integral[end] - gaussiankernel_integral[beg]);
+            }
+
+            sycl::float3 sums[6];
+            for (int k = 0; k < 6; k++) zeroVec(sums[k]);
+
+            for (int64_t yy = 0; yy < height + GAUSSIANSIZE; yy++){
+                if (yy < height){
+                    const sycl::float3* row1 = im1 + yy*width;
+                    const sycl::float3* row2 = im2 + yy*width;
+                    auto& slot = ring[yy % (2*GAUSSIANSIZE+1)];
+                    for (int c = 0; c < CPU_STRIP; c++){
+                        if (x0 + c >= width) break;
+                        sycl::float3 acc[5];
+                        for (int k = 0; k < 5; k++) zeroVec(acc[k]);
+                        for (int i = 0; i < 2*GAUSSIANSIZE+1; i++){
+                            const int64_t xs = x0 + c - GAUSSIANSIZE + i;
+                            if (xs < 0 || xs >= width) continue;
+                            const sycl::float3 a = row1[xs];
+                            const sycl::float3 b = row2[xs];
+                            const float g = gaussiankernel[i];
+                            acc[0] += a * g;
+                            acc[1] += b * g;
+                            acc[2] += (a * a) * g;
+                            acc[3] += (b * b) * g;
+                            acc[4] += (a * b) * g;
+                        }
+                        for (int k = 0; k < 5; k++) slot[k][c] = acc[k] * hnorm[c];
+                    }
+                }
+
+                const int64_t y = yy - GAUSSIANSIZE;
+                if (y < 0) continue;
+
+                const int beg = sycl::max<int64_t>(0, y - 8) - (y - 8);
+                const int end = sycl::min<int64_t>(height, y + 9) - (y - 8);
+                const float vnorm = 1.0f / (gaussiankernel_integral[end] - gaussiankernel_integral[beg]);
+
+                for (int c = 0; c < CPU_STRIP; c++){
+                    const int64_t x = x0 + c;
+                    if (x >= width) break;
+
+                    sycl::float3 mom[5];
+                    for (int k = 0; k < 5; k++) zeroVec(mom[k]);
+                    for (int i = beg; i < end; i++){
+                        const auto& slot = ring[(y - GAUSSIANSIZE + i) % (2*GAUSSIANSIZE+1)];
+                        const float g = gaussiankernel[i];
+                        for (int k = 0; k < 5; k++) mom[k] += slot[k][c] * g;
+                    }
+                    const sycl::float3 m1 = mom[0] * vnorm;
+                    const sycl::float3 m2 = mom[1] * vnorm;
+                    const sycl::float3 su11 = mom[2] * vnorm;
+                    const sycl::float3 su22 = mom[3] * vnorm;
+                    const sycl::float3 su12 = mom[4] * vnorm;
+
+                    const sycl::float3 m11 = m1 * m1;
+                    const sycl::float3 m22 = m2 * m2;
+                    const sycl::float3 m12 = m1 * m2;
+                    const sycl::float3 m_diff = m1 - m2;
+                    const sycl::float3 num_m = fma(m_diff, m_diff * -1.0f, 1.0f);
+                    const sycl::float3 num_s = fma(su12 - m12, 2.0f, 0.0009f);
+                    const sycl::float3 denom_s = (su11 - m11) + (su22 - m22) + 0.0009f;
+                    const sycl::float3 d0 = sycl::max(1.0f - ((num_m * num_s) / denom_s), 0.0f);
+
+                    const int64_t id = y*width + x;
+                    const sycl::float3 v1 = (sycl::fabs(im2[id] - m2) + 1.0f) /
+                                            (sycl::fabs(im1[id] - m1) + 1.0f) - 1.0f;
+                    const sycl::float3 d1 = sycl::max(v1, 0.0f);
+                    const sycl::float3 d2 = sycl::max(v1 * -1.0f, 0.0f);
+
+                    sums[0] += d0;
+                    sums[1] += tothe4th(d0);
+                    sums[2] += d1;
+                    sums[3] += tothe4th(d1);
+                    sums[4] += d2;
+                    sums[5] += tothe4th(d2);
+                }
+            }
+
+            const float norm = 1.0f / (float)(width * height);
+            for (int k = 0; k < 6; k++) dst[k*strips + strip] = sums[k] * norm;
+        });
+    }));
+}
+
+//same output as allscore_map
+std::vector<sycl::float3> allscore_map_cpu(sycl::float3* im1, sycl::float3* im2, sycl::float3* temp, sycl::float3* pinned, int64_t basewidth, int64_t baseheight, GaussianHandle& gaussianhandle, sycl::queue& stream, int first_scale = 0, int end_scale = 6, helper::StageTimes* times = nullptr){
+    std::vector<sycl::float3> result(2 * 6 * 3);
+    for (auto& v : result) { zeroVec(v); }
+
+    int64_t w = basewidth;
+    int64_t h = baseheight;
+    int64_t index = 0;
+    for (int scale = 0; scale < first_scale; scale++){
+        index += w*h;
+        w = (w-1)/2+1;
+        h = (h-1)/2+1;
+    }
+    std::vector<int64_t> scaleoutdone(7);
+    scaleoutdone[first_scale] = 0;
+    for (int scale = first_scale; scale < end_scale; scale++){
+        allscore_map_cpu_Kernel(stream, temp + scaleoutdone[scale], im1 + index, im2 + index, w, h,
+                                gaussianhandle.gaussiankernel_d, gaussianhandle.gaussiankernel_integral_d);
+        scaleoutdone[scale+1] = scaleoutdone[scale] + 6*((w-1)/CPU_STRIP + 1);
+        index += w*h;
+        w = (w-1)/2+1;
+        h = (h-1)/2+1;
+    }
+    sycl::event download = helper::traceCommand("download", stream, stream.memcpy(pinned, temp, sizeof(sycl::float3)*scaleoutdone[end_scale]));
+    download.wait();
+    const auto reduce_start = std::chrono::steady_clock::now();
+
+    for (int scale = first_scale; scale < end_scale; scale++){
+        const int64_t strips = (scaleoutdone[scale+1] - scaleoutdone[scale])/6;
+        for (int k = 0; k < 6; k++){
+            for (int64_t i = 0; i < strips; i++){
+                result[6*scale+k] += pinned[scaleoutdone[scale] + k*strips + i];
+            }
+        }
+    }
+
+    for (int i = 0; i < 18; i++){
+        result[2*i+1].x() = sycl::sqrt(sycl::sqrt(result[2*i+1].x()));
+        result[2*i+1].y() = sycl::sqrt(sycl::sqrt(result[2*i+1].y()));
+        result[2*i+1].z() = sycl::sqrt(sycl::sqrt(result[2*i+1].z()));
+    } //completing 4th norm
+
+    if (times) times->reduce += helper::eventNanoseconds(download) + helper::elapsedNanoseconds(reduce_start, std::chrono::steady_clock::now());
+    return result;
+}
+
+}
@@ -1,18 +1,18 @@
 namespace ssimu2{
 
-void downsample(sycl::float3* src, sycl::float3* dst, int64_t width, int64_t height, sycl::queue& q) {
+void downsample(sycl::float3* src, sycl::float3* dst, int64_t width, int64_t height, sycl::queue& q, int64_t threads_x = 16, int64_t threads_y = 16) {
         int64_t newh = (height - 1) / 2 + 1;
         int64_t neww = (width - 1) / 2 + 1;
 
-        int64_t th_x = sycl::min((int64_t)16, neww);
-        int64_t th_y = sycl::min((int64_t)16, newh);
+        int64_t th_x = sycl::min(threads_x, neww);
+        int64_t th_y = sycl::min(threads_y, newh);
         int64_t bl_x = (neww - 1) / th_x + 1;
         int64_t bl_y = (newh - 1) / th_y + 1;
 
         sycl::range<2> local(th_y, th_x);                     // threads per work-group
         sycl::range<2> global(bl_y * th_y, bl_x * th_x);      // total threads
 
-        q.submit([&](sycl::handler& h) {
+        helper::traceCommand("downsample", q, q.submit([&](sycl::handler& h) {
             h.parallel_for(
                 sycl::nd_range<2>(global, local),
                 [=](sycl::nd_item<2> item) {
@@ -33,7 +33,7 @@ void downsample(sycl::float3* src, sycl::float3* dst, int64_t width, int64_t hei
 
                     dst[idx] *= 0.25f;
                 });
-        });
+        }));
     }
 
 }
\ No newline at end of file
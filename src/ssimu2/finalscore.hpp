@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+//host side end of the metric, shared by the SYCL and the native CPU implementations
+
+namespace ssimu2{
+
+const float weights[108] = {
+    0.0f,
+    0.0007376606707406586f,
+    0.0f,
+    0.0f,
+    0.0007793481682867309f,
+    0.0f,
+    0.0f,
+    0.0004371155730107379f,
+    0.0f,
+    1.1041726426657346f,
+    0.00066284834129271f,
+    0.00015231632783718752f,
+    0.0f,
+    0.0016406437456599754f,
+    0.0f,
+    1.8422455520539298f,
+    11.441172603757666f,
+    0.0f,
+    0.0007989109436015163f,
+    0.000176816438078653f,
+    0.0f,
+    1.8787594979546387f,
+    10.94906990605142f,
+    0.0f,
+    0.0007289346991508072f,
+    0.9677937080626833f,
+    0.0f,
+    0.00014003424285435884f,
+    0.9981766977854967f,
+    0.00031949755934435053f,
+    0.0004550992113792063f,
+    0.0f,
+    0.0f,
+    0.0013648766163243398f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    7.466890328078848f,
+    0.0f,
+    17.445833984131262f,
+    0.0006235601634041466f,
+    0.0f,
+    0.0f,
+    6.683678146179332f,
+    0.00037724407979611296f,
+    1.027889937768264f,
+    225.20515300849274f,
+    0.0f,
+    0.0f,
+    19.213238186143016f,
+    0.0011401524586618361f,
+    0.001237755635509985f,
+    176.39317598450694f,
+    0.0f,
+    0.0f,
+    24.43300999870476f,
+    0.28520802612117757f,
+    0.0004485436923833408f,
+    0.0f,
+    0.0f,
+    0.0f,
+    34.77906344483772f,
+    44.835625328877896f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0008680556573291698f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0005313191874358747f,
+    0.0f,
+    0.00016533814161379112f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0004179171803251336f,
+    0.0017290828234722833f,
+    0.0f,
+    0.0020827005846636437f,
+    0.0f,
+    0.0f,
+    8.826982764996862f,
+    23.19243343998926f,
+    0.0f,
+    95.1080498811086f,
+    0.9863978034400682f,
+    0.9834382792465353f,
+    0.0012286405048278493f,
+    171.2667255897307f,
+    0.9807858872435379f,
+    0.0f,
+    0.0f,
+    0.0f,
+    0.0005130064588990679f,
+    0.0f,
+    0.00010854057858411537f,
+};
+
+//Every weight and every term is non negative and the score decreases when the weighted sum grows.
+//final_score of the terms of some scales with the others left at 0 is therefore an upper bound of the
+//full score (float rounding keeps the order of the sums), which is what threshold queries rely on.
+double final_score(const std::vector<float> &scores){
+    //score has to be of size 108
+    float ssim = 0.0f;
+    for (int i = 0; i < 108; i++){
+        ssim = std::fma(weights[i], scores[i], ssim);
+    }
+    ssim *= 0.9562382616834844;
+    ssim = (6.248496625763138e-5 * ssim * ssim) * ssim +
+        2.326765642916932 * ssim -
+        0.020884521182843837 * ssim * ssim;
+    
+    if (ssim > 0.0) {
+        ssim = std::pow((double)ssim, 0.6276336467831387) * -10.0 + 100.0;
+    } else {
+        ssim = 100.0f;
+    }
+
+    return ssim;
+}
+
+//Answer of a threshold query (is the score at least threshold?). The full resolution scale, about 3/4 of
+//the work, is only computed when the 5 coarser ones leave the score above the threshold. When they do
+//not, score is the upper bound they give (below the threshold) and exact is false. The unknown terms
+//have no upper bound tight enough to also decide passing frames early.
+struct ThresholdResult{
+    double score;
+    bool pass;
+    bool exact;
+};
+
+}
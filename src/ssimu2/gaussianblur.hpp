@@ -4,6 +4,7 @@ class GaussianHandle {
 public:
     void init(sycl::queue& q) {
         float gaussiankernel[4*GAUSSIANSIZE+3];
+        gaussiankernel[2*GAUSSIANSIZE+1] = 0.0f; //integral[0], only differences are used but it must not be garbage
 
         for (int i = 0; i < 2*GAUSSIANSIZE+1; i++) {
             gaussiankernel[i] = std::exp(-(GAUSSIANSIZE-i)*(GAUSSIANSIZE-i) /
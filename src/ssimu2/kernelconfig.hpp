@@ -0,0 +1,122 @@
+#pragma once
+
+#include <fstream>
+#include <filesystem>
+
+namespace ssimu2{
+
+//work-group sizes of the tunable kernels. allscore_map_Kernel is not part of it:
+//its 32x32 shared tile for the gaussian blur only works with 16x16 work-groups
+struct KernelConfig{
+    int64_t organizer_threads = 256; //memoryorganizer
+    int64_t pointwise_threads = 256; //rgb_to_linear and rgb_to_positive_xyb
+    int64_t downsample_x = 16;
+    int64_t downsample_y = 16;
+    int64_t reduce_threads = 1024; //upper bound, local memory size can lower it
+};
+
+//the tuning file holds one line per device/driver/resolution:
+//{device name}\t{driver version}\t{width}\t{height}\t{organizer} {pointwise} {downsample_x} {downsample_y} {reduce}
+std::string tuningFilePath(){
+    const char* env = std::getenv("VSCYCLE_TUNING_FILE");
+    if (env != NULL) return env;
+    const std::string dir = helper::cacheDirectory();
+    if (dir.empty()) return "";
+    return (std::filesystem::path(dir) / "ssimu2_tuning.txt").string();
+}
+
+std::string tuningKey(const sycl::device& dev, int64_t width, int64_t height){
+    std::stringstream ss;
+    ss << dev.get_info<sycl::info::device::name>() << '\t' << dev.get_info<sycl::info::device::driver_version>() << '\t' << width << '\t' << height << '\t';
+    return ss.str();
+}
+
+//results tuned in this process, used even if the tuning file could not be written
+std::vector<std::pair<std::string, KernelConfig>>& tunedInProcess(){
+    static std::vector<std::pair<std::string, KernelConfig>> tuned;
+    return tuned;
+}
+
+std::mutex& tuningLock(){
+    static std::mutex lock;
+    return lock;
+}
+
+bool validKernelConfig(const sycl::device& dev, const KernelConfig& config){
+    const int64_t maxgroup = dev.get_info<sycl::info::device::max_work_group_size>();
+    return config.organizer_threads > 0 && config.organizer_threads <= maxgroup
+        && config.pointwise_threads > 0 && config.pointwise_threads <= maxgroup
+        && config.downsample_x > 0 && config.downsample_y > 0 && config.downsample_x*config.downsample_y <= maxgroup
+        && config.reduce_threads >= 32 && config.reduce_threads <= maxgroup;
+}
+
+//returns false and leaves out untouched if this device/resolution was never tuned
+bool loadKernelConfig(const sycl::device& dev, int64_t width, int64_t height, KernelConfig& out){
+    const std::string key = tuningKey(dev, width, height);
+    std::lock_guard<std::mutex> guard(tuningLock());
+
+    for (const auto& [tunedkey, config] : tunedInProcess()){
+        if (tunedkey == key){
+            out = config;
+            return true;
+        }
+    }
+
+    const std::string path = tuningFilePath();
+    if (path.empty()) return false;
+    std::ifstream file(path);
+    if (!file) return false;
+
+    std::string line;
+    while (std::getline(file, line)){
+        if (line.compare(0, key.size(), key) != 0) continue;
+        std::stringstream ss(line.substr(key.size()));
+        KernelConfig config;
+        if (!(ss >> config.organizer_threads >> config.pointwise_threads >> config.downsample_x >> config.downsample_y >> config.reduce_threads)) continue;
+        if (!validKernelConfig(dev, config)) continue;
+        out = config;
+        return true;
+    }
+    return false;
+}
+
+//returns false if the file could not be written
+bool saveKernelConfig(const sycl::device& dev, int64_t width, int64_t height, const KernelConfig& config){
+    const std::string key = tuningKey(dev, width, height);
+    std::lock_guard<std::mutex> guard(tuningLock());
+
+    auto& tuned = tunedInProcess();
+    tuned.erase(std::remove_if(tuned.begin(), tuned.end(), [&](const auto& el){return el.first == key;}), tuned.end());
+    tuned.emplace_back(key, config);
+
+    const std::string path = tuningFilePath();
+    if (path.empty()) return false;
+
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(path);
+        std::string line;
+        while (file && std::getline(file, line)){
+            if (!line.empty() && line.compare(0, key.size(), key) != 0) lines.push_back(line);
+        }
+    }
+    std::stringstream newline;
+    newline << key << config.organizer_threads << ' ' << config.pointwise_threads << ' ' << config.downsample_x << ' ' << config.downsample_y << ' ' << config.reduce_threads;
+    lines.push_back(newline.str());
+
+    //write aside then rename so that a concurrent reader never sees half a file
+    std::error_code ec;
+    const std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+    const std::string tmppath = path + ".tmp";
+    {
+        std::ofstream file(tmppath, std::ios_base::out | std::ios_base::trunc);
+        if (!file) return false;
+        for (const auto& line : lines) file << line << '\n';
+        if (!file) return false;
+    }
+    std::filesystem::rename(tmppath, path, ec);
+    return !ec;
+}
+
+}
@@ -4,10 +4,13 @@
 #include "../util/gpuhelper.hpp"
 #include "../util/float3operations.hpp"
 #include "../util/concurrency.hpp"
+#include "../util/kerneltrace.hpp"
 #include "makeXYB.hpp"
 #include "downsample.hpp"
 #include "gaussianblur.hpp"
 #include "score.hpp"
+#include "cpukernels.hpp"
+#include "kernelconfig.hpp"
 
 namespace ssimu2{
 
@@ -19,15 +22,15 @@ static void memoryorganizer(sycl::float3* out,
                     int64_t stride,
                     int64_t width,
                     int64_t height,
-                    sycl::queue& q)
+                    sycl::queue& q,
+                    int64_t threads = 256)
 {
     const int64_t total = width * height;
 
-    // Keep your 256-thread work-group size
-    const size_t local_size = std::min<int64_t>(256, total);
+    const size_t local_size = std::min<int64_t>(threads, total);
     const size_t global_size = ((total + local_size - 1) / local_size) * local_size;
 
-    q.submit([&](sycl::handler& h) {
+    helper::traceCommand("memoryorganizer", q, q.submit([&](sycl::handler& h) {
         h.parallel_for(
             sycl::nd_range<1>(sycl::range<1>(global_size),
                             sycl::range<1>(local_size)),
@@ -43,7 +46,7 @@ static void memoryorganizer(sycl::float3* out,
                 out[i * width + j].z() = convertPointer<T>(srcp2, i, j, stride);
             }
         );
-    });
+    }));
 }
 
 int64_t getTotalScaleSize(int64_t width, int64_t height){
@@ -58,47 +61,79 @@ int64_t getTotalScaleSize(int64_t width, int64_t height){
 
 //expects packed linear RGB input. Beware that each src1_d, src2_d and temp_d must be of size "totalscalesize" even if the actual image is contained in a width*height format
 // src_1_d src_2_d and temp_d all are on the GPU
-double ssimu2GPUProcess(sycl::float3* src1_d, sycl::float3* src2_d, sycl::float3* temp_d, sycl::float3* pinned, int64_t width, int64_t height, GaussianHandle& gaussianhandle, int64_t maxshared, sycl::queue& q){
+//with a threshold, the full resolution scale is skipped when the others already put the score below it: the upper bound they give is returned and *exact set to false
+//reference_ready: src1_d already holds the positive XYB pyramid of the reference (stored features).
+//reference_out (host, totalscalesize float3) receives that pyramid otherwise
+double ssimu2GPUProcess(sycl::float3* src1_d, sycl::float3* src2_d, sycl::float3* temp_d, sycl::float3* pinned, int64_t width, int64_t height, GaussianHandle& gaussianhandle, int64_t maxshared, const KernelConfig& config, sycl::queue& q, double threshold = -INFINITY, bool* exact = nullptr, helper::StageTimes* times = nullptr, bool reference_ready = false, void* reference_out = nullptr){
     const int64_t totalscalesize = getTotalScaleSize(width, height);
+    //CPU devices emulate work-groups and barriers, they get the barrier-free variants
+    const bool cpudevice = q.get_device().is_cpu();
     //step 1 : fill the downsample part
     int64_t nw = width;
     int64_t nh = height;
     int64_t index = 0;
     for (int scale = 1; scale <= 5; scale++){
-        downsample(src1_d+index, src1_d+index+nw*nh, nw, nh, q);
-        downsample(src2_d+index, src2_d+index+nw*nh, nw, nh, q);
+        if (cpudevice){
+            if (!reference_ready) downsample_cpu(src1_d+index, src1_d+index+nw*nh, nw, nh, q);
+            downsample_cpu(src2_d+index, src2_d+index+nw*nh, nw, nh, q);
+        } else {
+            if (!reference_ready) downsample(src1_d+index, src1_d+index+nw*nh, nw, nh, q, config.downsample_x, config.downsample_y);
+            downsample(src2_d+index, src2_d+index+nw*nh, nw, nh, q, config.downsample_x, config.downsample_y);
+        }
         index += nw*nh;
         nw = (nw -1)/2 + 1;
         nh = (nh - 1)/2 + 1;
     }
 
     //step 2 : positive XYB transition
-    rgb_to_positive_xyb(src1_d, totalscalesize, q);
-    rgb_to_positive_xyb(src2_d, totalscalesize, q);
+    if (!reference_ready) rgb_to_positive_xyb(src1_d, totalscalesize, q, config.pointwise_threads);
+    rgb_to_positive_xyb(src2_d, totalscalesize, q, config.pointwise_threads);
+    if (reference_out) helper::traceCommand("download", q, q.memcpy(reference_out, src1_d, sizeof(sycl::float3)*totalscalesize));
 
     //step 4 : ssim map
     
     //step 5 : edge diff map    
-    std::vector<sycl::float3> allscore_res = allscore_map(src1_d, src2_d, temp_d, pinned, width, height, maxshared, gaussianhandle, q);
-    
+    auto scoremaps = [&](int first_scale, int end_scale){
+        return cpudevice
+            ? allscore_map_cpu(src1_d, src2_d, temp_d, pinned, width, height, gaussianhandle, q, first_scale, end_scale, times)
+            : allscore_map(src1_d, src2_d, temp_d, pinned, width, height, maxshared, gaussianhandle, q, config.reduce_threads, first_scale, end_scale, times);
+    };
 
     //step 6 : format the vector
-    std::vector<f32> measure_vec(108);
-
-    for (int plane = 0; plane < 3; plane++) {
-        for (int scale = 0; scale < 6; scale++) {
-            for (int n = 0; n < 2; n++) {
-                for (int i = 0; i < 3; i++) {
-                    if (plane == 0) measure_vec[plane*6*2*3 + scale*2*3 + n*3 + i] = allscore_res[scale*2*3 + i*2 + n].x();
-                    if (plane == 1) measure_vec[plane*6*2*3 + scale*2*3 + n*3 + i] = allscore_res[scale*2*3 + i*2 + n].y();
-                    if (plane == 2) measure_vec[plane*6*2*3 + scale*2*3 + n*3 + i] = allscore_res[scale*2*3 + i*2 + n].z();
+    auto measures = [](const std::vector<sycl::float3>& allscore_res){
+        std::vector<f32> measure_vec(108);
+
+        for (int plane = 0; plane < 3; plane++) {
+            for (int scale = 0; scale < 6; scale++) {
+                for (int n = 0; n < 2; n++) {
+                    for (int i = 0; i < 3; i++) {
+                        if (plane == 0) measure_vec[plane*6*2*3 + scale*2*3 + n*3 + i] = allscore_res[scale*2*3 + i*2 + n].x();
+                        if (plane == 1) measure_vec[plane*6*2*3 + scale*2*3 + n*3 + i] = allscore_res[scale*2*3 + i*2 + n].y();
+                        if (plane == 2) measure_vec[plane*6*2*3 + scale*2*3 + n*3 + i] = allscore_res[scale*2*3 + i*2 + n].z();
+                    }
                 }
             }
         }
+        return measure_vec;
+    };
+
+    std::vector<sycl::float3> allscore_res;
+    if (threshold == -INFINITY){
+        allscore_res = scoremaps(0, 6);
+    } else {
+        //coarse scales first, see final_score for why they bound the score
+        allscore_res = scoremaps(1, 6);
+        const double bound = final_score(measures(allscore_res));
+        if (bound < threshold){
+            *exact = false;
+            return bound;
+        }
+        const std::vector<sycl::float3> fullres = scoremaps(0, 1);
+        for (int k = 0; k < 6; k++) allscore_res[k] = fullres[k];
     }
 
     //step 7 : enjoy !
-    f32 res = final_score(measure_vec);
+    f32 res = final_score(measures(allscore_res));
 
     //hipEventRecord(event_d, stream); //place an event in the stream at the end of all our operations
     //hipEventSynchronize(event_d); //when the event is complete, we know our gpu result is ready!
@@ -107,10 +142,17 @@ double ssimu2GPUProcess(sycl::float3* src1_d, sycl::float3* src2_d, sycl::float3
 }
 
 template <InputMemType T>
-double ssimu2process(const uint8_t *srcp1[3], const uint8_t *srcp2[3], sycl::float3* pinned, int64_t stride, int64_t width, int64_t height, GaussianHandle& gaussianhandle, int64_t maxshared, sycl::queue& stream){
+//times needs a queue created with enable_profiling. reference_in (host, totalscalesize float3 stored by
+//reference_out of an earlier run) replaces srcp1, which is then not read
+double ssimu2process(const uint8_t *srcp1[3], const uint8_t *srcp2[3], sycl::float3* pinned, int64_t stride, int64_t width, int64_t height, GaussianHandle& gaussianhandle, int64_t maxshared, const KernelConfig& config, sycl::queue& stream, double threshold = -INFINITY, bool* exact = nullptr, helper::StageTimes* times = nullptr, const void* reference_in = nullptr, void* reference_out = nullptr){
+    const auto start = std::chrono::steady_clock::now();
+    if (times) *times = {};
+    std::vector<sycl::event> uploads;
     // bytes needed for the three-plane staging area vs. a float3 buffer of totalscalesize
     const int64_t totalscalesize = getTotalScaleSize(width, height);
     const size_t plane_bytes = static_cast<size_t>(stride) * static_cast<size_t>(height);
+    //the last row stops at width: a plane may be a region of a larger frame whose stride goes past its end
+    const size_t copy_bytes = plane_bytes - static_cast<size_t>(stride) + static_cast<size_t>(width) * (T == FLOAT ? 4 : 2);
     const size_t three_planes = plane_bytes * 3;
     const size_t float3_block = sizeof(sycl::float3) * static_cast<size_t>(totalscalesize);
 
@@ -126,24 +168,28 @@ double ssimu2process(const uint8_t *srcp1[3], const uint8_t *srcp2[3], sycl::flo
     } catch (...) {
         VSHIP_THROW(OutOfVRAM);
     }
+    helper::deviceBytesInUse() += total_bytes;
 
     auto* src1_d = reinterpret_cast<sycl::float3*>(mem);
     auto* src2_d = reinterpret_cast<sycl::float3*>(mem + float3_block);
     unsigned char* temp_bytes = mem + 2 * float3_block;              // scratch base (bytes)
     void* temp_scratch_for_gpu = static_cast<void*>(temp_bytes);     // pass-through scratch
 
-    // Stage the three host planes for src1 into device scratch
-    {
+    if (reference_in) {
+        //stored XYB pyramid of the reference, nothing left to compute for it but its blurred moments
+        uploads.push_back(helper::traceCommand("upload", stream, stream.memcpy(src1_d, reference_in, float3_block)));
+    } else {
+        // Stage the three host planes for src1 into device scratch
         uint8_t* p0 = temp_bytes;
         uint8_t* p1 = temp_bytes + 1 * plane_bytes;
         uint8_t* p2 = temp_bytes + 2 * plane_bytes;
 
-        stream.memcpy(p0, srcp1[0], plane_bytes);
-        stream.memcpy(p1, srcp1[1], plane_bytes);
-        stream.memcpy(p2, srcp1[2], plane_bytes);
+        uploads.push_back(helper::traceCommand("upload", stream, stream.memcpy(p0, srcp1[0], copy_bytes)));
+        uploads.push_back(helper::traceCommand("upload", stream, stream.memcpy(p1, srcp1[1], copy_bytes)));
+        uploads.push_back(helper::traceCommand("upload", stream, stream.memcpy(p2, srcp1[2], copy_bytes)));
         
         // Convert staged planes → interleaved/float3 RGB into src1_d
-        memoryorganizer<T>(src1_d, p0, p1, p2, stride, width, height, stream);
+        memoryorganizer<T>(src1_d, p0, p1, p2, stride, width, height, stream, config.organizer_threads);
     }
 
     // Stage the three host planes for src2 into the same device scratch (reused)
@@ -152,36 +198,45 @@ double ssimu2process(const uint8_t *srcp1[3], const uint8_t *srcp2[3], sycl::flo
         uint8_t* p1 = temp_bytes + 1 * plane_bytes;
         uint8_t* p2 = temp_bytes + 2 * plane_bytes;
 
-        stream.memcpy(p0, srcp2[0], plane_bytes);
-        stream.memcpy(p1, srcp2[1], plane_bytes);
-        stream.memcpy(p2, srcp2[2], plane_bytes);
+        uploads.push_back(helper::traceCommand("upload", stream, stream.memcpy(p0, srcp2[0], copy_bytes)));
+        uploads.push_back(helper::traceCommand("upload", stream, stream.memcpy(p1, srcp2[1], copy_bytes)));
+        uploads.push_back(helper::traceCommand("upload", stream, stream.memcpy(p2, srcp2[2], copy_bytes)));
 
-        memoryorganizer<T>(src2_d, p0, p1, p2, stride, width, height, stream);
+        memoryorganizer<T>(src2_d, p0, p1, p2, stride, width, height, stream, config.organizer_threads);
     }
 
     // Colorspace
-    rgb_to_linear(src1_d, totalscalesize, stream);
-    rgb_to_linear(src2_d, totalscalesize, stream);
+    if (!reference_in) rgb_to_linear(src1_d, totalscalesize, stream, config.pointwise_threads);
+    rgb_to_linear(src2_d, totalscalesize, stream, config.pointwise_threads);
 
     double res;
     try {
-        res = ssimu2GPUProcess(src1_d, src2_d, (sycl::float3*)(temp_bytes), pinned, width, height, gaussianhandle, maxshared, stream);
+        res = ssimu2GPUProcess(src1_d, src2_d, (sycl::float3*)(temp_bytes), pinned, width, height, gaussianhandle, maxshared, config, stream, threshold, exact, times, reference_in != nullptr, reference_out);
     } catch (const VshipError& e){
-        sycl::free(temp_bytes, stream);
+        stream.wait();
+        sycl::free(mem, stream);
+        helper::deviceBytesInUse() -= total_bytes;
         throw e;
     }
 
     // Make sure all enqueued ops that might touch 'mem' are done before free
     stream.wait_and_throw();
     sycl::free(mem, stream);
+    helper::deviceBytesInUse() -= total_bytes;
+
+    if (times){
+        for (const sycl::event& upload : uploads) times->upload += helper::eventNanoseconds(upload);
+        times->compute = helper::elapsedNanoseconds(start, std::chrono::steady_clock::now()) - times->upload - times->reduce;
+    }
     
     return res;
 }
 
 class SSIMU2ComputingImplementation{
 public:
-    SSIMU2ComputingImplementation(int64_t w, int64_t h, int device_id) 
-    : stream(sycl::device::get_devices(sycl::info::device_type::gpu)[device_id], sycl::property::queue::in_order{}) 
+    //profiling creates the queue with enable_profiling, needed by setStageTimes
+    SSIMU2ComputingImplementation(int64_t w, int64_t h, int device_id, bool profiling = false) 
+    : stream(helper::getDevices()[device_id], helper::queueProperties(profiling))
     {
         width = w;
         height = h;
@@ -192,13 +247,23 @@ public:
         auto dev = stream.get_device();
         maxshared = dev.get_info<sycl::info::device::local_mem_size>();
 
+        //work-group sizes found by a previous autotune run on this device, defaults otherwise
+        loadKernelConfig(dev, width, height, config);
+
         // Allocate pinned host memory (USM host). Many backends pin this.
-        const int64_t pinnedsize = allocsizeScore(width, height, maxshared);
+        const int64_t pinnedsize = dev.is_cpu() ? allocsizeScoreCPU(width, height) : allocsizeScore(width, height, maxshared, config.reduce_threads);
         pinned = sycl::malloc_host<sycl::float3>(static_cast<size_t>(pinnedsize), stream);
         if (!pinned) {
             gaussianhandle.destroy(stream);
             VSHIP_THROW(OutOfRAM);
         }
+
+        try {
+            helper::runOncePerDevice(dev, [&](){ warmup(); });
+        } catch (...) {
+            destroy();
+            throw;
+        }
     }
 
     void destroy() {
@@ -206,14 +271,69 @@ public:
         sycl::free(pinned, stream);
     }
 
+    //every following run writes its stage durations there (nullptr to stop), needs the profiling constructor
+    void setStageTimes(helper::StageTimes* times){
+        stage_times = times;
+    }
+
+    //Reference features of one frame: its positive XYB pyramid as the device holds it (totalscalesize float3,
+    //padding included). Given back to runWithReference they replace the decoded reference. Not the layout
+    //of the native backend, whose features also hold the blurred moments.
+    static int64_t referenceFeatureSize(int64_t w, int64_t h){
+        return getTotalScaleSize(w, h)*(int64_t)(sizeof(sycl::float3)/sizeof(float));
+    }
+
+    int64_t referenceFeatureSize() const {
+        return referenceFeatureSize(width, height);
+    }
+
+    //features_out (referenceFeatureSize floats) receives the reference features of srcp1 if not null
     template <InputMemType T>
-    double run(const uint8_t* srcp1[3], const uint8_t* srcp2[3], int64_t stride){
-        return ssimu2process<T>(srcp1, srcp2, pinned, stride, width, height, gaussianhandle, maxshared, stream);
+    double run(const uint8_t* srcp1[3], const uint8_t* srcp2[3], int64_t stride, float* features_out = nullptr){
+        return ssimu2process<T>(srcp1, srcp2, pinned, stride, width, height, gaussianhandle, maxshared, config, stream, -INFINITY, nullptr, stage_times, nullptr, features_out);
+    }
+
+    //same score as run, with the reference given by the features stored by an earlier run
+    template <InputMemType T>
+    double runWithReference(const float* features, const uint8_t* srcp2[3], int64_t stride){
+        return ssimu2process<T>(nullptr, srcp2, pinned, stride, width, height, gaussianhandle, maxshared, config, stream, -INFINITY, nullptr, stage_times, features);
+    }
+
+    //whether the score is at least threshold, see ThresholdResult
+    template <InputMemType T>
+    ThresholdResult runThreshold(const uint8_t* srcp1[3], const uint8_t* srcp2[3], int64_t stride, double threshold){
+        bool exact = true;
+        const double score = ssimu2process<T>(srcp1, srcp2, pinned, stride, width, height, gaussianhandle, maxshared, config, stream, threshold, &exact, stage_times);
+        return {score, score >= threshold, exact};
+    }
+
+    template <InputMemType T>
+    ThresholdResult runWithReferenceThreshold(const float* features, const uint8_t* srcp2[3], int64_t stride, double threshold){
+        bool exact = true;
+        const double score = ssimu2process<T>(nullptr, srcp2, pinned, stride, width, height, gaussianhandle, maxshared, config, stream, threshold, &exact, stage_times, features);
+        return {score, score >= threshold, exact};
     }
 
 private:
+    //runs every kernel variant once on a small zero frame so that the device image gets built
+    //(or loaded from the persistent kernel cache) now instead of during the first real frame.
+    //256x256 is the smallest size that also goes through the multi stage reduction
+    void warmup(){
+        const int64_t w = std::min<int64_t>(width, 256);
+        const int64_t h = std::min<int64_t>(height, 256);
+        const int64_t warmstride = w*sizeof(float);
+        std::vector<uint8_t> zeros(warmstride*h, 0);
+        const uint8_t* planes[3] = {zeros.data(), zeros.data(), zeros.data()};
+
+        ssimu2process<UINT16>(planes, planes, pinned, warmstride, w, h, gaussianhandle, maxshared, config, stream);
+        ssimu2process<HALF>(planes, planes, pinned, warmstride, w, h, gaussianhandle, maxshared, config, stream);
+        ssimu2process<FLOAT>(planes, planes, pinned, warmstride, w, h, gaussianhandle, maxshared, config, stream);
+    }
+
     sycl::queue stream;
+    helper::StageTimes* stage_times = nullptr;
     GaussianHandle gaussianhandle;
+    KernelConfig config;
     sycl::float3* pinned;
     int64_t width;
     int64_t height;
@@ -69,14 +69,14 @@ inline void rgb_to_linrgb(sycl::float3& a){
     rgb_to_linrgbfunc(a.z());
 }
 
-void rgb_to_positive_xyb(sycl::float3* array, int64_t width, sycl::queue& q) {
-    int64_t th_x = std::min<int64_t>(256, width);
+void rgb_to_positive_xyb(sycl::float3* array, int64_t width, sycl::queue& q, int64_t threads = 256) {
+    int64_t th_x = std::min<int64_t>(threads, width);
     int64_t bl_x = (width - 1) / th_x + 1;
 
     sycl::range<1> local(th_x);          // threads per work-group
     sycl::range<1> global(bl_x * th_x);  // total threads
 
-    q.submit([&](sycl::handler& h) {
+    helper::traceCommand("rgb_to_positive_xyb", q, q.submit([&](sycl::handler& h) {
         h.parallel_for(
             sycl::nd_range<1>(global, local),
             [=](sycl::nd_item<1> item) {
@@ -85,17 +85,17 @@ void rgb_to_positive_xyb(sycl::float3* array, int64_t width, sycl::queue& q) {
 
                 rgb_to_positive_xyb_d(array[x]);
             });
-    });
+    }));
 }
 
-inline void rgb_to_linear(sycl::float3* array, int64_t width, sycl::queue &stream){
-    int64_t th_x = std::min<int64_t>(256, width);
+inline void rgb_to_linear(sycl::float3* array, int64_t width, sycl::queue &stream, int64_t threads = 256){
+    int64_t th_x = std::min<int64_t>(threads, width);
     int64_t bl_x = (width - 1) / th_x + 1;
 
     sycl::range<1> local(th_x);          // threads per work-group
     sycl::range<1> global(bl_x * th_x);  // total threads
 
-    stream.submit([&](sycl::handler& h) {
+    helper::traceCommand("rgb_to_linear", stream, stream.submit([&](sycl::handler& h) {
         h.parallel_for(
             sycl::nd_range<1>(global, local),
             [=](sycl::nd_item<1> item) {
@@ -104,6 +104,6 @@ inline void rgb_to_linear(sycl::float3* array, int64_t width, sycl::queue &strea
 
                 rgb_to_linrgb(array[x]);
             });
-    });
+    }));
 }
 #endif
\ No newline at end of file
@@ -1,8 +1,16 @@
 #include <math.h>
+#include "finalscore.hpp"
+#include "../util/stagetimes.hpp"
 
 namespace ssimu2{
 
-int64_t allocsizeScore(int64_t width, int64_t height, int maxshared){
+//work-group size of the reduction stages: bounded by maxthreads and by the local memory holding 6 float3 per thread
+//allocsizeScore and allscore_map must agree on it, otherwise the pinned buffer is sized for the wrong number of partial sums
+int64_t reduceThreads(int64_t maxshared, int64_t blr_x, int64_t maxthreads){
+    return sycl::min((int64_t)(maxshared/(6*sizeof(sycl::float3)))/32*32, sycl::min(maxthreads, blr_x));
+}
+
+int64_t allocsizeScore(int64_t width, int64_t height, int maxshared, int64_t reducethreads = 1024){
     int64_t w = width;
     int64_t h = height;
     int64_t th_x, th_y, bl_x, bl_y;
@@ -13,10 +21,7 @@ int64_t allocsizeScore(int64_t width, int64_t height, int maxshared){
         bl_x = (w-1)/th_x + 1;
         bl_y = (h-1)/th_y + 1;
         bl_x = bl_x*bl_y; //convert to linear
-        th_x = 0;
-        if (maxshared != 0) {
-            th_x = sycl::min<int64_t>(maxshared/(6*sizeof(sycl::float3)/32*32), (int64_t)sycl::min((int64_t)1024, bl_x));    
-        }
+        th_x = reduceThreads(maxshared, bl_x, reducethreads);
         
         while (bl_x >= 256){
             bl_x = (bl_x -1)/th_x + 1;
@@ -55,7 +60,7 @@ void allscore_map_Kernel(
     const size_t local_elems_for_sharedmem = 32 * 32;
     const size_t shared_elems = sycl::max(local_elems_for_reduce, local_elems_for_sharedmem);
 
-    q.submit([&](sycl::handler &h) {
+    helper::traceCommand("allscore_map_Kernel", q, q.submit([&](sycl::handler &h) {
         // one local buffer used both for the 6*threadnum reduction arrays
         // and (at the same time) as a 32x32 sharedmem for GaussianSmart* helpers.
         sycl::local_accessor<sycl::float3, 1> sharedmem(sycl::range<1>(shared_elems), h);
@@ -179,10 +184,78 @@ void allscore_map_Kernel(
                 }
             } // end parallel_for
         ); // end submit
-    }); // end q.submit
+    })); // end q.submit
+}
+
+//one stage of the reduction of the per-block sums of allscore_map_Kernel: the 6 arrays of count values
+//at src become 6 arrays of (count-1)/th_x+1 values at dst
+void sumreduce_Kernel(sycl::queue& stream, sycl::float3* dst_ptr, const sycl::float3* src_ptr, int64_t oldblr_x, int64_t th_x){
+    const int64_t blr_x = (oldblr_x - 1) / th_x + 1;
+    sycl::range<1> local(th_x);
+    sycl::range<1> global(blr_x * th_x);
+
+    helper::traceCommand("sumreduce", stream, stream.submit([&](sycl::handler& h) {
+        sycl::local_accessor<sycl::float3, 1> smem(sycl::range<1>(6 * th_x), h);
+
+        h.parallel_for(
+            sycl::nd_range<1>(global, local),
+            [=](sycl::nd_item<1> it) {
+                const int64_t x       = it.get_global_linear_id();
+                const int64_t th      = it.get_local_linear_id();
+                const int64_t threads = it.get_local_range(0);
+                const int64_t block   = it.get_group_linear_id();
+                const int64_t blocks  = it.get_group_range(0);
+
+                sycl::float3* shm = smem.get_multi_ptr<sycl::access::decorated::no>().get();
+                sycl::float3* s1 = shm;
+                sycl::float3* s4 = s1 + threads;
+                sycl::float3* a1 = s4 + threads;
+                sycl::float3* a4 = a1 + threads;
+                sycl::float3* d1 = a4 + threads;
+                sycl::float3* d4 = d1 + threads;
+
+                if (x >= oldblr_x) {
+                    zeroVec(s1[th]); zeroVec(s4[th]);
+                    zeroVec(a1[th]); zeroVec(a4[th]);
+                    zeroVec(d1[th]); zeroVec(d4[th]);
+                } else {
+                    s1[th] = src_ptr[x];
+                    s4[th] = src_ptr[x + oldblr_x];
+                    a1[th] = src_ptr[x + 2 * oldblr_x];
+                    a4[th] = src_ptr[x + 3 * oldblr_x];
+                    d1[th] = src_ptr[x + 4 * oldblr_x];
+                    d4[th] = src_ptr[x + 5 * oldblr_x];
+                }
+                it.barrier(sycl::access::fence_space::local_space);
+
+                for (int step = 1; step < threads; step <<= 1) {
+                    if (th + step < threads && (th % (step * 2) == 0)) {
+                        s1[th] += s1[th + step];
+                        s4[th] += s4[th + step];
+                        a1[th] += a1[th + step];
+                        a4[th] += a4[th + step];
+                        d1[th] += d1[th + step];
+                        d4[th] += d4[th + step];
+                    }
+                    it.barrier(sycl::access::fence_space::local_space);
+                }
+
+                if (th == 0) {
+                    dst_ptr[block] = s1[0];
+                    dst_ptr[1 * blocks + block] = s4[0];
+                    dst_ptr[2 * blocks + block] = a1[0];
+                    dst_ptr[3 * blocks + block] = a4[0];
+                    dst_ptr[4 * blocks + block] = d1[0];
+                    dst_ptr[5 * blocks + block] = d4[0];
+                }
+            }
+        );
+    }));
 }
 
-std::vector<sycl::float3> allscore_map(sycl::float3* im1, sycl::float3* im2, sycl::float3* temp, sycl::float3* pinned, int64_t basewidth, int64_t baseheight, int64_t maxshared, GaussianHandle& gaussianhandle, sycl::queue& stream){
+//only the scales in [first_scale, end_scale) are computed, the others stay at 0 in the output
+//times (profiling queues only) gets the copy back and the host reduction added to its reduce time
+std::vector<sycl::float3> allscore_map(sycl::float3* im1, sycl::float3* im2, sycl::float3* temp, sycl::float3* pinned, int64_t basewidth, int64_t baseheight, int64_t maxshared, GaussianHandle& gaussianhandle, sycl::queue& stream, int64_t reducethreads = 1024, int first_scale = 0, int end_scale = 6, helper::StageTimes* times = nullptr){
      // output is {normssim1scale1, normssim4scale1, ..., normd4scale3} (18 vec3 pairs)
     std::vector<sycl::float3> result(2 * 6 * 3);
     for (auto& v : result) { zeroVec(v); }
@@ -193,9 +266,15 @@ std::vector<sycl::float3> allscore_map(sycl::float3* im1, sycl::float3* im2, syc
     int64_t th_x, th_y;
     int64_t bl_x, bl_y;
     int64_t index = 0;
+    for (int scale = 0; scale < first_scale; scale++){
+        index += w*h;
+        w = (w-1)/2+1;
+        h = (h-1)/2+1;
+    }
     std::vector<int> scaleoutdone(7);
-    scaleoutdone[0] = 0;
-    for (int scale = 0; scale < 6; scale++){
+    scaleoutdone[first_scale] = 0;
+    for (int scale = first_scale; scale < end_scale; scale++){
+        //fixed: the 32x32 shared tile of the gaussian blur is laid out for 16x16 work-groups
         th_x = 16;
         th_y = 16;
         bl_x = (w-1)/th_x + 1;
@@ -214,7 +293,7 @@ std::vector<sycl::float3> allscore_map(sycl::float3* im1, sycl::float3* im2, syc
         //printf("I got %s with %ld %ld %ld\n", hipGetErrorString(hipGetLastError()), 6*sizeof(sycl::float3)*th_x*th_y, bl_x, bl_y);
         //GPU_CHECK(hipGetLastError());
 
-        th_x = sycl::min((int64_t)(maxshared/(6*sizeof(sycl::float3)))/32*32, sycl::min((int64_t)1024, blr_x));
+        th_x = reduceThreads(maxshared, blr_x, reducethreads);
         int oscillate = 0; //3 sets of memory: real destination at 0, first at 6*bl_x for oscillate 0 and last at 12*bl_x for oscillate 1;
         int64_t oldblr_x = blr_x;
         while (blr_x >= reduce_up_to){
@@ -226,69 +305,7 @@ std::vector<sycl::float3> allscore_map(sycl::float3* im1, sycl::float3* im2, syc
             sycl::float3* src_ptr =
                 temp + scaleoutdone[scale] + (oscillate + 1) * 6 * bl_x * bl_y;
 
-            // launch sumreduce for this stage
-            {
-                sycl::range<1> local(th_x);
-                sycl::range<1> global(blr_x * th_x);
-
-                stream.submit([&](sycl::handler& h) {
-                    sycl::local_accessor<sycl::float3, 1> smem(sycl::range<1>(6 * th_x), h);
-
-                    h.parallel_for(
-                        sycl::nd_range<1>(global, local),
-                        [=](sycl::nd_item<1> it) {
-                            const int64_t x       = it.get_global_linear_id();
-                            const int64_t th      = it.get_local_linear_id();
-                            const int64_t threads = it.get_local_range(0);
-                            const int64_t block   = it.get_group_linear_id();
-                            const int64_t blocks  = it.get_group_range(0);
-
-                            sycl::float3* shm = smem.get_multi_ptr<sycl::access::decorated::no>().get();
-                            sycl::float3* s1 = shm;
-                            sycl::float3* s4 = s1 + threads;
-                            sycl::float3* a1 = s4 + threads;
-                            sycl::float3* a4 = a1 + threads;
-                            sycl::float3* d1 = a4 + threads;
-                            sycl::float3* d4 = d1 + threads;
-
-                            if (x >= oldblr_x) {
-                                zeroVec(s1[th]); zeroVec(s4[th]);
-                                zeroVec(a1[th]); zeroVec(a4[th]);
-                                zeroVec(d1[th]); zeroVec(d4[th]);
-                            } else {
-                                s1[th] = src_ptr[x];
-                                s4[th] = src_ptr[x + oldblr_x];
-                                a1[th] = src_ptr[x + 2 * oldblr_x];
-                                a4[th] = src_ptr[x + 3 * oldblr_x];
-                                d1[th] = src_ptr[x + 4 * oldblr_x];
-                                d4[th] = src_ptr[x + 5 * oldblr_x];
-                            }
-                            it.barrier(sycl::access::fence_space::local_space);
-
-                            for (int step = 1; step < threads; step <<= 1) {
-                                if (th + step < threads && (th % (step * 2) == 0)) {
-                                    s1[th] += s1[th + step];
-                                    s4[th] += s4[th + step];
-                                    a1[th] += a1[th + step];
-                                    a4[th] += a4[th + step];
-                                    d1[th] += d1[th + step];
-                                    d4[th] += d4[th + step];
-                                }
-                                it.barrier(sycl::access::fence_space::local_space);
-                            }
-
-                            if (th == 0) {
-                                dst_ptr[block] = s1[0];
-                                dst_ptr[1 * blocks + block] = s4[0];
-                                dst_ptr[2 * blocks + block] = a1[0];
-                                dst_ptr[3 * blocks + block] = a4[0];
-                                dst_ptr[4 * blocks + block] = d1[0];
-                                dst_ptr[5 * blocks + block] = d4[0];
-                            }
-                        }
-                    );
-                });
-            }
+            sumreduce_Kernel(stream, dst_ptr, src_ptr, oldblr_x, th_x);
 
             oscillate ^= 1;
             oldblr_x = blr_x;
@@ -302,10 +319,12 @@ std::vector<sycl::float3> allscore_map(sycl::float3* im1, sycl::float3* im2, syc
     sycl::float3* hostback = pinned;
     //printf("I am sending : %llu %llu %lld %d", hostback, temp, sizeof(sycl::float3)*scaleoutdone[6], stream);
     //GPU_CHECK(hipMemcpyDtoHAsync(hostback, (hipDeviceptr_t)temp, sizeof(sycl::float3)*scaleoutdone[6], stream));
-    stream.memcpy(hostback, temp,  sizeof(sycl::float3)*scaleoutdone[6]).wait();
+    sycl::event download = helper::traceCommand("download", stream, stream.memcpy(hostback, temp,  sizeof(sycl::float3)*scaleoutdone[end_scale]));
+    download.wait();
+    const auto reduce_start = std::chrono::steady_clock::now();
 
     //let s reduce!
-    for (int scale = 0; scale < 6; scale++){
+    for (int scale = first_scale; scale < end_scale; scale++){
         bl_x = (scaleoutdone[scale+1] - scaleoutdone[scale])/6;
         for (int i = 0; i < 6*bl_x; i++){
             if (i < bl_x){
@@ -330,138 +349,8 @@ std::vector<sycl::float3> allscore_map(sycl::float3* im1, sycl::float3* im2, syc
         result[2*i+1].z() = sycl::sqrt(sycl::sqrt(result[2*i+1].z()));
     } //completing 4th norm
 
+    if (times) times->reduce += helper::eventNanoseconds(download) + helper::elapsedNanoseconds(reduce_start, std::chrono::steady_clock::now());
     return result;
 }
 
-const float weights[108] = {
-    0.0f,
-    0.0007376606707406586f,
-    0.0f,
-    0.0f,
-    0.0007793481682867309f,
-    0.0f,
-    0.0f,
-    0.0004371155730107379f,
-    0.0f,
-    1.1041726426657346f,
-    0.00066284834129271f,
-    0.00015231632783718752f,
-    0.0f,
-    0.0016406437456599754f,
-    0.0f,
-    1.8422455520539298f,
-    11.441172603757666f,
-    0.0f,
-    0.0007989109436015163f,
-    0.000176816438078653f,
-    0.0f,
-    1.8787594979546387f,
-    10.94906990605142f,
-    0.0f,
-    0.0007289346991508072f,
-    0.9677937080626833f,
-    0.0f,
-    0.00014003424285435884f,
-    0.9981766977854967f,
-    0.00031949755934435053f,
-    0.0004550992113792063f,
-    0.0f,
-    0.0f,
-    0.0013648766163243398f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    7.466890328078848f,
-    0.0f,
-    17.445833984131262f,
-    0.0006235601634041466f,
-    0.0f,
-    0.0f,
-    6.683678146179332f,
-    0.00037724407979611296f,
-    1.027889937768264f,
-    225.20515300849274f,
-    0.0f,
-    0.0f,
-    19.213238186143016f,
-    0.0011401524586618361f,
-    0.001237755635509985f,
-    176.39317598450694f,
-    0.0f,
-    0.0f,
-    24.43300999870476f,
-    0.28520802612117757f,
-    0.0004485436923833408f,
-    0.0f,
-    0.0f,
-    0.0f,
-    34.77906344483772f,
-    44.835625328877896f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0008680556573291698f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0005313191874358747f,
-    0.0f,
-    0.00016533814161379112f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0004179171803251336f,
-    0.0017290828234722833f,
-    0.0f,
-    0.0020827005846636437f,
-    0.0f,
-    0.0f,
-    8.826982764996862f,
-    23.19243343998926f,
-    0.0f,
-    95.1080498811086f,
-    0.9863978034400682f,
-    0.9834382792465353f,
-    0.0012286405048278493f,
-    171.2667255897307f,
-    0.9807858872435379f,
-    0.0f,
-    0.0f,
-    0.0f,
-    0.0005130064588990679f,
-    0.0f,
-    0.00010854057858411537f,
-};
-
-double final_score(const std::vector<float> &scores){
-    //score has to be of size 108
-    float ssim = 0.0f;
-    for (int i = 0; i < 108; i++){
-        ssim = sycl::fma(weights[i], scores[i], ssim);
-    }
-    ssim *= 0.9562382616834844;
-    ssim = (6.248496625763138e-5 * ssim * ssim) * ssim +
-        2.326765642916932 * ssim -
-        0.020884521182843837 * ssim * ssim;
-    
-    if (ssim > 0.0) {
-        ssim = sycl::pow((double)ssim, 0.6276336467831387) * -10.0 + 100.0;
-    } else {
-        ssim = 100.0f;
-    }
-
-    return ssim;
-}
-
 }
\ No newline at end of file
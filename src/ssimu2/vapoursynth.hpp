@@ -1,17 +1,33 @@
 #pragma once
 
 #include "torgbs.hpp"
+#ifndef VSHIP_NO_SYCL
 #include "main.hpp"
+#include "autotune.hpp"
+#endif
+#include "../ssimu2cpu/main.hpp"
 #include "../util/gpuhelper.hpp"
+#include "../util/concurrency.hpp"
 
 namespace ssimu2{
 
 typedef struct Ssimulacra2Data{
     VSNode *reference;
     VSNode *distorted;
+    bool cpu; //native implementation instead of the SYCL one
+#ifndef VSHIP_NO_SYCL
     SSIMU2ComputingImplementation* ssimu2Streams;
-    threadSet<int>* streamSet;
+#endif
+    ssimu2cpu::SSIMU2ComputingImplementation* cpuStreams;
+    BufferPool<int>* streamSet;
     int streamnum = 0;
+    bool use_threshold = false; //threshold argument given, frames also get _SSIMULACRA2_PASS
+    double threshold = 0;
+    //left, top, width and height arguments: only this region of the frames is scored, the whole frame by default
+    int64_t roi_left = 0;
+    int64_t roi_top = 0;
+    int64_t roi_width = 0;
+    int64_t roi_height = 0;
 } Ssimulacra2Data;
 
 static const VSFrame *VS_CC ssimulacra2GetFrame(int n, int activationReason, void *instanceData, void **frameData, VSFrameContext *frameCtx, VSCore *core, const VSAPI *vsapi) {
@@ -24,39 +40,56 @@ static const VSFrame *VS_CC ssimulacra2GetFrame(int n, int activationReason, voi
         const VSFrame *src1 = vsapi->getFrameFilter(n, d->reference, frameCtx);
         const VSFrame *src2 = vsapi->getFrameFilter(n, d->distorted, frameCtx);
         
-        int64_t height = vsapi->getFrameHeight(src1, 0);
-        int64_t width = vsapi->getFrameWidth(src1, 0);
         int64_t stride = vsapi->getStride(src1, 0);
+        //the region is read in place, through the stride of the whole frame
+        const int64_t roi_offset = d->roi_top*stride + d->roi_left*(int64_t)sizeof(float);
 
         VSFrame *dst = vsapi->copyFrame(src2, core);
 
         const uint8_t *srcp1[3] = {
-            vsapi->getReadPtr(src1, 0),
-            vsapi->getReadPtr(src1, 1),
-            vsapi->getReadPtr(src1, 2),
+            vsapi->getReadPtr(src1, 0) + roi_offset,
+            vsapi->getReadPtr(src1, 1) + roi_offset,
+            vsapi->getReadPtr(src1, 2) + roi_offset,
         };
 
         const uint8_t *srcp2[3] = {
-            vsapi->getReadPtr(src2, 0),
-            vsapi->getReadPtr(src2, 1),
-            vsapi->getReadPtr(src2, 2),
+            vsapi->getReadPtr(src2, 0) + roi_offset,
+            vsapi->getReadPtr(src2, 1) + roi_offset,
+            vsapi->getReadPtr(src2, 2) + roi_offset,
         };
 
         double val;
-        const int stream = d->streamSet->pop();
-        SSIMU2ComputingImplementation& ssimu2Stream = d->ssimu2Streams[stream];
+        ThresholdResult answer = {};
+        const int stream = d->streamSet->acquire();
         try{
-            val = ssimu2Stream.run<FLOAT>(srcp1, srcp2, stride);
+            if (d->use_threshold){
+                if (d->cpu){
+                    answer = d->cpuStreams[stream].runThreshold<FLOAT>(srcp1, srcp2, stride, d->threshold);
+                } else {
+#ifndef VSHIP_NO_SYCL
+                    answer = d->ssimu2Streams[stream].runThreshold<FLOAT>(srcp1, srcp2, stride, d->threshold);
+#endif
+                }
+                val = answer.score;
+            } else if (d->cpu){
+                val = d->cpuStreams[stream].run<FLOAT>(srcp1, srcp2, stride);
+            } else {
+#ifndef VSHIP_NO_SYCL
+                val = d->ssimu2Streams[stream].run<FLOAT>(srcp1, srcp2, stride);
+#endif
+            }
         } catch (const VshipError& e){
             vsapi->setFilterError(e.getErrorMessage().c_str(), frameCtx);
-            d->streamSet->insert(stream);
+            d->streamSet->release(stream);
             vsapi->freeFrame(src1);
             vsapi->freeFrame(src2);
             return NULL;
         }
-        d->streamSet->insert(stream);
+        d->streamSet->release(stream);
 
         vsapi->mapSetFloat(vsapi->getFramePropertiesRW(dst), "_SSIMULACRA2", val, maReplace);
+        //_SSIMULACRA2 of a frame decided from the coarse scales is an upper bound of its score
+        if (d->use_threshold) vsapi->mapSetInt(vsapi->getFramePropertiesRW(dst), "_SSIMULACRA2_PASS", answer.pass ? 1 : 0, maReplace);
 
         // Release the source frame
         vsapi->freeFrame(src1);
@@ -76,10 +109,22 @@ static void VS_CC ssimulacra2Free(void *instanceData, VSCore *core, const VSAPI
     vsapi->freeNode(d->reference);
     vsapi->freeNode(d->distorted);
 
-    for (int i = 0; i < d->streamnum; i++){
-        d->ssimu2Streams[i].destroy();
+    if (d->cpu){
+        for (int i = 0; i < d->streamnum; i++){
+            d->cpuStreams[i].destroy();
+            d->cpuStreams[i].~SSIMU2ComputingImplementation();
+        }
+        free(d->cpuStreams);
+    } else {
+#ifndef VSHIP_NO_SYCL
+        //the other instances may still be tracing, the file is only flushed
+        helper::KernelTrace::get().flush();
+        for (int i = 0; i < d->streamnum; i++){
+            d->ssimu2Streams[i].destroy();
+        }
+        free(d->ssimu2Streams);
+#endif
     }
-    free(d->ssimu2Streams);
     delete d->streamSet;
 
     free(d);
@@ -111,19 +156,62 @@ static void VS_CC ssimulacra2Create(const VSMap *in, VSMap *out, void *userData,
     }
 
     int error;
+    d.roi_left = vsapi->mapGetInt(in, "left", 0, &error);
+    if (error != peSuccess) d.roi_left = 0;
+    d.roi_top = vsapi->mapGetInt(in, "top", 0, &error);
+    if (error != peSuccess) d.roi_top = 0;
+    d.roi_width = vsapi->mapGetInt(in, "width", 0, &error);
+    if (error != peSuccess) d.roi_width = viref->width - d.roi_left;
+    d.roi_height = vsapi->mapGetInt(in, "height", 0, &error);
+    if (error != peSuccess) d.roi_height = viref->height - d.roi_top;
+    if (d.roi_left < 0 || d.roi_top < 0 || d.roi_width <= 0 || d.roi_height <= 0
+        || d.roi_left + d.roi_width > viref->width || d.roi_top + d.roi_height > viref->height){
+        vsapi->mapSetError(out, "vscycle: left, top, width and height must describe a region inside the frame");
+        vsapi->freeNode(d.reference);
+        vsapi->freeNode(d.distorted);
+        return;
+    }
+
     int gpuid = vsapi->mapGetInt(in, "gpu_id", 0, &error);
     if (error != peSuccess){
         gpuid = 0;
     }
 
-    try{
-        //if succeed, this function also does hipSetDevice
-        helper::gpuFullCheck(gpuid);
-    } catch (const VshipError& e){
-        vsapi->mapSetError(out, e.getErrorMessage().c_str());
-        return;
+    //"sycl" or "cpu", builds without SYCL only have the native cpu implementation
+    const char* backend = vsapi->mapGetData(in, "backend", 0, &error);
+#ifndef VSHIP_NO_SYCL
+    d.cpu = false;
+#else
+    d.cpu = true;
+#endif
+    if (error == peSuccess){
+        const std::string name = backend;
+        if (name == "cpu"){
+            d.cpu = true;
+#ifndef VSHIP_NO_SYCL
+        } else if (name == "sycl" || name == "gpu"){
+            d.cpu = false;
+#endif
+        } else {
+            vsapi->mapSetError(out, ("vscycle: unknown backend " + name).c_str());
+            vsapi->freeNode(d.reference);
+            vsapi->freeNode(d.distorted);
+            return;
+        }
     }
 
+#ifndef VSHIP_NO_SYCL
+    if (!d.cpu){
+        try{
+            //if succeed, this function also does hipSetDevice
+            helper::gpuFullCheck(gpuid);
+        } catch (const VshipError& e){
+            vsapi->mapSetError(out, e.getErrorMessage().c_str());
+            return;
+        }
+    }
+#endif
+
     //int videowidth = viref->width;
     //int videoheight = viref->height;
     //put optimal thread number
@@ -135,29 +223,53 @@ static void VS_CC ssimulacra2Create(const VSMap *in, VSMap *out, void *userData,
 
     d.streamnum = vsapi->mapGetInt(in, "numStream", 0, &error);
     if (error != peSuccess){
-        d.streamnum = infos.numThreads;
+        //a native cpu stream already spreads each frame over every core, a few of them are enough to keep the pool busy
+        d.streamnum = d.cpu ? std::min(infos.numThreads, 4) : infos.numThreads;
     }
 
     d.streamnum = std::min(d.streamnum, infos.numThreads); // vs threads < numStream would make no sense
     d.streamnum = std::max(d.streamnum, 1); //at least one stream to not just wait indefinitely
 
+    d.threshold = vsapi->mapGetFloat(in, "threshold", 0, &error);
+    d.use_threshold = (error == peSuccess);
+
+    int autotune = vsapi->mapGetInt(in, "autotune", 0, &error);
+    if (error != peSuccess){
+        autotune = 0;
+    }
+    (void)autotune; //the native implementation has nothing to tune
+
     try{
-        auto devices = sycl::device::get_devices(sycl::info::device_type::gpu);
-        d.ssimu2Streams = (SSIMU2ComputingImplementation*)malloc(sizeof(SSIMU2ComputingImplementation)*d.streamnum);
-        for (int i = 0; i < d.streamnum; i++){
-            new(&d.ssimu2Streams[i]) SSIMU2ComputingImplementation(viref->width, viref->height, 0);
+        if (d.cpu){
+            d.cpuStreams = (ssimu2cpu::SSIMU2ComputingImplementation*)malloc(sizeof(ssimu2cpu::SSIMU2ComputingImplementation)*d.streamnum);
+            for (int i = 0; i < d.streamnum; i++){
+                new(&d.cpuStreams[i]) ssimu2cpu::SSIMU2ComputingImplementation(d.roi_width, d.roi_height);
+            }
+        } else {
+#ifndef VSHIP_NO_SYCL
+            auto devices = helper::getDevices();
+            if (autotune){
+                //streams created below load the tuned work-group sizes
+                sycl::queue tune_queue(devices[gpuid], helper::queueProperties());
+                autotuneKernels(tune_queue, d.roi_width, d.roi_height);
+            }
+            d.ssimu2Streams = (SSIMU2ComputingImplementation*)malloc(sizeof(SSIMU2ComputingImplementation)*d.streamnum);
+            for (int i = 0; i < d.streamnum; i++){
+                new(&d.ssimu2Streams[i]) SSIMU2ComputingImplementation(d.roi_width, d.roi_height, gpuid);
+            }
+#endif
         }
-        
+
     } catch (const VshipError& e){
         vsapi->mapSetError(out, e.getErrorMessage().c_str());
         return;
     }
 
-    std::set<int> newstreamset;
+    std::vector<int> streams;
     for (int i = 0; i < d.streamnum; i++){
-        newstreamset.insert(i);
+        streams.push_back(i);
     }
-    d.streamSet = new threadSet(newstreamset);
+    d.streamSet = new BufferPool<int>(streams);
 
     data = (Ssimulacra2Data *)malloc(sizeof(d));
     *data = d;
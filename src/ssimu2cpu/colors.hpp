@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "simd.hpp"
+
+namespace ssimu2cpu{
+
+//same branches as ssimu2::rgb_to_linrgbfunc
+inline float srgbToLinear(float a){
+    if (a < 0.f){
+        if (a < -0.04045f) return -std::pow(((-a+0.055f)*(1.0f/1.055f)), 2.4f);
+        return a * (1.0f/12.92f);
+    }
+    if (a > 0.04045f) return std::pow(((a+0.055f)*(1.0f/1.055f)), 2.4f);
+    return a * (1.0f/12.92f);
+}
+
+inline float halfToFloat(uint16_t h){
+    const uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t bits;
+    if (exponent == 0x1f){ //inf, nan
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0){
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0){
+        bits = sign;
+    } else { //subnormal half, normal float
+        int e = 113;
+        while ((mantissa & 0x400) == 0){
+            mantissa <<= 1;
+            e--;
+        }
+        bits = sign | ((uint32_t)e << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float res;
+    std::memcpy(&res, &bits, sizeof(float));
+    return res;
+}
+
+//16 bit inputs only have 65536 possible values: their linear value is read from an exact table
+inline const float* uint16LinearTable(){
+    static const std::vector<float> table = [](){
+        std::vector<float> t(1 << 16);
+        for (int i = 0; i < (1 << 16); i++) t[i] = srgbToLinear((float)i/((1 << 16)-1));
+        return t;
+    }();
+    return table.data();
+}
+
+inline const float* halfLinearTable(){
+    static const std::vector<float> table = [](){
+        std::vector<float> t(1 << 16);
+        for (int i = 0; i < (1 << 16); i++) t[i] = srgbToLinear(halfToFloat((uint16_t)i));
+        return t;
+    }();
+    return table.data();
+}
+
+//float inputs in [0, 1] are linearly interpolated in a table (error below 1e-7), the rest uses the formula
+constexpr int FLOAT_TABLE_SIZE = 4096;
+
+inline const float* floatLinearTable(){
+    static const std::vector<float> table = [](){
+        std::vector<float> t(FLOAT_TABLE_SIZE + 2);
+        for (int i = 0; i <= FLOAT_TABLE_SIZE; i++) t[i] = srgbToLinear((float)i/FLOAT_TABLE_SIZE);
+        t[FLOAT_TABLE_SIZE+1] = t[FLOAT_TABLE_SIZE];
+        return t;
+    }();
+    return table.data();
+}
+
+SSIMU2CPU_CLONES
+void uint16RowToLinear(const uint16_t* SSIMU2CPU_RESTRICT src, float* SSIMU2CPU_RESTRICT dst, int64_t width, const float* SSIMU2CPU_RESTRICT table){
+    for (int64_t x = 0; x < width; x++) dst[x] = table[src[x]];
+}
+
+SSIMU2CPU_CLONES
+void floatRowToLinear(const float* SSIMU2CPU_RESTRICT src, float* SSIMU2CPU_RESTRICT dst, int64_t width, const float* SSIMU2CPU_RESTRICT table){
+    for (int64_t x = 0; x < width; x++){
+        //clamp to [0, 1] with fabs rather than comparisons, which the compiler does not turn into vector selects
+        const float v = 0.5f * (src[x] + std::fabs(src[x]));
+        const float pos = (v - 0.5f * ((v - 1.0f) + std::fabs(v - 1.0f))) * FLOAT_TABLE_SIZE;
+        int32_t i = (int32_t)pos;
+        i = i < 0 ? 0 : (i > FLOAT_TABLE_SIZE ? FLOAT_TABLE_SIZE : i); //nan and inf, fixed below
+        const float frac = pos - (float)i;
+        dst[x] = table[i] + frac * (table[i+1] - table[i]);
+    }
+    //out of range values are rare, fix them afterwards so that the loop above stays branchless
+    int outside = 0;
+    for (int64_t x = 0; x < width; x++){
+        outside |= (int)(src[x] < 0.0f) | (int)(src[x] > 1.0f) | (int)(src[x] != src[x]);
+    }
+    if (!outside) return;
+    for (int64_t x = 0; x < width; x++){
+        if (!(src[x] >= 0.0f && src[x] <= 1.0f)) dst[x] = srgbToLinear(src[x]);
+    }
+}
+
+template <InputMemType T>
+void planeRowsToLinear(const uint8_t* src, int64_t stride, float* dst, int64_t width, int64_t y0, int64_t y1){
+    for (int64_t y = y0; y < y1; y++){
+        const uint8_t* row = src + y*stride;
+        if constexpr (T == UINT16){
+            uint16RowToLinear((const uint16_t*)row, dst + y*width, width, uint16LinearTable());
+        } else if constexpr (T == HALF){
+            uint16RowToLinear((const uint16_t*)row, dst + y*width, width, halfLinearTable());
+        } else {
+            floatRowToLinear((const float*)row, dst + y*width, width, floatLinearTable());
+        }
+    }
+}
+
+//cube root of a non negative float: exponent/3 bit trick followed by 3 newton steps, full float precision
+//but unlike std::cbrt it vectorizes
+inline float cbrtPositive(float x){
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(float));
+    bits = bits/3 + 709921077u;
+    float y;
+    std::memcpy(&y, &bits, sizeof(float));
+    y = (2.0f/3.0f) * y + x / (3.0f * y * y);
+    y = (2.0f/3.0f) * y + x / (3.0f * y * y);
+    y = (2.0f/3.0f) * y + x / (3.0f * y * y);
+    return y;
+}
+
+//in place linear RGB -> positive XYB, same constants as ssimu2::rgb_to_positive_xyb_d
+SSIMU2CPU_CLONES
+void linearToPositiveXYB(float* SSIMU2CPU_RESTRICT p0, float* SSIMU2CPU_RESTRICT p1, float* SSIMU2CPU_RESTRICT p2, int64_t size){
+    const float opsin_bias = 0.0037930734f;
+    const float abs_bias = -0.1559542025327239f;
+    for (int64_t i = 0; i < size; i++){
+        const float r = p0[i];
+        const float g = p1[i];
+        const float b = p2[i];
+
+        float l = std::fma(0.30f, r, std::fma(0.622f, g, std::fma(0.078f, b, opsin_bias)));
+        float m = std::fma(0.23f, r, std::fma(0.692f, g, std::fma(0.078f, b, opsin_bias)));
+        float s = std::fma(0.24342269f, r, std::fma(0.20476745f, g, std::fma(0.55180986f, b, opsin_bias)));
+
+        l = cbrtPositive(l > 0.0f ? l : 0.0f) + abs_bias;
+        m = cbrtPositive(m > 0.0f ? m : 0.0f) + abs_bias;
+        s = cbrtPositive(s > 0.0f ? s : 0.0f) + abs_bias;
+
+        const float x = 0.5f * (l - m);
+        const float y = m + x;
+
+        p0[i] = x * 14.0f + 0.42f;
+        p1[i] = y + 0.01f;
+        p2[i] = (s - y) + 0.55f;
+    }
+}
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "simd.hpp"
+
+namespace ssimu2cpu{
+
+//output rows [y0, y1) of the 2x2 box downsample of one plane, borders clamped like ssimu2::downsample
+SSIMU2CPU_CLONES
+void downsampleRows(const float* SSIMU2CPU_RESTRICT src, float* SSIMU2CPU_RESTRICT dst, int64_t width, int64_t height, int64_t y0, int64_t y1){
+    const int64_t neww = (width - 1) / 2 + 1;
+    const int64_t paired = width / 2; //output columns whose two source columns both exist
+
+    for (int64_t y = y0; y < y1; y++){
+        const float* row0 = src + std::min(2 * y, height - 1) * width;
+        const float* row1 = src + std::min(2 * y + 1, height - 1) * width;
+        float* out = dst + y * neww;
+        for (int64_t x = 0; x < paired; x++){
+            out[x] = (((row0[2*x] + row1[2*x]) + row0[2*x+1]) + row1[2*x+1]) * 0.25f;
+        }
+        if (paired < neww){
+            const int64_t x0 = width - 1;
+            out[paired] = (((row0[x0] + row1[x0]) + row0[x0]) + row1[x0]) * 0.25f;
+        }
+    }
+}
+
+}
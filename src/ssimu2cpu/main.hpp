@@ -0,0 +1,267 @@
+#pragma once
+
+//Native CPU implementation of ssimu2::SSIMU2ComputingImplementation. It needs no SYCL runtime and gives the same
+//scores as the SYCL path up to float rounding (see README). Planes are kept as separate float arrays holding the
+//6 scales back to back, and every stage is split in bands of rows executed on a shared thread pool.
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+#include "../util/preprocessor.hpp"
+#include "../util/VshipExceptions.hpp"
+#include "../util/threadpool.hpp"
+#include "../util/stagetimes.hpp"
+#include "../ssimu2/finalscore.hpp"
+#include "simd.hpp"
+#include "colors.hpp"
+#include "downsample.hpp"
+#include "score.hpp"
+
+namespace ssimu2cpu{
+
+//rows per task. Fixed rather than derived from the thread count so that the summation order, hence the score, does not depend on the machine
+constexpr int64_t BAND_HEIGHT = 64;
+
+int64_t getTotalScaleSize(int64_t width, int64_t height){
+    int64_t result = 0;
+    for (int scale = 0; scale < 6; scale++){
+        result += width*height;
+        width = (width-1)/2+1;
+        height = (height-1)/2+1;
+    }
+    return result;
+}
+
+class SSIMU2ComputingImplementation{
+public:
+    SSIMU2ComputingImplementation(int64_t w, int64_t h, helper::ThreadPool& threadpool = helper::ThreadPool::shared())
+    : pool(&threadpool)
+    {
+        width = w;
+        height = h;
+        totalscalesize = getTotalScaleSize(width, height);
+        try {
+            planes.resize(6*totalscalesize);
+        } catch (const std::bad_alloc&) {
+            VSHIP_THROW(OutOfRAM);
+        }
+
+        int64_t sw = width;
+        int64_t sh = height;
+        int64_t offset = 0;
+        for (int scale = 0; scale < 6; scale++){
+            scales[scale] = {sw, sh, offset};
+            offset += sw*sh;
+            sw = (sw-1)/2+1;
+            sh = (sh-1)/2+1;
+        }
+
+        //build the conversion tables now rather than during the first frame
+        uint16LinearTable();
+        halfLinearTable();
+        floatLinearTable();
+    }
+
+    void destroy(){
+        std::vector<float>().swap(planes);
+    }
+
+    //every following run writes its stage durations there (nullptr to stop), there is no upload on the cpu
+    void setStageTimes(helper::StageTimes* times){
+        stage_times = times;
+    }
+
+    //Reference features of one frame: its XYB pyramid then the blurred mu1 and s11 of the 3 planes,
+    //totalscalesize floats each. Given back to runWithReference they replace the decoded reference.
+    static int64_t referenceFeatureSize(int64_t w, int64_t h){
+        return 9*getTotalScaleSize(w, h);
+    }
+
+    int64_t referenceFeatureSize() const {
+        return 9*totalscalesize;
+    }
+
+    //features_out (referenceFeatureSize floats) receives the reference features of srcp1 if not null
+    template <InputMemType T>
+    double run(const uint8_t* srcp1[3], const uint8_t* srcp2[3], int64_t stride, float* features_out = nullptr){
+        return compute<T>(srcp1, srcp2, stride, nullptr, features_out);
+    }
+
+    //same score as run, with the reference given by the features stored by an earlier run
+    template <InputMemType T>
+    double runWithReference(const float* features, const uint8_t* srcp2[3], int64_t stride){
+        return compute<T>(nullptr, srcp2, stride, features, nullptr);
+    }
+
+    //whether the score is at least threshold, see ssimu2::ThresholdResult
+    template <InputMemType T>
+    ssimu2::ThresholdResult runThreshold(const uint8_t* srcp1[3], const uint8_t* srcp2[3], int64_t stride, double threshold){
+        bool exact = true;
+        const double score = compute<T>(srcp1, srcp2, stride, nullptr, nullptr, threshold, &exact);
+        return {score, score >= threshold, exact};
+    }
+
+    template <InputMemType T>
+    ssimu2::ThresholdResult runWithReferenceThreshold(const float* features, const uint8_t* srcp2[3], int64_t stride, double threshold){
+        bool exact = true;
+        const double score = compute<T>(nullptr, srcp2, stride, features, nullptr, threshold, &exact);
+        return {score, score >= threshold, exact};
+    }
+
+private:
+    //with a threshold (features_out must be null) the full resolution scale is skipped when the others
+    //already put the score below it, the upper bound they give is returned and *exact set to false
+    template <InputMemType T>
+    double compute(const uint8_t* srcp1[3], const uint8_t* srcp2[3], int64_t stride, const float* features_in, float* features_out,
+                   double threshold = -INFINITY, bool* exact = nullptr){
+        const auto start = std::chrono::steady_clock::now();
+        const int64_t bands = (height - 1)/BAND_HEIGHT + 1;
+        //with stored features only the distorted planes go through steps 1 to 3
+        const int first_plane = features_in ? 3 : 0;
+        const int planecount = 6 - first_plane;
+
+        //step 1 : linear RGB at full resolution
+        pool->parallel_for(planecount*bands, [&](int64_t task){
+            const int64_t band = task % bands;
+            const int plane = first_plane + task / bands;
+            const uint8_t* src = (plane < 3) ? srcp1[plane] : srcp2[plane-3];
+            planeRowsToLinear<T>(src, stride, plane_ptr(plane), width, band*BAND_HEIGHT, std::min(height, (band+1)*BAND_HEIGHT));
+        });
+
+        //step 2 : downsampled scales, each from the previous one
+        for (int scale = 1; scale < 6; scale++){
+            const Scale& prev = scales[scale-1];
+            const Scale& cur = scales[scale];
+            const int64_t scalebands = (cur.height - 1)/BAND_HEIGHT + 1;
+            pool->parallel_for(planecount*scalebands, [&](int64_t task){
+                const int64_t band = task % scalebands;
+                float* plane = plane_ptr(first_plane + task / scalebands);
+                downsampleRows(plane + prev.offset, plane + cur.offset, prev.width, prev.height, band*BAND_HEIGHT, std::min(cur.height, (band+1)*BAND_HEIGHT));
+            });
+        }
+
+        //step 3 : positive XYB on the whole pyramid
+        const int64_t chunk = BAND_HEIGHT*width;
+        const int64_t chunks = (totalscalesize - 1)/chunk + 1;
+        pool->parallel_for((planecount/3)*chunks, [&](int64_t task){
+            const int image = first_plane/3 + task / chunks;
+            const int64_t begin = (task % chunks)*chunk;
+            const int64_t size = std::min(chunk, totalscalesize - begin);
+            linearToPositiveXYB(plane_ptr(3*image) + begin, plane_ptr(3*image+1) + begin, plane_ptr(3*image+2) + begin, size);
+        });
+
+        if (features_out){
+            pool->parallel_for(3, [&](int64_t plane){
+                std::copy(plane_ptr(plane), plane_ptr(plane) + totalscalesize, features_out + plane*totalscalesize);
+            });
+        }
+        const float* const reference[3] = {
+            features_in ? features_in : plane_ptr(0),
+            features_in ? features_in + totalscalesize : plane_ptr(1),
+            features_in ? features_in + 2*totalscalesize : plane_ptr(2),
+        };
+
+        //step 4 : blurred moments and the 6 sums per plane and scale, one task per band of a scale
+        std::vector<std::array<int64_t, 2>> tasks; //scale, band
+        for (int scale = 0; scale < 6; scale++){
+            const int64_t scalebands = (scales[scale].height - 1)/BAND_HEIGHT + 1;
+            for (int64_t band = 0; band < scalebands; band++) tasks.push_back({scale, band});
+        }
+        const int64_t full_resolution_tasks = (scales[0].height - 1)/BAND_HEIGHT + 1;
+        std::vector<std::array<double, 18>> partial(tasks.size());
+
+        auto score_tasks = [&](int64_t first_task, int64_t end_task){
+            pool->parallel_for(end_task - first_task, [&](int64_t index){
+                const int64_t task = first_task + index;
+                const Scale& sc = scales[tasks[task][0]];
+                const int64_t y0 = tasks[task][1]*BAND_HEIGHT;
+                const int64_t y1 = std::min(sc.height, y0 + BAND_HEIGHT);
+
+                thread_local std::vector<float> scratch;
+                const size_t needed = bandScratchSize(sc.width);
+                if (scratch.size() < needed) scratch.resize(needed);
+
+                for (int plane = 0; plane < 3; plane++){
+                    ReferenceStats stats;
+                    if (features_in){
+                        stats.mu1 = features_in + (3+plane)*totalscalesize + sc.offset;
+                        stats.s11 = features_in + (6+plane)*totalscalesize + sc.offset;
+                    } else if (features_out){
+                        stats.mu1_out = features_out + (3+plane)*totalscalesize + sc.offset;
+                        stats.s11_out = features_out + (6+plane)*totalscalesize + sc.offset;
+                    }
+                    bandScore(reference[plane] + sc.offset, plane_ptr(plane+3) + sc.offset, sc.width, sc.height, y0, y1, gaussian, scratch.data(), partial[task].data() + 6*plane, stats);
+                }
+            });
+        };
+
+        //step 5 : reduce in a fixed order and format like ssimu2GPUProcess, scales below first_scale are left at 0
+        auto measures = [&](int first_scale){
+            std::vector<float> measure_vec(108);
+            size_t task = 0;
+            for (int scale = 0; scale < 6; scale++){
+                if (scale < first_scale){
+                    while (task < tasks.size() && tasks[task][0] == scale) task++;
+                    continue;
+                }
+                std::array<double, 18> sums{};
+                for (; task < tasks.size() && tasks[task][0] == scale; task++){
+                    for (int i = 0; i < 18; i++) sums[i] += partial[task][i];
+                }
+                const double norm = 1.0 / (double)(scales[scale].width * scales[scale].height);
+                for (int plane = 0; plane < 3; plane++){
+                    for (int n = 0; n < 2; n++){
+                        for (int i = 0; i < 3; i++){
+                            double value = sums[6*plane + 2*i + n] * norm;
+                            if (n == 1) value = std::sqrt(std::sqrt(value)); //completing 4th norm
+                            measure_vec[plane*6*2*3 + scale*2*3 + n*3 + i] = (float)value;
+                        }
+                    }
+                }
+            }
+            return measure_vec;
+        };
+
+        if (threshold == -INFINITY){
+            score_tasks(0, tasks.size());
+        } else {
+            //coarse scales first, see ssimu2::final_score for why they bound the score
+            score_tasks(full_resolution_tasks, tasks.size());
+            const double bound = ssimu2::final_score(measures(1));
+            if (bound < threshold){
+                *exact = false;
+                if (stage_times) *stage_times = {0, helper::elapsedNanoseconds(start, std::chrono::steady_clock::now()), 0};
+                return bound;
+            }
+            score_tasks(0, full_resolution_tasks);
+        }
+
+        const auto reduce_start = std::chrono::steady_clock::now();
+        const double score = ssimu2::final_score(measures(0));
+        if (stage_times) *stage_times = {0, helper::elapsedNanoseconds(start, reduce_start), helper::elapsedNanoseconds(reduce_start, std::chrono::steady_clock::now())};
+        return score;
+    }
+
+    struct Scale{
+        int64_t width;
+        int64_t height;
+        int64_t offset;
+    };
+
+    //planes 0-2: reference, 3-5: distorted
+    float* plane_ptr(int plane){
+        return planes.data() + plane*totalscalesize;
+    }
+
+    helper::ThreadPool* pool;
+    helper::StageTimes* stage_times = nullptr;
+    Gaussian gaussian;
+    std::vector<float> planes;
+    Scale scales[6];
+    int64_t width;
+    int64_t height;
+    int64_t totalscalesize;
+};
+
+}
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "simd.hpp"
+
+namespace ssimu2cpu{
+
+constexpr int TAPS = 2*GAUSSIANSIZE+1;
+
+//same kernel and integral table as ssimu2::GaussianHandle
+struct Gaussian{
+    float kernel[TAPS];
+    float integral[TAPS+1];
+
+    Gaussian(){
+        integral[0] = 0.0f;
+        for (int i = 0; i < TAPS; i++){
+            kernel[i] = std::exp(-(GAUSSIANSIZE-i)*(GAUSSIANSIZE-i) / (2*SIGMA*SIGMA)) / (std::sqrt(TAU*SIGMA*SIGMA));
+            integral[i+1] = integral[i] + kernel[i];
+        }
+    }
+
+    //1/(sum of the taps that fall inside [0, size)) for the window centered on pos
+    float norm(int64_t pos, int64_t size) const {
+        const int beg = std::max<int64_t>(0, pos - GAUSSIANSIZE) - (pos - GAUSSIANSIZE);
+        const int end = std::min<int64_t>(size, pos + GAUSSIANSIZE + 1) - (pos - GAUSSIANSIZE);
+        return 1.0f / (integral[end] - integral[beg]);
+    }
+};
+
+//floats of scratch needed by bandScore for a plane of this width
+int64_t bandScratchSize(int64_t width){
+    const int64_t padded = width + 2*GAUSSIANSIZE;
+    return 5*padded + TAPS*5*width + 5*width + 6*width + width;
+}
+
+//horizontal blur of one moment of one row: p holds the moment with GAUSSIANSIZE zeros on each side
+SSIMU2CPU_CLONES
+void blurRowHorizontal(const float* SSIMU2CPU_RESTRICT p, float* SSIMU2CPU_RESTRICT out, const float* SSIMU2CPU_RESTRICT hnorm, int64_t width, const float* SSIMU2CPU_RESTRICT kernel){
+    for (int64_t x = 0; x < width; x++){
+        float acc = 0.0f;
+        for (int i = 0; i < TAPS; i++) acc += kernel[i] * p[x+i];
+        out[x] = acc * hnorm[x];
+    }
+}
+
+//vertical blur of one moment when all 17 rows exist
+SSIMU2CPU_CLONES
+void blurColumnFull(const float* const* rows, float* SSIMU2CPU_RESTRICT out, int64_t width, const float* SSIMU2CPU_RESTRICT kernel){
+    //named pointers, an array of row pointers keeps the compiler from vectorizing
+    const float *r0 = rows[0], *r1 = rows[1], *r2 = rows[2], *r3 = rows[3], *r4 = rows[4], *r5 = rows[5];
+    const float *r6 = rows[6], *r7 = rows[7], *r8 = rows[8], *r9 = rows[9], *r10 = rows[10], *r11 = rows[11];
+    const float *r12 = rows[12], *r13 = rows[13], *r14 = rows[14], *r15 = rows[15], *r16 = rows[16];
+    for (int64_t x = 0; x < width; x++){
+        float acc = kernel[0] * r0[x];
+        acc += kernel[1] * r1[x];
+        acc += kernel[2] * r2[x];
+        acc += kernel[3] * r3[x];
+        acc += kernel[4] * r4[x];
+        acc += kernel[5] * r5[x];
+        acc += kernel[6] * r6[x];
+        acc += kernel[7] * r7[x];
+        acc += kernel[8] * r8[x];
+        acc += kernel[9] * r9[x];
+        acc += kernel[10] * r10[x];
+        acc += kernel[11] * r11[x];
+        acc += kernel[12] * r12[x];
+        acc += kernel[13] * r13[x];
+        acc += kernel[14] * r14[x];
+        acc += kernel[15] * r15[x];
+        acc += kernel[16] * r16[x];
+        out[x] = acc;
+    }
+}
+
+//vertical blur of one moment near the top or bottom border, taps [beg, end) only
+SSIMU2CPU_CLONES
+void blurColumnPartial(const float* const* rows, float* SSIMU2CPU_RESTRICT out, int64_t width, const float* SSIMU2CPU_RESTRICT kernel, int beg, int end){
+    for (int64_t x = 0; x < width; x++) out[x] = 0.0f;
+    for (int i = beg; i < end; i++){
+        const float* row = rows[i];
+        const float g = kernel[i];
+        for (int64_t x = 0; x < width; x++) out[x] += g * row[x];
+    }
+}
+
+//ssim, artifact and detail loss terms of one row, accumulated per column in colsum[6][width]
+//mom holds the blurred moments (rows 1, 3 and 4 are used), the reference ones m1 and s11 come already normalized
+SSIMU2CPU_CLONES
+void scoreRow(const float* SSIMU2CPU_RESTRICT mom, const float* SSIMU2CPU_RESTRICT m1row, const float* SSIMU2CPU_RESTRICT s11row, const float* SSIMU2CPU_RESTRICT im1, const float* SSIMU2CPU_RESTRICT im2, float vnorm, float* SSIMU2CPU_RESTRICT colsum, int64_t width){
+    SSIMU2CPU_IVDEP
+    for (int64_t x = 0; x < width; x++){
+        const float m1 = m1row[x];
+        const float m2 = mom[width + x] * vnorm;
+        const float su11 = s11row[x];
+        const float su22 = mom[3*width + x] * vnorm;
+        const float su12 = mom[4*width + x] * vnorm;
+
+        const float m_diff = m1 - m2;
+        const float num_m = 1.0f - m_diff * m_diff;
+        const float num_s = 2.0f * (su12 - m1 * m2) + 0.0009f;
+        const float denom_s = (su11 - m1 * m1) + (su22 - m2 * m2) + 0.0009f;
+        const float ssim = 1.0f - (num_m * num_s) / denom_s;
+        const float d0 = ssim > 0.0f ? ssim : 0.0f;
+
+        const float v1 = (std::fabs(im2[x] - m2) + 1.0f) / (std::fabs(im1[x] - m1) + 1.0f) - 1.0f;
+        const float d1 = v1 > 0.0f ? v1 : 0.0f;
+        const float d2 = v1 < 0.0f ? -v1 : 0.0f;
+
+        const float d0sq = d0 * d0;
+        const float d1sq = d1 * d1;
+        const float d2sq = d2 * d2;
+        colsum[x] += d0;
+        colsum[width + x] += d0sq * d0sq;
+        colsum[2*width + x] += d1;
+        colsum[3*width + x] += d1sq * d1sq;
+        colsum[4*width + x] += d2;
+        colsum[5*width + x] += d2sq * d2sq;
+    }
+}
+
+//Blurred and normalized mean and second moment of the reference plane (width*height each). They only depend
+//on the reference, so they can be computed once, stored (the *_out pointers) and given back for the next
+//comparisons against the same frame (mu1, s11), which then skip 2 of the 5 blurs.
+struct ReferenceStats{
+    const float* mu1 = nullptr;
+    const float* s11 = nullptr;
+    float* mu1_out = nullptr;
+    float* s11_out = nullptr;
+};
+
+//Sums of the 6 terms (ssim, ssim^4, artifact, artifact^4, detail, detail^4) over output rows [y0, y1) of one plane.
+//The horizontal blur of the rows [y0-8, y1+8) is kept in a ring of 17 rows and each output row is blurred
+//vertically as soon as its last row is there, so a band only ever touches ~17 rows of intermediate data.
+void bandScore(const float* im1, const float* im2, int64_t width, int64_t height, int64_t y0, int64_t y1, const Gaussian& gaussian, float* scratch, double out[6], const ReferenceStats& ref = ReferenceStats()){
+    //moments: 0 im1, 1 im2, 2 im1², 3 im2², 4 im1*im2, the reference ones are skipped when given
+    static constexpr int all_moments[5] = {0, 1, 2, 3, 4};
+    static constexpr int distorted_moments[3] = {1, 3, 4};
+    const bool reuse = ref.mu1 != nullptr;
+    const int* moments = reuse ? distorted_moments : all_moments;
+    const int moment_count = reuse ? 3 : 5;
+
+    const int64_t padded = width + 2*GAUSSIANSIZE;
+    float* pad = scratch;
+    float* ring = pad + 5*padded;
+    float* mom = ring + TAPS*5*width;
+    float* colsum = mom + 5*width;
+    float* hnorm = colsum + 6*width;
+
+    for (int k = 0; k < 5; k++){
+        std::fill(pad + k*padded, pad + k*padded + GAUSSIANSIZE, 0.0f);
+        std::fill(pad + k*padded + GAUSSIANSIZE + width, pad + (k+1)*padded, 0.0f);
+    }
+    std::fill(colsum, colsum + 6*width, 0.0f);
+    for (int64_t x = 0; x < width; x++) hnorm[x] = gaussian.norm(x, width);
+
+    const int64_t first = std::max<int64_t>(0, y0 - GAUSSIANSIZE);
+    for (int64_t yy = first; yy < y1 + GAUSSIANSIZE; yy++){
+        if (yy < height){
+            const float* a = im1 + yy*width;
+            const float* b = im2 + yy*width;
+            float* p0 = pad + GAUSSIANSIZE;
+            float* p1 = p0 + padded;
+            float* p2 = p1 + padded;
+            float* p3 = p2 + padded;
+            float* p4 = p3 + padded;
+            for (int64_t x = 0; x < width; x++){
+                p0[x] = a[x];
+                p1[x] = b[x];
+                p2[x] = a[x] * a[x];
+                p3[x] = b[x] * b[x];
+                p4[x] = a[x] * b[x];
+            }
+            for (int m = 0; m < moment_count; m++){
+                const int k = moments[m];
+                blurRowHorizontal(pad + k*padded, ring + (yy % TAPS)*5*width + k*width, hnorm, width, gaussian.kernel);
+            }
+        }
+
+        const int64_t y = yy - GAUSSIANSIZE;
+        if (y < y0) continue;
+
+        const int beg = std::max<int64_t>(0, y - GAUSSIANSIZE) - (y - GAUSSIANSIZE);
+        const int end = std::min<int64_t>(height, y + GAUSSIANSIZE + 1) - (y - GAUSSIANSIZE);
+        for (int m = 0; m < moment_count; m++){
+            const int k = moments[m];
+            const float* rows[TAPS];
+            for (int i = 0; i < TAPS; i++){
+                const int64_t source = y - GAUSSIANSIZE + i;
+                rows[i] = (i >= beg && i < end) ? ring + (source % TAPS)*5*width + k*width : nullptr;
+            }
+            if (beg == 0 && end == TAPS){
+                blurColumnFull(rows, mom + k*width, width, gaussian.kernel);
+            } else {
+                blurColumnPartial(rows, mom + k*width, width, gaussian.kernel, beg, end);
+            }
+        }
+        const float vnorm = gaussian.norm(y, height);
+        const float* m1row;
+        const float* s11row;
+        if (reuse){
+            m1row = ref.mu1 + y*width;
+            s11row = ref.s11 + y*width;
+        } else {
+            //same product as the one scoreRow would do, so storing them does not change the score
+            float* m1 = mom;
+            float* s11 = mom + 2*width;
+            for (int64_t x = 0; x < width; x++){
+                m1[x] *= vnorm;
+                s11[x] *= vnorm;
+            }
+            if (ref.mu1_out != nullptr){
+                std::copy(m1, m1 + width, ref.mu1_out + y*width);
+                std::copy(s11, s11 + width, ref.s11_out + y*width);
+            }
+            m1row = m1;
+            s11row = s11;
+        }
+        scoreRow(mom, m1row, s11row, im1 + y*width, im2 + y*width, vnorm, colsum, width);
+    }
+
+    for (int k = 0; k < 6; k++){
+        double total = 0.0;
+        for (int64_t x = 0; x < width; x++) total += colsum[k*width + x];
+        out[k] = total;
+    }
+}
+
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+//The hot loops of the native implementation are plain loops over contiguous float rows written so that the compiler
+//vectorizes them. On x86-64 ELF targets every such function is compiled three times (AVX-512, AVX2, baseline)
+//and the loader picks the best one for the running CPU, so a single binary is fast everywhere.
+//Build with -DVSHIP_NO_CLONES to get only the baseline (or -march) version.
+//(x86-64-v4/v3 are dispatched on cpu features, named archs like haswell would be dispatched on the exact cpu model)
+#if defined(__x86_64__) && defined(__ELF__) && defined(__GNUC__) && !defined(__SYCL_DEVICE_ONLY__) && !defined(VSHIP_NO_CLONES)
+    #if !defined(__clang__) && __GNUC__ >= 12
+        #define SSIMU2CPU_CLONES __attribute__((target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")))
+    #else
+        #define SSIMU2CPU_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+    #endif
+#else
+    #define SSIMU2CPU_CLONES
+#endif
+
+#if defined(_MSC_VER)
+    #define SSIMU2CPU_RESTRICT __restrict
+#else
+    #define SSIMU2CPU_RESTRICT __restrict__
+#endif
+
+//the loop has no dependency between iterations even though some of its pointers share a base (rows of one buffer)
+#if defined(__clang__)
+    #define SSIMU2CPU_IVDEP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+    #define SSIMU2CPU_IVDEP _Pragma("GCC ivdep")
+#else
+    #define SSIMU2CPU_IVDEP
+#endif
@@ -1,12 +1,16 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <memory>
 #include <mutex>
 #include <optional>
-#include <queue>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
 #ifndef ASSERT_WITH_MESSAGE
@@ -26,149 +30,284 @@
 
 #endif
 
-template <typename ElementType> class ThreadSafeQueue {
+//Hand-offs between the reader, worker and writer threads. The fast path of every structure is lock free:
+//a mutex and condition variable are only touched once a thread has spun for a while and goes to sleep,
+//so the cost of a push or pop does not grow with the number of threads on the other side.
+
+//hot atomics get their own cache line so producers and consumers do not invalidate each other
+constexpr size_t cache_line_size = 64;
+
+inline void cpu_relax(){
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    __builtin_ia32_pause();
+#endif
+}
+
+//Lets threads sleep until a condition published through atomics becomes true.
+//Notifying costs a fence and a load when nobody sleeps.
+class EventCount {
   private:
-    std::queue<ElementType> internal_queue_;
-    mutable std::mutex queue_mutex_;
-    std::condition_variable queue_not_empty_cv_;
-    std::condition_variable queue_not_full_cv_;
-    const size_t maximum_capacity_;
-    bool is_queue_closed_ = false;
+    std::atomic<int> waiters_{0};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+    //spinning only helps when the thread we wait for can run at the same time
+    static int spin_count() {
+        static const int count = std::thread::hardware_concurrency() > 1 ? 128 : 0;
+        return count;
+    }
+
+    bool has_waiters() {
+        //pairs with the fence in wait: either the waiter sees the new state or we see the waiter
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters_.load(std::memory_order_relaxed) == 0) return false;
+        //a waiter between its last check and cv_.wait holds the mutex, this waits for it to sleep
+        std::lock_guard<std::mutex> lock(mutex_);
+        return true;
+    }
 
   public:
-    explicit ThreadSafeQueue(size_t max_capacity)
-        : maximum_capacity_(max_capacity) {
-        ASSERT_WITH_MESSAGE(maximum_capacity_ > 0,
-                            "Queue capacity must be greater than 0");
+    //one state change lets one waiter proceed
+    void notify_one() {
+        if (has_waiters()) cv_.notify_one();
     }
 
-    ThreadSafeQueue(const ThreadSafeQueue &) = delete;
-    ThreadSafeQueue &operator=(const ThreadSafeQueue &) = delete;
+    void notify_all() {
+        if (has_waiters()) cv_.notify_all();
+    }
 
-    bool push(ElementType element) {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        queue_not_full_cv_.wait(lock, [this]() {
-            return internal_queue_.size() < maximum_capacity_ ||
-                   is_queue_closed_;
-        });
+    template <typename Predicate> void wait(Predicate ready) {
+        for (int i = 0; i < spin_count(); i++) {
+            if (ready()) return;
+            cpu_relax();
+        }
+        waiters_.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, ready);
+        }
+        waiters_.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
 
-        ASSERT_WITH_MESSAGE(!is_queue_closed_,
-                            "Attempt to push on a closed queue");
+//Bounded multi-producer multi-consumer ring buffer (Dmitry Vyukov's algorithm).
+//Every cell carries a sequence number telling whether it is ready to be written or read for the current lap,
+//so producers and consumers only contend on their own position counter. Capacity is rounded up to a power of 2.
+template <typename ElementType> class MPMCQueue {
+  private:
+    struct alignas(cache_line_size) Cell {
+        std::atomic<size_t> sequence;
+        ElementType data;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    const size_t mask_;
+    alignas(cache_line_size) std::atomic<size_t> enqueue_pos_{0};
+    alignas(cache_line_size) std::atomic<size_t> dequeue_pos_{0};
+    alignas(cache_line_size) std::atomic<bool> is_queue_closed_{false};
+    EventCount not_empty_;
+    EventCount not_full_;
 
-        ASSERT_WITH_MESSAGE(internal_queue_.size() < maximum_capacity_,
-                            "Queue full on push - unexpected state");
+    static size_t round_capacity(size_t capacity) {
+        size_t res = 1;
+        while (res < capacity) res <<= 1;
+        return res;
+    }
+
+    bool can_push() const {
+        const size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        return cells_[pos & mask_].sequence.load(std::memory_order_acquire) == pos;
+    }
 
-        internal_queue_.push(std::move(element));
-        lock.unlock();
-        queue_not_empty_cv_.notify_one();
+    bool can_pop() const {
+        const size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        return cells_[pos & mask_].sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+  public:
+    explicit MPMCQueue(size_t max_capacity)
+        : cells_(new Cell[round_capacity(max_capacity)]), mask_(round_capacity(max_capacity) - 1) {
+        ASSERT_WITH_MESSAGE(max_capacity > 0,
+                            "Queue capacity must be greater than 0");
+        for (size_t i = 0; i <= mask_; i++) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPMCQueue(const MPMCQueue &) = delete;
+    MPMCQueue &operator=(const MPMCQueue &) = delete;
+
+    //false if the queue is full
+    bool try_push(ElementType element) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+            if (dif == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data = std::move(element);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        not_empty_.notify_one();
         return true;
     }
 
-    std::optional<ElementType> pop() {
-        std::unique_lock<std::mutex> lock(queue_mutex_);
-        queue_not_empty_cv_.wait(lock, [this]() {
-            return !internal_queue_.empty() || is_queue_closed_;
-        });
+    //false if the queue is empty
+    bool try_pop(ElementType &element) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (dif == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        element = std::move(cell->data);
+        cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        not_full_.notify_one();
+        return true;
+    }
 
-        if (internal_queue_.empty()) {
-            return std::nullopt;
+    //blocks while the queue is full
+    bool push(ElementType element) {
+        ASSERT_WITH_MESSAGE(!is_closed(),
+                            "Attempt to push on a closed queue");
+        while (!try_push(element)) {
+            not_full_.wait([this]() { return can_push() || is_closed(); });
+            ASSERT_WITH_MESSAGE(!is_closed(),
+                                "Attempt to push on a closed queue");
         }
+        return true;
+    }
 
-        ElementType element = std::move(internal_queue_.front());
-        internal_queue_.pop();
-        lock.unlock();
-        queue_not_full_cv_.notify_one();
-        return element;
+    //blocks while the queue is empty, nullopt once it is closed and drained
+    std::optional<ElementType> pop() {
+        ElementType element;
+        while (true) {
+            if (try_pop(element)) return element;
+            if (is_closed()) {
+                //elements pushed before close are still delivered
+                if (try_pop(element)) return element;
+                return std::nullopt;
+            }
+            not_empty_.wait([this]() { return can_pop() || is_closed(); });
+        }
     }
 
     void close() {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        is_queue_closed_ = true;
-        queue_not_empty_cv_.notify_all();
-        queue_not_full_cv_.notify_all();
+        is_queue_closed_.store(true, std::memory_order_release);
+        not_empty_.notify_all();
+        not_full_.notify_all();
     }
 
-    bool is_closed() const {
-        std::lock_guard<std::mutex> lock(queue_mutex_);
-        return is_queue_closed_;
+    bool is_closed() const { return is_queue_closed_.load(std::memory_order_acquire); }
+    size_t capacity() const noexcept { return mask_ + 1; }
+
+    //number of elements, only a snapshot while other threads push and pop (for monitoring)
+    size_t size() const {
+        const size_t dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+        const size_t enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+        return std::min<size_t>(enqueued > dequeued ? enqueued - dequeued : 0, capacity());
     }
-    size_t capacity() const noexcept { return maximum_capacity_; }
 };
 
-template<typename T>
-class threadSet{
-    std::condition_variable_any com;
-    std::mutex lock;
-    std::set<T> data;
-public:
-    threadSet(const std::set<T>& in){
-        data = in;
-    }
-    void insert(const T& a){
-        lock.lock();
-        com.notify_one();
-        data.insert(a);
-        lock.unlock();
-    }
-    bool empty(){
-        lock.lock();
-        bool ret = data.empty();
-        lock.unlock();
-        return ret;
-    }
-    T pop(){
-        //return the lowest element
-        lock.lock();
-        while (data.empty()){
-            com.wait(lock);
-        }
-        T ret = *data.begin();
-        data.erase(ret);
-        lock.unlock();
-        return ret;
+//Fixed set of reusable resources (frame buffers, stream indices). acquire blocks until one is free.
+template <typename T> class BufferPool {
+  private:
+    MPMCQueue<T> free_items_;
+    const size_t size_;
+
+  public:
+    explicit BufferPool(const std::vector<T> &items)
+        : free_items_(std::max<size_t>(items.size(), 1)), size_(items.size()) {
+        for (const T &item : items) free_items_.try_push(item);
     }
+
+    T acquire() { return *free_items_.pop(); }
+
+    //the ring has room for every item of the pool, but a consumer descheduled in the middle of a pop
+    //keeps its cell busy for one lap, so this may still have to wait briefly
+    void release(T item) { free_items_.push(std::move(item)); }
+
+    size_t size() const { return size_; }
+    //items currently acquired, a snapshot (for monitoring)
+    size_t in_use() const { return size_ - std::min(size_, free_items_.size()); }
 };
 
-template<typename T>
-class ClosableThreadSet{
-    std::condition_variable_any com;
-    std::mutex lock;
-    std::set<T> data;
-    bool closed = false;
-public:
-    ClosableThreadSet(const std::set<T>& in){
-        data = in;
-    }
-    void insert(const T& a){
-        lock.lock();
-        if (closed) std::cerr << "Error: something inserted into a closed threadset. That likely means something is wrong" << std::endl;
-        com.notify_one();
-        data.insert(a);
-        lock.unlock();
-    }
-    bool empty(){
-        lock.lock();
-        bool ret = data.empty();
-        lock.unlock();
-        return ret;
-    }
-    std::optional<T> pop(){
-        //return the lowest element
-        lock.lock();
-        if (closed) return std::nullopt;
-        while (data.empty()){
-            com.wait(lock);
-            if (closed) return std::nullopt;
-        }
-        T ret = *data.begin();
-        data.erase(ret);
-        lock.unlock();
-        return ret;
+//Results keyed by frame index. Workers publish results in any order without locking, the single consumer
+//receives them in completion order through pop() and ordered_prefix() tells how many leading frames are
+//settled, which lets writers emit in frame order. Frames that will never get a result are marked missing
+//so they do not block the ordered prefix.
+template <typename T> class ReorderBuffer {
+  private:
+    enum SlotState : uint8_t { Pending = 0, Ready = 1, Missing = 2 };
+    struct Slot {
+        std::atomic<uint8_t> state{Pending};
+        T value;
+    };
+
+    std::unique_ptr<Slot[]> slots_;
+    const int64_t count_;
+    MPMCQueue<int64_t> arrivals_;
+    int64_t prefix_ = 0; //consumer side only
+
+    void publish(int64_t index, SlotState state) {
+        ASSERT_WITH_MESSAGE(index >= 0 && index < count_, "Reorder buffer index out of range");
+        slots_[index].state.store(state, std::memory_order_release);
+        arrivals_.push(index);
     }
-    void close(){
-        lock.lock();
-        closed = true;
-        com.notify_all();
-        lock.unlock();
+
+  public:
+    explicit ReorderBuffer(int64_t count)
+        : slots_(new Slot[std::max<int64_t>(count, 1)]), count_(count), arrivals_(std::max<int64_t>(count, 1)) {}
+
+    ReorderBuffer(const ReorderBuffer &) = delete;
+    ReorderBuffer &operator=(const ReorderBuffer &) = delete;
+
+    void push(int64_t index, T value) {
+        slots_[index].value = std::move(value);
+        publish(index, Ready);
     }
+
+    void mark_missing(int64_t index) { publish(index, Missing); }
+
+    //next settled index in completion order, nullopt once closed and drained
+    std::optional<int64_t> pop() { return arrivals_.pop(); }
+
+    void close() { arrivals_.close(); }
+
+    //results published but not popped by the consumer yet, a snapshot (for monitoring)
+    size_t backlog() const { return arrivals_.size(); }
+
+    bool has_value(int64_t index) const {
+        return slots_[index].state.load(std::memory_order_acquire) == Ready;
+    }
+    const T &value(int64_t index) const { return slots_[index].value; }
+
+    //has a result or is missing
+    bool is_settled(int64_t index) const {
+        return slots_[index].state.load(std::memory_order_acquire) != Pending;
+    }
+
+    //number of leading frames that have a result or are missing
+    int64_t ordered_prefix() {
+        while (prefix_ < count_ && slots_[prefix_].state.load(std::memory_order_acquire) != Pending) prefix_++;
+        return prefix_;
+    }
+
+    int64_t size() const { return count_; }
 };
@@ -2,6 +2,7 @@
 #define FLOAT3OPHPP
 
 #include "sycl/sycl.hpp"
+#include "kerneltrace.hpp"
 
 inline float tothe4th(float x){
     x = x*x;
@@ -45,7 +46,7 @@ void multarray(sycl::queue& q, float* src1, float* src2, float* dst, int64_t wid
     int64_t th_x = std::min((int64_t)256, width);
     int64_t bl_x = (width - 1) / th_x + 1;
           
-    q.submit([&](sycl::handler& h) {
+    helper::traceCommand("multarray", q, q.submit([&](sycl::handler& h) {
         h.parallel_for(
             sycl::nd_range<1>(sycl::range<1>(bl_x * th_x),
                             sycl::range<1>(th_x)),
@@ -56,7 +57,7 @@ void multarray(sycl::queue& q, float* src1, float* src2, float* dst, int64_t wid
                 }
             }
         );
-    });
+    }));
 
 }
 
@@ -64,7 +65,7 @@ void subarray(sycl::queue& q, float* src1, float* src2, float* dst, int64_t widt
     int64_t th_x = std::min((int64_t)256, width);
     int64_t bl_x = (width - 1) / th_x + 1;
           
-    q.submit([&](sycl::handler& h) {
+    helper::traceCommand("subarray", q, q.submit([&](sycl::handler& h) {
         h.parallel_for(
             sycl::nd_range<1>(sycl::range<1>(bl_x * th_x),
                             sycl::range<1>(th_x)),
@@ -75,7 +76,7 @@ void subarray(sycl::queue& q, float* src1, float* src2, float* dst, int64_t widt
                 }
             }
         );
-    });
+    }));
 }
 
 template <InputMemType T>
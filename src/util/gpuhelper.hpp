@@ -1,6 +1,10 @@
 #ifndef GPUHELPERHPP
 #define GPUHELPERHPP
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
 #include "preprocessor.hpp"
 #include "VshipExceptions.hpp"
 
@@ -10,6 +14,7 @@
 
 //GPU 0: {GPU Name}
 //...
+//CPU n: {CPU Name} (SYCL CPU devices come after every GPU)
 
 //case where gpu_id is specified:
 
@@ -26,8 +31,78 @@
 
 namespace helper{
 
+    //per user directory where vscycle keeps its caches (kernels, tuning), empty if none can be determined
+    std::string cacheDirectory(){
+#ifdef _WIN32
+        const char* base = std::getenv("LOCALAPPDATA");
+        if (base == NULL) return "";
+        return std::string(base) + "\\vscycle";
+#else
+        const char* xdg = std::getenv("XDG_CACHE_HOME");
+        const char* home = std::getenv("HOME");
+        if (xdg != NULL && xdg[0] != '\0') return std::string(xdg) + "/vscycle";
+        if (home != NULL) return std::string(home) + "/.cache/vscycle";
+        return "";
+#endif
+    }
+
+    //has to be called before the first SYCL call, the runtime reads these once at initialization.
+    //JIT compiled device images are then reused across processes instead of being rebuilt at every start
+    void enablePersistentKernelCache(){
+        if (std::getenv("SYCL_CACHE_PERSISTENT") != NULL) return; //user already decided
+
+        std::string cachedir;
+        const char* user_dir = std::getenv("VSCYCLE_KERNEL_CACHE");
+        if (user_dir != NULL){
+            cachedir = user_dir;
+            if (cachedir == "0") return;
+        } else {
+            cachedir = cacheDirectory();
+            if (cachedir.empty()) return;
+        }
+
+#ifdef _WIN32
+        _putenv_s("SYCL_CACHE_PERSISTENT", "1");
+        if (std::getenv("SYCL_CACHE_DIR") == NULL) _putenv_s("SYCL_CACHE_DIR", cachedir.c_str());
+#else
+        setenv("SYCL_CACHE_PERSISTENT", "1", 0);
+        setenv("SYCL_CACHE_DIR", cachedir.c_str(), 0);
+#endif
+    }
+
+    //device memory currently allocated by the metric implementations of this process, in bytes (--metrics)
+    std::atomic<int64_t>& deviceBytesInUse(){
+        static std::atomic<int64_t> bytes{0};
+        return bytes;
+    }
+
+#ifndef VSHIP_NO_SYCL
+    //executes func only the first time a given device is seen in this process
+    //(the registry is static to each instantiation, so each calling lambda has its own)
+    template <typename F>
+    void runOncePerDevice(const sycl::device& dev, F func){
+        static std::mutex devices_lock;
+        static std::vector<sycl::device> done_devices;
+
+        std::lock_guard<std::mutex> guard(devices_lock);
+        for (const auto& d : done_devices){
+            if (d == dev) return;
+        }
+        func();
+        done_devices.push_back(dev);
+    }
+
+    //GPUs first so that gpu_id keeps its meaning, then CPU devices which get the barrier-free kernels
+    std::vector<sycl::device> getDevices(){
+        std::vector<sycl::device> devices = sycl::device::get_devices(sycl::info::device_type::gpu);
+        for (const auto& dev : sycl::device::get_devices(sycl::info::device_type::cpu)){
+            devices.push_back(dev);
+        }
+        return devices;
+    }
+
     int checkGpuCount(){
-        auto devices = sycl::device::get_devices(sycl::info::device_type::gpu);
+        auto devices = getDevices();
         int count = static_cast<int>(devices.size());
         if (count == 0) {
             VSHIP_THROW(NoDeviceDetected);
@@ -72,7 +147,7 @@ namespace helper{
     }
 
     void gpuFullCheck(int gpuid = 0){
-        auto devices = sycl::device::get_devices(sycl::info::device_type::gpu);
+        auto devices = getDevices();
         int count = checkGpuCount();
 
         if (count <= gpuid || gpuid < 0){
@@ -86,14 +161,22 @@ namespace helper{
 
     std::string listGPU() {
         std::stringstream ss;
-        auto devices = sycl::device::get_devices(sycl::info::device_type::gpu);
+        auto devices = getDevices();
 
         for (size_t i = 0; i < devices.size(); i++) {
-            ss << "GPU " << i << ": " << devices[i].get_info<sycl::info::device::name>() << std::endl;
+            ss << (devices[i].is_cpu() ? "CPU " : "GPU ") << i << ": " << devices[i].get_info<sycl::info::device::name>() << std::endl;
         }
 
         return ss.str();
     }
+#else
+    //builds without SYCL only have the native CPU implementation
+    std::string listGPU() {
+        std::stringstream ss;
+        ss << "CPU 0: native implementation (" << std::max(1u, std::thread::hardware_concurrency()) << " threads)" << std::endl;
+        return ss.str();
+    }
+#endif
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+namespace helper{
+
+//XXH64 (https://github.com/Cyan4973/xxHash), one shot version
+namespace xxh64_detail{
+    constexpr uint64_t P1 = 11400714785074694791ULL;
+    constexpr uint64_t P2 = 14029467366897019727ULL;
+    constexpr uint64_t P3 = 1609587929392839161ULL;
+    constexpr uint64_t P4 = 9650029242287828579ULL;
+    constexpr uint64_t P5 = 2870177450012600261ULL;
+
+    inline uint64_t rotl(uint64_t x, int r){ return (x << r) | (x >> (64 - r)); }
+    inline uint64_t read64(const uint8_t* p){ uint64_t v; std::memcpy(&v, p, 8); return v; } //little endian hosts only
+    inline uint32_t read32(const uint8_t* p){ uint32_t v; std::memcpy(&v, p, 4); return v; }
+
+    inline uint64_t round(uint64_t acc, uint64_t input){
+        acc += input * P2;
+        acc = rotl(acc, 31);
+        return acc * P1;
+    }
+
+    inline uint64_t merge(uint64_t acc, uint64_t val){
+        acc ^= round(0, val);
+        return acc * P1 + P4;
+    }
+}
+
+inline uint64_t xxh64(const void* data, size_t len, uint64_t seed = 0){
+    using namespace xxh64_detail;
+    const uint8_t* p = (const uint8_t*)data;
+    const uint8_t* const end = p + len;
+    uint64_t h;
+
+    if (len >= 32){
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        const uint8_t* const limit = end - 32;
+        do {
+            v1 = round(v1, read64(p)); p += 8;
+            v2 = round(v2, read64(p)); p += 8;
+            v3 = round(v3, read64(p)); p += 8;
+            v4 = round(v4, read64(p)); p += 8;
+        } while (p <= limit);
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge(h, v1);
+        h = merge(h, v2);
+        h = merge(h, v3);
+        h = merge(h, v4);
+    } else {
+        h = seed + P5;
+    }
+
+    h += (uint64_t)len;
+
+    while (p + 8 <= end){
+        h ^= round(0, read64(p));
+        h = rotl(h, 27) * P1 + P4;
+        p += 8;
+    }
+    if (p + 4 <= end){
+        h ^= (uint64_t)read32(p) * P1;
+        h = rotl(h, 23) * P2 + P3;
+        p += 4;
+    }
+    while (p < end){
+        h ^= (*p) * P5;
+        h = rotl(h, 11) * P1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+inline uint64_t xxh64(const std::string& str, uint64_t seed = 0){
+    return xxh64(str.data(), str.size(), seed);
+}
+
+//Content fingerprint of a file that does not read all of it: the size, the first and last MiB
+//and 64 blocks of 64 KiB spread over the rest. Two encodes of the same source differ everywhere,
+//so this tells them apart while costing a few MiB of reads even on huge files. 0 if unreadable.
+inline uint64_t fileFingerprint(const std::string& path){
+    std::error_code ec;
+    const int64_t size = (int64_t)std::filesystem::file_size(path, ec);
+    if (ec) return 0;
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) return 0;
+
+    uint64_t h = xxh64(&size, sizeof(size));
+
+    const int64_t edge = 1 << 20;
+    const int64_t block = 1 << 16;
+    std::vector<uint8_t> buffer(edge);
+
+    auto hash_range = [&](int64_t offset, int64_t len){
+        len = std::min(len, size - offset);
+        if (len <= 0) return;
+#ifdef _WIN32
+        _fseeki64(file, offset, SEEK_SET);
+#else
+        fseeko(file, offset, SEEK_SET);
+#endif
+        const size_t got = std::fread(buffer.data(), 1, len, file);
+        h = xxh64(buffer.data(), got, h);
+    };
+
+    if (size <= 2*edge + 64*block){
+        for (int64_t offset = 0; offset < size; offset += edge) hash_range(offset, edge);
+    } else {
+        hash_range(0, edge);
+        const int64_t inner = size - 2*edge - block;
+        for (int i = 0; i < 64; i++) hash_range(edge + inner*i/63, block);
+        hash_range(size - edge, edge);
+    }
+
+    std::fclose(file);
+    return h;
+}
+
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#ifndef VSHIP_NO_SYCL
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "sycl/sycl.hpp"
+
+namespace helper{
+
+//VSCYCLE_TRACE=path: queues created with queueProperties get enable_profiling and every command passed
+//to traceCommand is written to path with its name and device start and end times, as Chrome/Perfetto
+//trace events (one track per queue). The file uses the JSON array format, which the viewers still load
+//when the process was killed before closing it. Without the variable tracing costs a branch per command.
+//The times of the last commands are only read by flush or close, which the programs call once their work is
+//done: the trace is a static and its destructor runs too late to query the SYCL runtime, it writes nothing.
+class KernelTrace{
+    struct Pending{
+        const char* name;
+        sycl::event event;
+        int track;
+    };
+
+    //events are resolved in batches, well after they were submitted, so that reading their times does not wait on the device
+    static constexpr size_t batch = 4096;
+
+    std::mutex mutex;
+    std::ofstream out;
+    std::deque<Pending> pending;
+    std::unordered_map<size_t, int> tracks; //queue hash to track
+    bool active = false;
+    bool first = true;
+
+    KernelTrace(){
+        const char* path = std::getenv("VSCYCLE_TRACE");
+        if (path == nullptr || *path == '\0') return;
+        out.open(path, std::ios::binary | std::ios::trunc);
+        if (!out){
+            std::cerr << "VSCYCLE_TRACE: cannot write [" << path << "], tracing is disabled" << std::endl;
+            return;
+        }
+        out << "[\n";
+        active = true;
+    }
+
+    //device timestamps in microseconds, the unit of the trace format
+    void writePending(size_t count){
+        for (size_t i = 0; i < count; i++){
+            const Pending& command = pending.front();
+            try {
+                const uint64_t start = command.event.get_profiling_info<sycl::info::event_profiling::command_start>();
+                const uint64_t end = command.event.get_profiling_info<sycl::info::event_profiling::command_end>();
+                out << (first ? "" : ",\n") << "{\"name\":\"" << command.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << command.track
+                    << ",\"ts\":" << std::fixed << start / 1000.0 << ",\"dur\":" << (end - start) / 1000.0 << "}";
+                first = false;
+            } catch (const sycl::exception&){
+                //command that failed or whose backend gives no times, it is left out
+            }
+            pending.pop_front();
+        }
+        out.flush();
+    }
+
+public:
+    KernelTrace(const KernelTrace&) = delete;
+    KernelTrace& operator=(const KernelTrace&) = delete;
+
+    static KernelTrace& get(){
+        static KernelTrace trace;
+        return trace;
+    }
+
+    bool enabled() const {
+        return active;
+    }
+
+    //writes every command recorded so far, tracing goes on
+    void flush(){
+        if (!active) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        writePending(pending.size());
+    }
+
+    //flush and end the file, later commands are not traced
+    void close(){
+        if (!active) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        writePending(pending.size());
+        out << "\n]\n";
+        out.close();
+        active = false;
+    }
+
+    void record(const char* name, const sycl::queue& q, const sycl::event& event){
+        if (!q.has_property<sycl::property::queue::enable_profiling>()) return;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!active) return;
+        const auto inserted = tracks.emplace(std::hash<sycl::queue>{}(q), (int)tracks.size());
+        pending.push_back({name, event, inserted.first->second});
+        if (pending.size() >= 2*batch) writePending(batch);
+    }
+};
+
+//in_order, with enable_profiling when profiling is asked for or VSCYCLE_TRACE is set
+inline sycl::property_list queueProperties(bool profiling = false){
+    if (profiling || KernelTrace::get().enabled()){
+        return sycl::property_list{sycl::property::queue::in_order{}, sycl::property::queue::enable_profiling{}};
+    }
+    return sycl::property_list{sycl::property::queue::in_order{}};
+}
+
+//names a submitted command in the VSCYCLE_TRACE output, returns its event
+inline sycl::event traceCommand(const char* name, const sycl::queue& q, sycl::event event){
+    KernelTrace& trace = KernelTrace::get();
+    if (trace.enabled()) trace.record(name, q, event);
+    return event;
+}
+
+}
+
+#endif
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace helper{
+
+//Whole file memory mapping, either created read-write with a given size or opened read only.
+//Pages are shared with the file: what is written through data() ends up in it.
+class MappedFile{
+    uint8_t* ptr = nullptr;
+    size_t length = 0;
+    bool writable = false;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#else
+    int fd = -1;
+#endif
+
+    bool map(){
+#ifdef _WIN32
+        mapping = CreateFileMappingA(file, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, (DWORD)((uint64_t)length >> 32), (DWORD)length, NULL);
+        if (mapping == NULL) return false;
+        ptr = (uint8_t*)MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, length);
+        return ptr != nullptr;
+#else
+        void* res = mmap(nullptr, length, writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+        if (res == MAP_FAILED) return false;
+        ptr = (uint8_t*)res;
+        return true;
+#endif
+    }
+
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile(){
+        close();
+    }
+
+    //the file is truncated or extended to size bytes, new bytes are zero
+    bool create(const std::string& path, size_t size){
+        close();
+        writable = true;
+        length = size;
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        if (ftruncate(fd, (off_t)size) != 0){
+            close();
+            return false;
+        }
+#endif
+        if (!map()){
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    bool open_read(const std::string& path){
+        close();
+        writable = false;
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0){
+            close();
+            return false;
+        }
+        length = (size_t)size.QuadPart;
+#else
+        fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0){
+            close();
+            return false;
+        }
+        length = (size_t)st.st_size;
+#endif
+        if (!map()){
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    //writes the dirty pages back and waits for the disk
+    bool sync(){
+        if (ptr == nullptr || !writable) return ptr != nullptr;
+#ifdef _WIN32
+        return FlushViewOfFile(ptr, 0) && FlushFileBuffers(file);
+#else
+        return msync(ptr, length, MS_SYNC) == 0;
+#endif
+    }
+
+    void close(){
+#ifdef _WIN32
+        if (ptr != nullptr) UnmapViewOfFile(ptr);
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = NULL;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (ptr != nullptr) munmap(ptr, length);
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+        ptr = nullptr;
+        length = 0;
+    }
+
+    uint8_t* data() const {
+        return ptr;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
+
+}
@@ -15,7 +15,10 @@
 #include <mutex>
 #include <condition_variable>
 #include <cassert>
+//VSHIP_NO_SYCL: build without any SYCL runtime, only the native CPU implementation (ssimu2cpu) is available
+#ifndef VSHIP_NO_SYCL
 #include "sycl/sycl.hpp"
+#endif
 
 #ifdef _WIN32
     #define aligned_alloc(a, b) malloc(b)
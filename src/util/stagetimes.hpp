@@ -0,0 +1,32 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#ifndef VSHIP_NO_SYCL
+#include "sycl/sycl.hpp"
+#endif
+
+namespace helper{
+
+//Where the time of one score computation went, in nanoseconds, for profiling. upload: host to device
+//copies (device time from SYCL event profiling, 0 on the native cpu backend). reduce: copy back of the
+//partial sums and host side reduction. compute: the rest of the call, conversions and kernels.
+struct StageTimes{
+    int64_t upload = 0;
+    int64_t compute = 0;
+    int64_t reduce = 0;
+};
+
+inline int64_t elapsedNanoseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+#ifndef VSHIP_NO_SYCL
+//device time of a finished command, its queue must have been created with enable_profiling
+inline int64_t eventNanoseconds(const sycl::event& event){
+    return (int64_t)(event.get_profiling_info<sycl::info::event_profiling::command_end>()
+                   - event.get_profiling_info<sycl::info::event_profiling::command_start>());
+}
+#endif
+
+}
@@ -0,0 +1,181 @@
+#ifndef THREADPOOLHPP
+#define THREADPOOLHPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace helper{
+
+//Fixed set of worker threads executing parallel_for jobs. Several threads may call parallel_for at the same time
+//(one per frame in flight), their jobs are served in submission order and the calling thread always works
+//on its own job too, so a job progresses even when every worker is busy elsewhere.
+//Only the first active() workers take jobs, which lets the number of cores used change at runtime.
+class ThreadPool{
+    struct Job{
+        std::function<void(int64_t)> func;
+        int64_t count;
+        std::atomic<int64_t> next{0};
+        std::atomic<int64_t> done{0};
+        std::exception_ptr error;
+        std::mutex lock;
+        std::condition_variable finished;
+    };
+
+public:
+    explicit ThreadPool(int threadnum){
+        if (threadnum < 1) threadnum = 1;
+        active = threadnum;
+        for (int i = 0; i < threadnum; i++){
+            workers.emplace_back([this, i](){ workerLoop(i); });
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool(){
+        {
+            std::lock_guard<std::mutex> guard(queue_lock);
+            stopping = true;
+        }
+        queue_cv.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    int size() const {
+        return static_cast<int>(workers.size());
+    }
+
+    int activeThreads() const {
+        return active.load();
+    }
+
+    //workers past count finish their current job and then sleep until they are active again
+    void setActiveThreads(int count){
+        {
+            std::lock_guard<std::mutex> guard(queue_lock);
+            active = std::max(1, std::min(count, size()));
+        }
+        queue_cv.notify_all();
+    }
+
+#ifdef __linux__
+    //worker i only runs on cpus[i % cpus.size()], false if the system refused
+    bool pinWorkers(const std::vector<int>& cpus){
+        if (cpus.empty()) return false;
+        bool pinned = true;
+        for (size_t i = 0; i < workers.size(); i++){
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i % cpus.size()], &set);
+            pinned = pthread_setaffinity_np(workers[i].native_handle(), sizeof(set), &set) == 0 && pinned;
+        }
+        return pinned;
+    }
+#endif
+
+    //calls func(i) for every i in [0, count) and returns once all of them are done.
+    //The first exception thrown by func is rethrown here after the remaining indices ran
+    void parallel_for(int64_t count, const std::function<void(int64_t)>& func){
+        if (count <= 0) return;
+        if (count == 1){
+            func(0);
+            return;
+        }
+
+        auto job = std::make_shared<Job>();
+        job->func = func;
+        job->count = count;
+        {
+            std::lock_guard<std::mutex> guard(queue_lock);
+            jobs.push_back(job);
+        }
+        queue_cv.notify_all();
+
+        work(*job);
+
+        std::unique_lock<std::mutex> guard(job->lock);
+        job->finished.wait(guard, [&](){ return job->done.load() == job->count; });
+        if (job->error) std::rethrow_exception(job->error);
+    }
+
+    //process wide pool with one thread per hardware thread unless setSharedSize said otherwise, created on first use
+    static ThreadPool& shared(){
+        static ThreadPool pool(sharedSize());
+        return pool;
+    }
+
+    //only effective before the first call to shared()
+    static void setSharedSize(int threadnum){
+        sharedSize() = std::max(1, threadnum);
+    }
+
+private:
+    //takes indices of job until none is left
+    void work(Job& job){
+        while (true){
+            const int64_t i = job.next.fetch_add(1);
+            if (i >= job.count) return;
+            try {
+                job.func(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> guard(job.lock);
+                if (!job.error) job.error = std::current_exception();
+            }
+            if (job.done.fetch_add(1) + 1 == job.count){
+                std::lock_guard<std::mutex> guard(job.lock);
+                job.finished.notify_all();
+            }
+        }
+    }
+
+    static int& sharedSize(){
+        static int size = std::max(1u, std::thread::hardware_concurrency());
+        return size;
+    }
+
+    void workerLoop(int index){
+        while (true){
+            std::shared_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> guard(queue_lock);
+                queue_cv.wait(guard, [&](){ return stopping || (!jobs.empty() && index < active.load()); });
+                if (jobs.empty()) return; //stopping
+                job = jobs.front();
+                //every index handed out: nobody else needs to find this job anymore
+                if (job->next.load() >= job->count){
+                    jobs.pop_front();
+                    continue;
+                }
+            }
+            work(*job);
+            std::lock_guard<std::mutex> guard(queue_lock);
+            if (!jobs.empty() && jobs.front() == job) jobs.pop_front();
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::deque<std::shared_ptr<Job>> jobs;
+    std::mutex queue_lock;
+    std::condition_variable queue_cv;
+    std::atomic<int> active{1};
+    bool stopping = false;
+};
+
+}
+
+#endif
@@ -5,6 +5,10 @@
 #include "util/gpuhelper.hpp"
 
 static void VS_CC GpuInfo(const VSMap *in, VSMap *out, void *userData, VSCore *core, const VSAPI *vsapi) {
+#ifdef VSHIP_NO_SYCL
+    const std::string info = helper::listGPU();
+    vsapi->mapSetData(out, "gpu_human_data", info.data(), info.size(), dtUtf8, maReplace);
+#else
     std::stringstream ss;
     int count, device;
 
@@ -27,13 +31,13 @@ static void VS_CC GpuInfo(const VSMap *in, VSMap *out, void *userData, VSCore *c
         return;
     }
 
-    auto devices = sycl::device::get_devices(sycl::info::device_type::gpu);
+    auto devices = helper::getDevices();
 
     if (error != peSuccess){
         //no gpu_id was selected
         for (int i = 0; i < count; i++){
             const auto& dev = devices[i];
-            ss << "GPU " << i << ": " << dev.get_info<sycl::info::device::name>() << std::endl;
+            ss << (dev.is_cpu() ? "CPU " : "GPU ") << i << ": " << dev.get_info<sycl::info::device::name>() << std::endl;
         }
     } else {
         const auto& dev = devices[gpuid];
@@ -45,7 +49,7 @@ static void VS_CC GpuInfo(const VSMap *in, VSMap *out, void *userData, VSCore *c
         //ss << "MemoryBusWidth: " << dev.get_info<sycl::info::device::global_mem_cache_line_size>()*8 << " bits" << std::endl;
         ss << "Integrated: " << dev.is_cpu() << std::endl; // True if integrated (CPU) device
         try {
-            sycl::queue q{sycl::queue{sycl::gpu_selector_v}};
+            sycl::queue q{dev};
             int res = helper::gpuKernelCheck(q);
             ss << "PassKernelCheck : " << res << std::endl;
         } catch (const VshipError&) {
@@ -54,11 +58,13 @@ static void VS_CC GpuInfo(const VSMap *in, VSMap *out, void *userData, VSCore *c
         }
     }
     vsapi->mapSetData(out, "gpu_human_data", ss.str().data(), ss.str().size(), dtUtf8, maReplace);
+#endif
 }
 
 VS_EXTERNAL_API(void) VapourSynthPluginInit2(VSPlugin *plugin, const VSPLUGINAPI *vspapi) {
+    helper::enablePersistentKernelCache();
     vspapi->configPlugin("com.swarejonge.vscycle", "vscycle", "VapourSynth SSIMULACRA2 on GPU", VS_MAKE_VERSION(3, 2), VAPOURSYNTH_API_VERSION, 0, plugin);
-    vspapi->registerFunction("SSIMULACRA2", "reference:vnode;distorted:vnode;numStream:int:opt;gpu_id:int:opt;", "clip:vnode;", ssimu2::ssimulacra2Create, NULL, plugin);
+    vspapi->registerFunction("SSIMULACRA2", "reference:vnode;distorted:vnode;numStream:int:opt;gpu_id:int:opt;autotune:int:opt;backend:data:opt;threshold:float:opt;left:int:opt;top:int:opt;width:int:opt;height:int:opt;", "clip:vnode;", ssimu2::ssimulacra2Create, NULL, plugin);
     //vspapi->registerFunction("BUTTERAUGLI", "reference:vnode;distorted:vnode;intensity_multiplier:float:opt;distmap:int:opt;numStream:int:opt;gpu_id:int:opt;", "clip:vnode;", butter::butterCreate, NULL, plugin);
     vspapi->registerFunction("GpuInfo", "gpu_id:int:opt;", "gpu_human_data:data;", GpuInfo, NULL, plugin);
 }